@@ -26,6 +26,9 @@
 
 #include "objc-weak.h"
 #include "llvm-DenseMap.h"
+#if SUPPORT_SWISS_REFCOUNTS
+#include "objc-swissmap.h"
+#endif
 #include "NSObject.h"
 
 #include <malloc/malloc.h>
@@ -39,6 +42,7 @@
 #include <libkern/OSAtomic.h>
 #include <Block.h>
 #include <map>
+#include <algorithm>
 #include <execinfo.h>
 
 @interface NSInvocation
@@ -134,14 +138,26 @@ namespace {
 
 // RefcountMap disguises its pointers because we 
 // don't want the table to act as a root for `leaks`.
+#if SUPPORT_SWISS_REFCOUNTS
+typedef objc::SwissMap<DisguisedPtr<objc_object>,size_t,true> RefcountMap;
+#else
 typedef objc::DenseMap<DisguisedPtr<objc_object>,size_t,true> RefcountMap;
+#endif
+
+typedef spinlock_tt<LOCKCLASS_SIDETABLE> SideTableLock;
+
+// Minimum number of retain count entries released between checks
+// of whether a side table's RefcountMap should shrink.
+#define REFCNT_SHRINK_INTERVAL 1024
 
 struct SideTable {
-    spinlock_t slock;
+    SideTableLock slock;
     RefcountMap refcnts;
     weak_table_t weak_table;
+    // Entries erased or zeroed since refcnts was last checked.
+    size_t refcntsReleased;
 
-    SideTable() {
+    SideTable() : refcntsReleased(0) {
         memset(&weak_table, 0, sizeof(weak_table));
     }
 
@@ -153,6 +169,22 @@ struct SideTable {
     void unlock() { slock.unlock(); }
     bool trylock() { return slock.trylock(); }
 
+    // Called with the lock held when a retain count entry was erased or
+    // its count dropped to zero. Only the dealloc and side table borrow 
+    // paths call this, never the retain/release fast path.
+    // shrinkIfSparse() scans every bucket. A scan that does not shrink 
+    // means at least 1/8 of the buckets are in use, so waiting for as 
+    // many releases as there are entries bounds the cost per release.
+    void refcntReleased() {
+        if (++refcntsReleased < std::max<size_t>(refcnts.size(), 
+                                                 REFCNT_SHRINK_INTERVAL))
+        {
+            return;
+        }
+        refcntsReleased = 0;
+        refcnts.shrinkIfSparse();
+    }
+
     // Address-ordered lock discipline for a pair of side tables.
 
     template<bool HaveOld, bool HaveNew>
@@ -161,10 +193,14 @@ struct SideTable {
     static void unlockTwo(SideTable *lock1, SideTable *lock2);
 };
 
+static inline SideTableLock& lockForStripe(SideTable& table) {
+    return table.slock;
+}
+
 
 template<>
 void SideTable::lockTwo<true, true>(SideTable *lock1, SideTable *lock2) {
-    spinlock_t::lockTwo(&lock1->slock, &lock2->slock);
+    SideTableLock::lockTwo(&lock1->slock, &lock2->slock);
 }
 
 template<>
@@ -179,7 +215,7 @@ void SideTable::lockTwo<false, true>(SideTable *, SideTable *lock2) {
 
 template<>
 void SideTable::unlockTwo<true, true>(SideTable *lock1, SideTable *lock2) {
-    spinlock_t::unlockTwo(&lock1->slock, &lock2->slock);
+    SideTableLock::unlockTwo(&lock1->slock, &lock2->slock);
 }
 
 template<>
@@ -198,7 +234,7 @@ void SideTable::unlockTwo<false, true>(SideTable *, SideTable *lock2) {
 // libc calls us before our C++ initializers run. We also don't want a global 
 // pointer to this struct because of the extra indirection.
 // Do it the hard way.
-alignas(sizeof(StripedMap<SideTable>)) static uint8_t
+alignas(StripedMap<SideTable>) static uint8_t
     SideTableBuf[sizeof(StripedMap<SideTable>)];
 
 static void SideTableInit() {
@@ -446,6 +482,9 @@ objc_loadWeakRetained(id *location)
     id result;
 
     SideTable *table;
+
+    // Most loads need neither the side table lock nor the weak table.
+    if (weak_read_unlocked(location, &result)) return result;
     
  retry:
     result = *location;
@@ -531,14 +570,30 @@ objc_moveWeak(id *dst, id *src)
      an autorelease pool boundary.
    A pool token is a pointer to the POOL_SENTINEL for that pool. When 
      the pool is popped, every object hotter than the sentinel is released.
+   Autoreleasing the object that is already on top of the stack again 
+     stores a repeat count in the next slot instead of another copy of the 
+     pointer. Repeat counts have the low bit set, which object pointers 
+     in the pool never do.
    The stack is divided into a doubly-linked list of pages. Pages are added 
      and deleted as necessary. 
    Thread-local storage points to the hot page, where newly autoreleased 
      objects are stored. 
+   Freed pages are kept for reuse: a few in a per-thread cache, and more 
+     in a global pool that other threads allocate from once 
+     their own cache is empty. A thread's cache goes to the global pool 
+     when the thread exits.
 **********************************************************************/
 
 BREAKPOINT_FUNCTION(void objc_autoreleaseNoPool(id obj));
 
+// Free autorelease pool pages kept by one thread, in _objc_pthread_data.
+// The pages are linked through their first word.
+struct autorelease_page_cache_t {
+    void *pages;
+    uint32_t count;
+    objc_autorelease_page_statistics_t stats;
+};
+
 namespace {
 
 struct magic_t {
@@ -584,13 +639,30 @@ class AutoreleasePoolPage
 #define POOL_SENTINEL nil
     static pthread_key_t const key = AUTORELEASE_POOL_KEY;
     static uint8_t const SCRIBBLE = 0xA3;  // 0xA3A3A3A3 after releasing
-    static size_t const SIZE = 
+    // Size and alignment of every page, a power of 2. PAGE_MAX_SIZE 
+    // unless OBJC_AUTORELEASE_POOL_PAGE_SIZE selects another size. 
+    // Set once by init() and never changed, because pageForPointer() 
+    // relies on every page having the same size.
+    static size_t SIZE;
+    static size_t COUNT;
+    static size_t const MIN_SIZE = 
 #if PROTECT_AUTORELEASEPOOL
         PAGE_MAX_SIZE;  // must be multiple of vm page size
 #else
-        PAGE_MAX_SIZE;  // size and alignment, power of 2 . i386下是4K的大小
+        4096;
 #endif
-    static size_t const COUNT = SIZE / sizeof(id);
+    static size_t const MAX_SIZE = 2*1024*1024;
+    // OBJC_USE_POOL_SUPERPAGES backs pages of this size with superpages.
+    static size_t const SUPERPAGE_SIZE = 2*1024*1024;
+    // Entries popped together by releaseUntil(). Kept small because 
+    // the copy is on the stack of every nested pop during a drain.
+    static size_t const DRAIN_CHUNK = 64;
+    // Copies of one repeated object released together.
+    static size_t const RELEASE_BATCH = 32;
+    // A repeat count slot holds (count << 1) | REPEAT_TAG, meaning 
+    // the object below it was autoreleased count more times.
+    static uintptr_t const REPEAT_TAG = 1;
+    static uintptr_t const REPEAT_ONE = 2;
 
     magic_t const magic;                    //用来校验 AutoreleasePoolPage 的结构是否完整
     id *next;                               //指向最新添加的 autoreleased 对象的下一个位置，初始化时指向 begin() ；
@@ -599,14 +671,147 @@ class AutoreleasePoolPage
     AutoreleasePoolPage *child;             //指向子结点，最后一个结点的 child 值为 nil
     uint32_t const depth;                   //代表深度，从 0 开始，往后递增 1；
     uint32_t hiwat;                         //代表 high water mark
+    // Autoreleases recorded on this page, counting each repeat and 
+    // each pool boundary. Kept by add() and releaseUntil().
+    size_t pending;
 
     // SIZE-sizeof(*this) bytes of contents follow
 
+    // Allocated pages in all threads, in use or free, 
+    // for objc_copyMemoryStatistics().
+    static int32_t pageCount;
+
+    // Free pages kept by each thread, and by all threads together.
+    // The limits are in units of PAGE_MAX_SIZE, so other page sizes 
+    // cache about as many bytes, and at least one page.
+    static uint32_t const THREAD_CACHE_PAGES = 4;
+    static int32_t const GLOBAL_POOL_PAGES = 64;
+    static uint32_t threadCachePages;
+    static int32_t globalPoolPages;
+    // The global pool is a list linked through each page's first word. 
+    // It is locked rather than lock-free because a lock-free pop reads 
+    // the link of a page that another thread may have taken and freed.
+    static spinlock_t globalPoolLock;
+    static void *globalPool;
+    static int32_t globalPoolCount;
+
     static void * operator new(size_t size) {
-        return malloc_zone_memalign(malloc_default_zone(), SIZE, SIZE);
+        return allocPage();
     }
     static void operator delete(void * p) {
-        return free(p);
+        freePage(p);
+    }
+
+    static autorelease_page_cache_t *pageCache(bool create)
+    {
+        _objc_pthread_data *data = _objc_fetch_pthread_data(create);
+        if (!data) return nil;
+        if (!data->autoreleasePageCache  &&  create) {
+            data->autoreleasePageCache = (autorelease_page_cache_t *)
+                calloc(1, sizeof(autorelease_page_cache_t));
+        }
+        return data->autoreleasePageCache;
+    }
+
+    // DebugPoolAllocation lets heap debuggers track every page, 
+    // so pages are not reused then.
+    static void *allocPage()
+    {
+        autorelease_page_cache_t *cache = pageCache(true);
+
+        if (!DebugPoolAllocation) {
+            if (cache->count > 0) {
+                void *page = cache->pages;
+                cache->pages = *(void **)page;
+                cache->count--;
+                cache->stats.threadCacheHits++;
+                return page;
+            }
+            // Unlocked check to skip the lock when the pool is empty.
+            if (globalPoolCount > 0) {
+                globalPoolLock.lock();
+                void *page = globalPool;
+                if (page) {
+                    globalPool = *(void **)page;
+                    globalPoolCount--;
+                }
+                globalPoolLock.unlock();
+                if (page) {
+                    cache->stats.globalPoolHits++;
+                    return page;
+                }
+            }
+        }
+
+        uint64_t start = nanoseconds();
+        void *page = allocatePageMemory();
+        cache->stats.allocatorTime += nanoseconds() - start;
+        cache->stats.pagesAllocated++;
+        OSAtomicIncrement32(&pageCount);
+        return page;
+    }
+
+    // Called during thread teardown too, so the thread's 
+    // per-thread data may already be gone.
+    static void freePage(void *page)
+    {
+        autorelease_page_cache_t *cache = pageCache(false);
+
+        if (!DebugPoolAllocation) {
+            if (cache  &&  cache->count < threadCachePages) {
+                *(void **)page = cache->pages;
+                cache->pages = page;
+                cache->count++;
+                return;
+            }
+            if (releaseToGlobalPool(page)) return;
+        }
+
+        uint64_t start = nanoseconds();
+        freePageMemory(page);
+        if (cache) {
+            cache->stats.allocatorTime += nanoseconds() - start;
+            cache->stats.pagesFreed++;
+        }
+        OSAtomicDecrement32(&pageCount);
+    }
+
+    static void *allocatePageMemory()
+    {
+#if defined(VM_FLAGS_SUPERPAGE_SIZE_2MB)
+        if (UsePoolSuperpages  &&  SIZE == SUPERPAGE_SIZE) {
+            // Superpages are aligned to their size.
+            vm_address_t page = 0;
+            kern_return_t kr = 
+                vm_allocate(mach_task_self(), &page, SIZE, 
+                            VM_FLAGS_ANYWHERE | VM_FLAGS_SUPERPAGE_SIZE_2MB);
+            if (kr == KERN_SUCCESS) return (void *)page;
+            // No superpages available. Use malloc instead.
+        }
+#endif
+        return malloc_zone_memalign(malloc_default_zone(), SIZE, SIZE);
+    }
+
+    static void freePageMemory(void *page)
+    {
+        if (UsePoolSuperpages  &&  !malloc_zone_from_ptr(page)) {
+            vm_deallocate(mach_task_self(), (vm_address_t)page, SIZE);
+        } else {
+            free(page);
+        }
+    }
+
+    static bool releaseToGlobalPool(void *page)
+    {
+        globalPoolLock.lock();
+        bool pooled = globalPoolCount < globalPoolPages;
+        if (pooled) {
+            *(void **)page = globalPool;
+            globalPool = page;
+            globalPoolCount++;
+        }
+        globalPoolLock.unlock();
+        return pooled;
     }
 
     inline void protect() {
@@ -627,7 +832,7 @@ class AutoreleasePoolPage
         : magic(), next(begin()), thread(pthread_self()),
           parent(newParent), child(nil), 
           depth(parent ? 1+parent->depth : 0), 
-          hiwat(parent ? parent->hiwat : 0)
+          hiwat(parent ? parent->hiwat : 0), pending(0)
     { 
         if (parent) {
             parent->check();
@@ -703,11 +908,34 @@ class AutoreleasePoolPage
         return (next - begin() < (end() - begin()) / 2);
     }
 
+    static bool isRepeat(id entry) {
+        return (uintptr_t)entry & REPEAT_TAG;
+    }
+
+    static uintptr_t repeatCount(id entry) {
+        return (uintptr_t)entry >> 1;
+    }
+
     id *add(id obj)
     {
         assert(!full());
         unprotect();
         id *ret = next;  // faster than `return next-1` because of aliasing
+        pending++;
+        if (obj != POOL_SENTINEL  &&  next != begin()) {
+            // Count a repeat of the object on top instead of adding it.
+            id top = next[-1];
+            if (isRepeat(top)  &&  next[-2] == obj) {
+                next[-1] = (id)((uintptr_t)top + REPEAT_ONE);
+                protect();
+                return next - 2;
+            }
+            if (top == obj) {
+                *next++ = (id)(REPEAT_ONE | REPEAT_TAG);
+                protect();
+                return ret - 1;
+            }
+        }
         *next++ = obj;
         protect();
         return ret;
@@ -734,14 +962,35 @@ class AutoreleasePoolPage
                 setHotPage(page);
             }
 
+            // Take up to DRAIN_CHUNK entries off the top of the page, 
+            // without going past stop, and release them from the copy. 
+            // The copy is reversed so the hottest entry comes first. 
+            // Anything -dealloc autoreleases meanwhile goes on top of 
+            // the page and is popped by a later pass.
+            id chunk[DRAIN_CHUNK];
+            id *limit = (page == this) ? stop : page->begin();
+            size_t count = page->next - limit;
+            if (count > DRAIN_CHUNK) {
+                count = DRAIN_CHUNK;
+                // Keep a repeat count with the object below it.
+                if (isRepeat(page->next[-(ptrdiff_t)count])) count--;
+            }
+            id *start = page->next - count;
+            size_t popped = 0;
+            for (size_t i = 0; i < count; i++) {
+                chunk[i] = start[count - 1 - i];
+                popped += isRepeat(chunk[i]) ? repeatCount(chunk[i]) : 1;
+            }
+
             page->unprotect();
-            id obj = *--page->next;
-            memset((void*)page->next, SCRIBBLE, sizeof(*page->next));
+#if DEBUG
+            memset((void*)start, SCRIBBLE, count * sizeof(id));
+#endif
+            page->next = start;
+            page->pending -= popped;
             page->protect();
 
-            if (obj != POOL_SENTINEL) {
-                objc_release(obj);
-            }
+            releaseEntries(chunk, count);
         }
 
         setHotPage(this);
@@ -754,6 +1003,38 @@ class AutoreleasePoolPage
 #endif
     }
 
+    // Releases pool entries popped by releaseUntil(), which are in 
+    // reverse page order: hottest first, and each repeat count comes 
+    // just before its object. Runs of objects go to releaseBatch_inOrder(), 
+    // which prefetches ahead but still deallocates each object before 
+    // releasing the next, as releasing one at a time would. 
+    // POOL_SENTINEL is nil, which releaseBatch_inOrder() ignores.
+    static void releaseEntries(id *entries, size_t count)
+    {
+        size_t begin = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (isRepeat(entries[i])) {
+                releaseBatch_inOrder(entries + begin, i - begin);
+                releaseRepeated(entries[i+1], repeatCount(entries[i]) + 1);
+                begin = ++i + 1;
+            }
+        }
+        releaseBatch_inOrder(entries + begin, count - begin);
+    }
+
+    static void releaseRepeated(id obj, uintptr_t count)
+    {
+        id batch[RELEASE_BATCH];
+        size_t fill = count < RELEASE_BATCH ? count : RELEASE_BATCH;
+        for (size_t i = 0; i < fill; i++) batch[i] = obj;
+
+        while (count > 0) {
+            size_t n = count < RELEASE_BATCH ? count : RELEASE_BATCH;
+            releaseBatch_inOrder(batch, n);
+            count -= n;
+        }
+    }
+
     void kill() 
     {
         // Not recursive: we don't want to blow out the stack 
@@ -800,7 +1081,7 @@ class AutoreleasePoolPage
     static AutoreleasePoolPage *pageForPointer(uintptr_t p) 
     {
         AutoreleasePoolPage *result;
-        uintptr_t offset = p % SIZE;
+        uintptr_t offset = p & (SIZE - 1);
 
         assert(offset >= sizeof(AutoreleasePoolPage));
 
@@ -985,6 +1266,54 @@ public:
         int r __unused = pthread_key_init_np(AutoreleasePoolPage::key, 
                                              AutoreleasePoolPage::tls_dealloc);
         assert(r == 0);
+
+        // Read by environ_init(), which ignores the environment 
+        // when setuid or setgid.
+        if (AutoreleasePoolPageSize) {
+            setPageSize(AutoreleasePoolPageSize);
+        } else if (UsePoolSuperpages) {
+            setPageSize(SUPERPAGE_SIZE);
+        }
+        if (UsePoolSuperpages  &&  SIZE != SUPERPAGE_SIZE) {
+            _objc_inform("OBJC_USE_POOL_SUPERPAGES ignored: autorelease pool "
+                         "pages are %zu bytes, not %zu", SIZE, SUPERPAGE_SIZE);
+        }
+    }
+
+    // Accepts a size in bytes, or in KB or MB with a K or M suffix.
+    static void setPageSize(size_t size)
+    {
+        SIZE = size;
+        COUNT = SIZE / sizeof(id);
+
+        size_t pages = THREAD_CACHE_PAGES * PAGE_MAX_SIZE / SIZE;
+        threadCachePages = pages ? (uint32_t)pages : 1;
+        pages = GLOBAL_POOL_PAGES * PAGE_MAX_SIZE / SIZE;
+        globalPoolPages = pages ? (int32_t)pages : 1;
+    }
+
+    static void setPageSize(const char *value)
+    {
+        char *end;
+        unsigned long size = strtoul(value, &end, 0);
+        if (*end == 'K'  ||  *end == 'k') {
+            size *= 1024;
+            end++;
+        } else if (*end == 'M'  ||  *end == 'm') {
+            size *= 1024*1024;
+            end++;
+        }
+
+        if (*end  ||  size < MIN_SIZE  ||  size > MAX_SIZE  ||  
+            (size & (size - 1)) != 0) 
+        {
+            _objc_inform("OBJC_AUTORELEASE_POOL_PAGE_SIZE=%s ignored: "
+                         "the size must be a power of 2 from %zu to %zu "
+                         "bytes", value, MIN_SIZE, MAX_SIZE);
+            return;
+        }
+
+        setPageSize((size_t)size);
     }
 
     void print() 
@@ -997,6 +1326,9 @@ public:
         for (id *p = begin(); p < next; p++) {
             if (*p == POOL_SENTINEL) {
                 _objc_inform("[%p]  ################  POOL %p", p, p);
+            } else if (isRepeat(*p)) {
+                _objc_inform("[%p]  ................  repeated %lu more times", 
+                             p, (unsigned long)repeatCount(*p));
             } else {
                 _objc_inform("[%p]  %#16lx  %s", 
                              p, (unsigned long)*p, object_getClassName(*p));
@@ -1010,9 +1342,9 @@ public:
         _objc_inform("AUTORELEASE POOLS for thread %p", pthread_self());
 
         AutoreleasePoolPage *page;
-        ptrdiff_t objects = 0;
+        size_t objects = 0;
         for (page = coldPage(); page; page = page->child) {
-            objects += page->next - page->begin();
+            objects += page->pending;
         }
         _objc_inform("%llu releases pending.", (unsigned long long)objects);
 
@@ -1028,7 +1360,10 @@ public:
         // Check and propagate high water mark
         // Ignore high water marks under 256 to suppress noise.
         AutoreleasePoolPage *p = hotPage();
-        uint32_t mark = p->depth*COUNT + (uint32_t)(p->next - p->begin());
+        uint32_t mark = 0;
+        for (AutoreleasePoolPage *page = p; page; page = page->parent) {
+            mark += (uint32_t)page->pending;
+        }
         if (mark > p->hiwat  &&  mark > 256) {
             for( ; p; p = p->parent) {
                 p->unprotect();
@@ -1050,9 +1385,46 @@ public:
         }
     }
 
+    static void threadExit(autorelease_page_cache_t *cache)
+    {
+        while (cache->count > 0) {
+            void *page = cache->pages;
+            cache->pages = *(void **)page;
+            cache->count--;
+            if (!releaseToGlobalPool(page)) {
+                freePageMemory(page);
+                OSAtomicDecrement32(&pageCount);
+            }
+        }
+        free(cache);
+    }
+
+    static void statistics(objc_autorelease_page_statistics_t *stats)
+    {
+        autorelease_page_cache_t *cache = pageCache(false);
+        if (cache) *stats = cache->stats;
+        else bzero(stats, sizeof(*stats));
+    }
+
+    static void memoryStatistics(objc_memory_statistic_t *stats)
+    {
+        size_t pages = (size_t)pageCount;
+        stats[MEMSTAT_AUTORELEASE].count += pages;
+        stats[MEMSTAT_AUTORELEASE].bytes += pages * SIZE;
+    }
+
 #undef POOL_SENTINEL
 };
 
+size_t AutoreleasePoolPage::SIZE = PAGE_MAX_SIZE;
+size_t AutoreleasePoolPage::COUNT = PAGE_MAX_SIZE / sizeof(id);
+uint32_t AutoreleasePoolPage::threadCachePages = THREAD_CACHE_PAGES;
+int32_t AutoreleasePoolPage::globalPoolPages = GLOBAL_POOL_PAGES;
+int32_t AutoreleasePoolPage::pageCount = 0;
+spinlock_t AutoreleasePoolPage::globalPoolLock;
+void *AutoreleasePoolPage::globalPool = nil;
+int32_t AutoreleasePoolPage::globalPoolCount = 0;
+
 // anonymous namespace
 };
 
@@ -1092,9 +1464,12 @@ objc_object::clearDeallocating_slow()
         weak_clear_no_lock(&table.weak_table, (id)this);
     }
     if (isa.has_sidetable_rc) {
-        table.refcnts.erase(this);
+        if (table.refcnts.erase(this)) table.refcntReleased();
     }
     table.unlock();
+
+    // Lock-free weak loads may still be looking at this object.
+    if (isa.weakly_referenced) weak_wait_for_readers((id)this);
 }
 
 #endif
@@ -1184,7 +1559,9 @@ objc_object::sidetable_moveExtraRC_nolock(size_t extra_rc,
 
     uintptr_t carry;
     size_t refcnt = addc(oldRefcnt, extra_rc << SIDE_TABLE_RC_SHIFT, 0, &carry);
-    if (carry) refcnt = SIDE_TABLE_RC_PINNED;
+    if (carry  ||  (extra_rc >> (WORD_BITS - SIDE_TABLE_RC_SHIFT))) {
+        refcnt = SIDE_TABLE_RC_PINNED;
+    }
     if (isDeallocating) refcnt |= SIDE_TABLE_DEALLOCATING;
     if (weaklyReferenced) refcnt |= SIDE_TABLE_WEAKLY_REFERENCED;
 
@@ -1245,6 +1622,7 @@ objc_object::sidetable_subExtraRC_nolock(size_t delta_rc)
     size_t newRefcnt = oldRefcnt - (delta_rc << SIDE_TABLE_RC_SHIFT);
     assert(oldRefcnt > newRefcnt);  // shouldn't underflow
     it->second = newRefcnt;
+    if (newRefcnt == 0) table.refcntReleased();
     return delta_rc;
 }
 
@@ -1260,6 +1638,454 @@ objc_object::sidetable_getExtraRC_nolock()
 }
 
 
+/***********************************************************************
+* Retain count operations for the inline retain count word.
+* Classes set up with class_setUsesInlineRetainCount() reserve a word 
+* at the end of each instance. It holds the retain counts that overflow 
+* the isa, exactly as the side table would, with a lock in the low bit.
+* The lock is per object and the word shares the object's cache lines, 
+* so a heavily retained object neither hashes into a side table nor 
+* contends with unrelated objects that share its stripe.
+**********************************************************************/
+
+#define INLINE_RC_LOCKED  (1UL<<0)
+#define INLINE_RC_SHIFT   1
+
+// Attempts before a waiter starts yielding the CPU. The lock is held 
+// only for a few instructions, unless the holder has been preempted.
+#define INLINE_RC_SPIN_COUNT 100
+
+uintptr_t *
+objc_object::inlineRC_lock(Class cls)
+{
+    uint32_t offset = cls->inlineRCOffset();
+    if (!offset) return nil;
+
+    uintptr_t *word = (uintptr_t *)((char *)this + offset);
+    for (unsigned int attempts = 0; ; attempts++) {
+        uintptr_t value = *(volatile uintptr_t *)word;
+        if (!(value & INLINE_RC_LOCKED)  &&  
+            __sync_bool_compare_and_swap(word, value, value|INLINE_RC_LOCKED))
+        {
+            return word;
+        }
+        if (attempts >= INLINE_RC_SPIN_COUNT) {
+            // The holder is probably not running. Depress our priority 
+            // and yield, as OSSpinLock does, so that a lower-priority 
+            // holder can run and release the lock.
+            thread_switch(MACH_PORT_NULL, SWITCH_OPTION_DEPRESS, 1);
+        }
+    }
+}
+
+void 
+objc_object::inlineRC_unlock(uintptr_t *word)
+{
+    assert(*word & INLINE_RC_LOCKED);
+    __sync_fetch_and_and(word, ~INLINE_RC_LOCKED);
+}
+
+void 
+objc_object::inlineRC_addExtraRC_nolock(uintptr_t *word, size_t delta_rc)
+{
+    assert(*word & INLINE_RC_LOCKED);
+    *word += delta_rc << INLINE_RC_SHIFT;
+}
+
+// Returns the actual count subtracted, which may be less than the request.
+size_t 
+objc_object::inlineRC_subExtraRC_nolock(uintptr_t *word, size_t delta_rc)
+{
+    assert(*word & INLINE_RC_LOCKED);
+    size_t extra_rc = *word >> INLINE_RC_SHIFT;
+    if (delta_rc > extra_rc) delta_rc = extra_rc;
+    *word -= delta_rc << INLINE_RC_SHIFT;
+    return delta_rc;
+}
+
+size_t 
+objc_object::inlineRC_getExtraRC_nolock(uintptr_t *word)
+{
+    assert(*word & INLINE_RC_LOCKED);
+    return *word >> INLINE_RC_SHIFT;
+}
+
+
+/***********************************************************************
+* Biased retain counts.
+* Classes set up with class_setUsesBiasedRetainCount() reserve two words 
+* at the end of each instance. initInstanceIsa() biases each new object 
+* toward the allocating thread. That thread's retains and releases 
+* through objc_retain() and objc_release() adjust ownerCount with plain 
+* loads and stores. Other threads, and callers of rootRetain() and 
+* rootRelease() such as -retain and -release, use the isa retain count.
+*
+* While an object is biased, its isa retain count includes one 
+* reference held on behalf of the owner, so other threads can never 
+* free it by themselves. When ownerCount reaches zero the owner unbiases 
+* the object for good and releases that reference.
+*
+* References counted in ownerCount may be released by other threads. 
+* If such a release would free the object, rootRelease() records it as 
+* pending in state instead and queues the object for its owner. The 
+* owner subtracts pending releases from ownerCount, possibly freeing 
+* the object, at its next slow-path release of that object, at its next 
+* autorelease pool pop, or when it exits. Releases of objects whose 
+* owner has already exited are merged at once by the releasing thread.
+**********************************************************************/
+
+struct biased_rc_t {
+    // Owner thread ID in the high bits, or 0 if unbiased. 
+    // Count of pending releases and the queued bit in the low bits.
+    // Changed with compare-and-swap.
+    volatile uint64_t state;
+    // References held by the owner. Changed only by the owner thread, 
+    // or by whichever thread holds BIASED_RC_QUEUED after it exits.
+    uintptr_t ownerCount;
+};
+
+#define BIASED_RC_OWNER_SHIFT   32
+#define BIASED_RC_QUEUED        (1ULL<<31)
+#define BIASED_RC_PENDING_MASK  (BIASED_RC_QUEUED - 1)
+#define BIASED_RC_LOW_MASK      (BIASED_RC_QUEUED | BIASED_RC_PENDING_MASK)
+
+// The offset is recorded because changeIsa() may move a queued object 
+// to a class whose biased count is elsewhere, or that has none.
+struct biased_rc_queue_entry_t {
+    objc_object *obj;
+    uint32_t offset;
+};
+
+struct biased_rc_queue_t {
+    vector<biased_rc_queue_entry_t> objects;
+    // Unlocked hint for the owner thread.
+    volatile size_t count;
+};
+
+void biasedRC_mergeQueue(biased_rc_queue_t *queue);
+
+// Queues of live owner threads by thread ID. 
+// IDs are never reused, so a missing ID means the owner has exited.
+static mutex_t BiasedRCLock;
+static DenseMap<uint32_t, biased_rc_queue_t *> *BiasedRCThreads;
+static uint32_t BiasedRCLastThread;
+
+static inline biased_rc_t *
+biasedRC(objc_object *obj, uint32_t offset)
+{
+    return (biased_rc_t *)((char *)obj + offset);
+}
+
+static inline uint32_t 
+biasedRC_owner(uint64_t state)
+{
+    return (uint32_t)(state >> BIASED_RC_OWNER_SHIFT);
+}
+
+// Returns the current thread's owner ID, or 0 if it has none yet.
+static inline uint32_t 
+biasedRC_currentThread()
+{
+    _objc_pthread_data *data = _objc_fetch_pthread_data(false);
+    return data ? data->biasedRCThread : 0;
+}
+
+static uint32_t 
+biasedRC_registerThread()
+{
+    _objc_pthread_data *data = _objc_fetch_pthread_data(true);
+    if (data->biasedRCThread) return data->biasedRCThread;
+
+    biased_rc_queue_t *queue = new biased_rc_queue_t;
+    queue->count = 0;
+
+    uint32_t thread;
+    {
+        mutex_locker_t lock(BiasedRCLock);
+        if (!BiasedRCThreads) {
+            BiasedRCThreads = new DenseMap<uint32_t, biased_rc_queue_t *>;
+        }
+        // DenseMap reserves the two largest keys as empty and tombstone.
+        if (BiasedRCLastThread >= ~0U - 2) {
+            _objc_fatal("too many threads for biased retain counts");
+        }
+        thread = ++BiasedRCLastThread;
+        (*BiasedRCThreads)[thread] = queue;
+    }
+
+    data->biasedRCQueue = queue;
+    data->biasedRCThread = thread;
+    return thread;
+}
+
+void 
+objc_object::biasedRC_init(uint32_t offset)
+{
+    uint32_t thread = biasedRC_currentThread();
+    if (!thread) thread = biasedRC_registerThread();
+
+    // The allocation's reference belongs to the owner. 
+    // The isa's initial count is the reference held on its behalf.
+    biased_rc_t *rc = biasedRC(this, offset);
+    rc->ownerCount = 1;
+    rc->state = (uint64_t)thread << BIASED_RC_OWNER_SHIFT;
+}
+
+id 
+objc_object::rootRetainBiased(uint32_t offset)
+{
+    biased_rc_t *rc = biasedRC(this, offset);
+    uint32_t thread = biasedRC_currentThread();
+    if (thread  &&  biasedRC_owner(rc->state) == thread) {
+        rc->ownerCount++;
+        return (id)this;
+    }
+    return rootRetain();
+}
+
+void 
+objc_object::rootReleaseBiased(uint32_t offset)
+{
+    biased_rc_t *rc = biasedRC(this, offset);
+    uint32_t thread = biasedRC_currentThread();
+    uint64_t state = rc->state;
+    if (!thread  ||  biasedRC_owner(state) != thread) {
+        rootRelease();
+        return;
+    }
+
+    uint64_t owned = (uint64_t)thread << BIASED_RC_OWNER_SHIFT;
+    while (state == owned) {
+        if (rc->ownerCount > 1) {
+            rc->ownerCount--;
+            return;
+        }
+        // Our last reference. Unbias, then release the isa reference 
+        // held on our behalf.
+        if (__sync_bool_compare_and_swap(&rc->state, state, 0)) {
+            rc->ownerCount = 0;
+            rootRelease();
+            return;
+        }
+        state = rc->state;
+    }
+
+    // Other threads released some of our references. 
+    // Merge them now, including everything else queued for us.
+    assert(state & BIASED_RC_QUEUED);
+    rc->ownerCount--;
+    biasedRC_mergeQueue(_objc_fetch_pthread_data(false)->biasedRCQueue);
+}
+
+// Called by rootRelease() when the isa retain count would reach zero.
+// Returns true if the release was charged to a biased owner instead, 
+// in which case the object must not be deallocated now.
+bool 
+objc_object::biasedRC_absorbRelease(uint32_t offset)
+{
+    biased_rc_t *rc = biasedRC(this, offset);
+    uint32_t thread = biasedRC_currentThread();
+
+    while (true) {
+        uint64_t state = rc->state;
+        uint32_t owner = biasedRC_owner(state);
+        if (!owner) return false;
+
+        if (owner == thread) {
+            // The owner released through rootRelease(). 
+            // Take the reference from ownerCount instead.
+            if ((state & BIASED_RC_QUEUED)  ||  rc->ownerCount > 1) {
+                rc->ownerCount--;
+                return true;
+            }
+            // Our last reference: this release frees the object.
+            if (__sync_bool_compare_and_swap(&rc->state, state, 0)) {
+                rc->ownerCount = 0;
+                return false;
+            }
+            continue;
+        }
+
+        // Another thread released a reference counted in ownerCount.
+        assert((state & BIASED_RC_PENDING_MASK) != BIASED_RC_PENDING_MASK);
+        uint64_t newState = (state + 1) | BIASED_RC_QUEUED;
+        if (!__sync_bool_compare_and_swap(&rc->state, state, newState)) {
+            continue;
+        }
+        if (!(state & BIASED_RC_QUEUED)) biasedRC_enqueue(owner, offset);
+        return true;
+    }
+}
+
+// Queues this object for its owner to merge. 
+// The caller just set BIASED_RC_QUEUED.
+void 
+objc_object::biasedRC_enqueue(uint32_t owner, uint32_t offset)
+{
+    {
+        mutex_locker_t lock(BiasedRCLock);
+        auto it = BiasedRCThreads->find(owner);
+        if (it != BiasedRCThreads->end()) {
+            biased_rc_queue_t *queue = it->second;
+            queue->objects.push_back(biased_rc_queue_entry_t{this, offset});
+            queue->count = queue->objects.size();
+            return;
+        }
+    }
+
+    // The owner has exited, so ownerCount can no longer change under us.
+    biasedRC_merge(offset);
+}
+
+// Subtracts pending releases from ownerCount, 
+// and releases the owner's isa reference if none are left.
+// The caller owns the object or holds BIASED_RC_QUEUED.
+void 
+objc_object::biasedRC_merge(uint32_t offset)
+{
+    biased_rc_t *rc = biasedRC(this, offset);
+    uintptr_t ownerCount = rc->ownerCount;
+
+    while (true) {
+        uint64_t state = rc->state;
+        assert(state & BIASED_RC_QUEUED);
+        uintptr_t pending = (uintptr_t)(state & BIASED_RC_PENDING_MASK);
+        assert(ownerCount >= pending);
+        uintptr_t remaining = ownerCount - pending;
+
+        // Store ownerCount before clearing BIASED_RC_QUEUED, 
+        // so the next thread to set it sees the new value.
+        rc->ownerCount = remaining;
+
+        if (!biasedRC_owner(state)) {
+            // changeIsa() detached the object from its owner. Replace 
+            // the isa reference held on the owner's behalf with the 
+            // owner's remaining references.
+            if (!__sync_bool_compare_and_swap(&rc->state, state, 0)) continue;
+            rc->ownerCount = 0;
+            if (!remaining) rootRelease();
+            else for (uintptr_t i = 1; i < remaining; i++) rootRetain();
+            return;
+        }
+
+        uint64_t newState = remaining ? (state & ~BIASED_RC_LOW_MASK) : 0;
+        if (__sync_bool_compare_and_swap(&rc->state, state, newState)) {
+            if (!remaining) rootRelease();
+            return;
+        }
+    }
+}
+
+void 
+biasedRC_mergeQueue(biased_rc_queue_t *queue)
+{
+    vector<biased_rc_queue_entry_t> objects;
+
+    {
+        mutex_locker_t lock(BiasedRCLock);
+        objects.swap(queue->objects);
+        queue->count = 0;
+    }
+
+    for (const biased_rc_queue_entry_t& entry : objects) {
+        entry.obj->biasedRC_merge(entry.offset);
+    }
+}
+
+// Called by changeIsa() when it gives the object a raw isa, with the 
+// side table locked. Unbiases the object and returns how many 
+// references its owner held beyond the isa reference held on its 
+// behalf, for the caller to add to the side table count. 
+// If other threads have released owner references and queued the 
+// object, the owner's merge does that instead, since only it can read 
+// ownerCount safely; the object stays queued but detached from its 
+// owner. Retains by a live owner on another thread that race with 
+// this may be lost.
+// newOffset is the new class's biased count offset, whose words are 
+// cleared so the object starts out unbiased under that class.
+size_t 
+objc_object::biasedRC_unbias(uint32_t offset, uint32_t newOffset)
+{
+    biased_rc_t *rc = biasedRC(this, offset);
+    size_t owned = 0;
+
+    while (true) {
+        uint64_t state = rc->state;
+        if (!biasedRC_owner(state)) break;
+        if (state & BIASED_RC_QUEUED) {
+            if (__sync_bool_compare_and_swap(&rc->state, state, 
+                                             state & BIASED_RC_LOW_MASK)) 
+            {
+                break;
+            }
+            continue;
+        }
+        if (__sync_bool_compare_and_swap(&rc->state, state, 0)) {
+            assert(rc->ownerCount > 0);
+            owned = rc->ownerCount - 1;
+            rc->ownerCount = 0;
+            break;
+        }
+    }
+
+    // Don't clobber words the queued merge still needs.
+    if (newOffset  &&  
+        (newOffset >= offset + sizeof(biased_rc_t)  ||  
+         offset >= newOffset + sizeof(biased_rc_t)))
+    {
+        biased_rc_t *newRC = biasedRC(this, newOffset);
+        newRC->ownerCount = 0;
+        newRC->state = 0;
+    }
+
+    return owned;
+}
+
+intptr_t 
+objc_object::biasedRC_extraRetainCount(uint32_t offset)
+{
+    biased_rc_t *rc = biasedRC(this, offset);
+    uint64_t state = rc->state;
+    if (!biasedRC_owner(state)) return 0;
+
+    // Not synchronized with the owner. retainCount is advisory anyway.
+    return ((intptr_t)rc->ownerCount - 
+            (intptr_t)(state & BIASED_RC_PENDING_MASK) - 1);
+}
+
+// Merges releases of objects owned by this thread that other threads 
+// performed since the last call.
+static void 
+biasedRC_mergePending()
+{
+    if (!BiasedRCThreads) return;
+    _objc_pthread_data *data = _objc_fetch_pthread_data(false);
+    if (!data  ||  !data->biasedRCQueue  ||  !data->biasedRCQueue->count) {
+        return;
+    }
+    biasedRC_mergeQueue(data->biasedRCQueue);
+}
+
+void 
+biasedRC_threadExit(_objc_pthread_data *data)
+{
+    biased_rc_queue_t *queue = data->biasedRCQueue;
+    if (!queue) return;
+
+    // Objects queued after this find no owner and are merged 
+    // by the releasing thread.
+    {
+        mutex_locker_t lock(BiasedRCLock);
+        BiasedRCThreads->erase(data->biasedRCThread);
+    }
+
+    biasedRC_mergeQueue(queue);
+    delete queue;
+    data->biasedRCQueue = nil;
+    data->biasedRCThread = 0;
+}
+
+
 // SUPPORT_NONPOINTER_ISA
 #endif
 
@@ -1278,6 +2104,9 @@ objc_object::sidetable_retain_slow(SideTable& table)
         refcntStorage += SIDE_TABLE_RC_ONE;
     }
     table.unlock();
+    if (__builtin_expect(PrintRetainProfile, 0)) {
+        retainProfile_record(this, 0, true);
+    }
 
     return (id)this;
 }
@@ -1297,6 +2126,9 @@ objc_object::sidetable_retain()
             refcntStorage += SIDE_TABLE_RC_ONE;
         }
         table.unlock();
+        if (__builtin_expect(PrintRetainProfile, 0)) {
+            retainProfile_record(this, 0, false);
+        }
         return (id)this;
     }
     return sidetable_retain_slow(table);
@@ -1352,13 +2184,31 @@ objc_object::sidetable_retainCount()
 }
 
 
-bool 
-objc_object::sidetable_isDeallocating()
+// Pin the retain count so retain and release leave it alone 
+// and the object is never deallocated.
+void 
+objc_object::sidetable_setImmortal()
 {
     SideTable& table = SideTables()[this];
 
-    // NO SPINLOCK HERE
-    // _objc_rootIsDeallocating() is called exclusively by _objc_storeWeak(), 
+    table.lock();
+    size_t& refcnt = table.refcnts[this];
+    if (refcnt & SIDE_TABLE_DEALLOCATING) {
+        _objc_fatal("objc_setImmortal() called on deallocating object %p", 
+                    this);
+    }
+    refcnt = SIDE_TABLE_RC_PINNED | (refcnt & SIDE_TABLE_FLAG_MASK);
+    table.unlock();
+}
+
+
+bool 
+objc_object::sidetable_isDeallocating()
+{
+    SideTable& table = SideTables()[this];
+
+    // NO SPINLOCK HERE
+    // _objc_rootIsDeallocating() is called exclusively by _objc_storeWeak(), 
     // which already acquired the lock on our behalf.
 
 
@@ -1429,6 +2279,9 @@ objc_object::sidetable_release_slow(SideTable& table, bool performDealloc)
         it->second -= SIDE_TABLE_RC_ONE;
     }
     table.unlock();
+    if (__builtin_expect(PrintRetainProfile, 0)) {
+        retainProfile_record(this, 0, true);
+    }
     if (do_dealloc  &&  performDealloc) {
         ((void(*)(objc_object *, SEL))objc_msgSend)(this, SEL_dealloc);
     }
@@ -1462,6 +2315,9 @@ objc_object::sidetable_release(bool performDealloc)
             it->second -= SIDE_TABLE_RC_ONE;
         }
         table.unlock();
+        if (__builtin_expect(PrintRetainProfile, 0)) {
+            retainProfile_record(this, 0, false);
+        }
         if (do_dealloc  &&  performDealloc) {
             ((void(*)(objc_object *, SEL))objc_msgSend)(this, SEL_dealloc);
         }
@@ -1480,15 +2336,208 @@ objc_object::sidetable_clearDeallocating()
     // clear any weak table items
     // clear extra retain count and deallocating bit
     // (fixme warn or abort if extra retain count == 0 ?)
+    bool weaklyReferenced = false;
     table.lock();
     RefcountMap::iterator it = table.refcnts.find(this);
     if (it != table.refcnts.end()) {
         if (it->second & SIDE_TABLE_WEAKLY_REFERENCED) {
             weak_clear_no_lock(&table.weak_table, (id)this);
+            weaklyReferenced = true;
         }
         table.refcnts.erase(it);
+        table.refcntReleased();
     }
     table.unlock();
+
+    // Lock-free weak loads may still be looking at this object.
+    if (weaklyReferenced) weak_wait_for_readers((id)this);
+}
+
+
+// Slow path of objc_retainBatch().
+// The caller holds table's lock, and table is SideTables()[this].
+void
+objc_object::rootRetain_batchLocked(SideTable& table)
+{
+#if SUPPORT_NONPOINTER_ISA
+    bool transcribeToSideTable;
+    isa_t oldisa;
+    isa_t newisa;
+    uint32_t attempts = 0;
+
+    do {
+        attempts++;
+        transcribeToSideTable = false;
+        oldisa = LoadExclusive(&isa.bits);
+        newisa = oldisa;
+        if (!newisa.indexed) goto unindexed;
+        uintptr_t carry;
+        newisa.bits = addc(newisa.bits, RC_ONE, 0, &carry);  // extra_rc++
+        if (carry) {
+            if (oldisa.isImmortal()) return;
+            // Leave half of the retain counts inline and
+            // copy the other half to the side table.
+            transcribeToSideTable = true;
+            newisa.extra_rc = RC_HALF;
+            newisa.has_sidetable_rc = true;
+        }
+    } while (!StoreExclusive(&isa.bits, oldisa.bits, newisa.bits));
+
+    if (transcribeToSideTable) sidetable_addExtraRC_nolock(RC_HALF);
+    if (__builtin_expect(PrintRetainProfile, 0)) {
+        retainProfile_record(this, attempts - 1, false);
+    }
+    return;
+
+ unindexed:
+#endif
+    size_t& refcntStorage = table.refcnts[this];
+    if (! (refcntStorage & SIDE_TABLE_RC_PINNED)) {
+        refcntStorage += SIDE_TABLE_RC_ONE;
+    }
+    if (__builtin_expect(PrintRetainProfile, 0)) {
+        retainProfile_record(this, 0, false);
+    }
+}
+
+
+// Slow path of objc_releaseBatch(). Does not call -dealloc.
+// Returns true if the object should now be deallocated.
+// The caller holds table's lock, and table is SideTables()[this].
+bool
+objc_object::rootRelease_batchLocked(SideTable& table)
+{
+#if SUPPORT_NONPOINTER_ISA
+    isa_t oldisa;
+    isa_t newisa;
+    uint32_t attempts = 0;
+
+ retry:
+    do {
+        attempts++;
+        oldisa = LoadExclusive(&isa.bits);
+        newisa = oldisa;
+        if (!newisa.indexed) goto unindexed;
+        if (newisa.isImmortal()) return false;
+        uintptr_t carry;
+        newisa.bits = subc(newisa.bits, RC_ONE, 0, &carry);  // extra_rc--
+        if (carry) goto underflow;
+    } while (!StoreReleaseExclusive(&isa.bits, oldisa.bits, newisa.bits));
+    if (__builtin_expect(PrintRetainProfile, 0)) {
+        retainProfile_record(this, attempts - 1, false);
+    }
+    return false;
+
+ underflow:
+    // abandon newisa to undo the decrement
+    newisa = oldisa;
+
+    // rootRelease_batchFast() handles inline retain count words
+    // and biased counts itself.
+    assert(!ISA()->inlineRCOffset()  &&  !ISA()->biasedRCOffset());
+
+    if (newisa.has_sidetable_rc) {
+        size_t borrowed = sidetable_subExtraRC_nolock(RC_HALF);
+        if (borrowed > 0) {
+            newisa.extra_rc = borrowed - 1;  // redo the original decrement too
+            bool stored = StoreExclusive(&isa.bits, oldisa.bits, newisa.bits);
+            if (!stored) {
+                // Inline update failed. 
+                // Try it again right now, as rootRelease() does. This 
+                // prevents livelock on LL/SC architectures where the 
+                // side table access itself may have dropped the reservation.
+                isa_t oldisa2 = LoadExclusive(&isa.bits);
+                isa_t newisa2 = oldisa2;
+                if (newisa2.indexed) {
+                    uintptr_t overflow;
+                    newisa2.bits = 
+                        addc(newisa2.bits, RC_ONE * (borrowed-1), 0, &overflow);
+                    if (!overflow) {
+                        stored = StoreReleaseExclusive(&isa.bits, oldisa2.bits, 
+                                                       newisa2.bits);
+                    }
+                }
+            }
+            if (!stored) {
+                // Put the retains back in the side table and start over.
+                sidetable_addExtraRC_nolock(borrowed);
+                goto retry;
+            }
+            if (__builtin_expect(PrintRetainProfile, 0)) {
+                retainProfile_record(this, attempts - 1, false);
+            }
+            return false;
+        }
+    }
+
+    if (newisa.deallocating) {
+        return overrelease_error();
+    }
+    newisa.deallocating = true;
+    if (!StoreExclusive(&isa.bits, oldisa.bits, newisa.bits)) goto retry;
+    __sync_synchronize();
+    return true;
+
+ unindexed:
+#endif
+    bool do_dealloc = false;
+    RefcountMap::iterator it = table.refcnts.find(this);
+    if (it == table.refcnts.end()) {
+        do_dealloc = true;
+        table.refcnts[this] = SIDE_TABLE_DEALLOCATING;
+    } else if (it->second < SIDE_TABLE_DEALLOCATING) {
+        // SIDE_TABLE_WEAKLY_REFERENCED may be set. Don't change it.
+        do_dealloc = true;
+        it->second |= SIDE_TABLE_DEALLOCATING;
+    } else if (! (it->second & SIDE_TABLE_RC_PINNED)) {
+        it->second -= SIDE_TABLE_RC_ONE;
+    }
+    if (__builtin_expect(PrintRetainProfile, 0)) {
+        retainProfile_record(this, 0, false);
+    }
+    return do_dealloc;
+}
+
+
+// Clears weak references and side table retain counts for 
+// objc_releaseBatch() before it sends -dealloc, so that 
+// clearDeallocating() later finds nothing to do.
+// Returns true if weak references were cleared; the caller must 
+// then call weak_wait_for_readers() after dropping the lock.
+// The caller holds table's lock, and table is SideTables()[this].
+bool
+objc_object::clearDeallocating_batchLocked(SideTable& table)
+{
+#if SUPPORT_NONPOINTER_ISA
+    if (isa.indexed) {
+        bool weaklyReferenced = isa.weakly_referenced;
+        if (weaklyReferenced) {
+            weak_clear_no_lock(&table.weak_table, (id)this);
+        }
+        if (isa.has_sidetable_rc) {
+            if (table.refcnts.erase(this)) table.refcntReleased();
+        }
+
+        isa_t oldisa;
+        isa_t newisa;
+        do {
+            oldisa = LoadExclusive(&isa.bits);
+            newisa = oldisa;
+            newisa.weakly_referenced = false;
+            newisa.has_sidetable_rc = false;
+        } while (!StoreExclusive(&isa.bits, oldisa.bits, newisa.bits));
+        return weaklyReferenced;
+    }
+#endif
+
+    // Keep the entry: it holds SIDE_TABLE_DEALLOCATING until 
+    // sidetable_clearDeallocating() removes it.
+    RefcountMap::iterator it = table.refcnts.find(this);
+    if (it == table.refcnts.end()) return false;
+    if (! (it->second & SIDE_TABLE_WEAKLY_REFERENCED)) return false;
+    weak_clear_no_lock(&table.weak_table, (id)this);
+    it->second &= ~SIDE_TABLE_WEAKLY_REFERENCED;
+    return true;
 }
 
 
@@ -1542,6 +2591,313 @@ id objc_autorelease(id obj) { return [obj autorelease]; }
 #endif
 
 
+/***********************************************************************
+* objc_setImmortal
+* Makes obj's retain count irrelevant. Retain, release, and autorelease 
+* of obj do nothing, and obj is never deallocated. 
+* Non-pointer isa objects are marked in the isa itself, so these calls 
+* return without any atomic operation. Other objects pin their 
+* side table retain count.
+**********************************************************************/
+void
+objc_setImmortal(id obj)
+{
+    if (!obj) return;
+    if (UseGC) return;
+
+    obj->rootSetImmortal();
+}
+
+
+/***********************************************************************
+* objc_retainBatch, objc_releaseBatch
+* Retain or release many objects at once.
+* Non-pointer isa counts are updated in place, prefetching isa words
+* a few objects ahead. Objects that need the side table are collected,
+* sorted by stripe, and handled with one lock acquisition per stripe.
+* objc_releaseBatch() sends -dealloc after those locks are dropped.
+* Before that it clears the weak references of all the dying objects, 
+* again with one lock acquisition per stripe.
+* Objects with custom RR go through their -retain or -release as usual.
+* Locking: acquires each side table lock at most once per
+*   RC_BATCH_SIZE objects
+*
+* releaseBatch_inOrder() is the autorelease pool drain's version. 
+* It releases strictly in order and sends -dealloc as soon as an object 
+* dies, so a -dealloc can still retain objects later in the batch. 
+* It keeps a side table lock across consecutive objects in one stripe.
+**********************************************************************/
+
+#if __OBJC2__
+
+// Objects waiting for a side table lock or for -dealloc, per pass. 
+// The buffers are on the stack, and -dealloc can call 
+// objc_releaseBatch() again, so this stays small.
+#define RC_BATCH_SIZE 32
+
+// Distance ahead of the current object to prefetch.
+#define RC_BATCH_PREFETCH 8
+
+struct rc_batch_entry_t {
+    unsigned int stripe;
+    objc_object *obj;
+};
+
+static bool
+rc_batch_entry_less(const rc_batch_entry_t& lhs, const rc_batch_entry_t& rhs)
+{
+    return lhs.stripe < rhs.stripe;
+}
+
+static void
+rc_batch_add(rc_batch_entry_t *entries, size_t& count, objc_object *obj)
+{
+    entries[count].stripe = StripedMap<SideTable>::stripeIndex(obj);
+    entries[count].obj = obj;
+    count++;
+}
+
+static void
+retainBatch_locked(rc_batch_entry_t *entries, size_t count)
+{
+    std::sort(entries, entries + count, rc_batch_entry_less);
+
+    size_t i = 0;
+    while (i < count) {
+        unsigned int stripe = entries[i].stripe;
+        SideTable& table = SideTables().stripe(stripe);
+        table.lock();
+        do {
+            entries[i].obj->rootRetain_batchLocked(table);
+        } while (++i < count  &&  entries[i].stripe == stripe);
+        table.unlock();
+    }
+}
+
+static void
+releaseBatch_locked(rc_batch_entry_t *entries, size_t count,
+                    objc_object **dead, size_t& deadCount)
+{
+    std::sort(entries, entries + count, rc_batch_entry_less);
+
+    size_t i = 0;
+    while (i < count) {
+        unsigned int stripe = entries[i].stripe;
+        SideTable& table = SideTables().stripe(stripe);
+        table.lock();
+        do {
+            objc_object *obj = entries[i].obj;
+            if (obj->rootRelease_batchLocked(table)) dead[deadCount++] = obj;
+        } while (++i < count  &&  entries[i].stripe == stripe);
+        table.unlock();
+    }
+}
+
+// Clears the weak references of every dead object that has any, 
+// with one lock acquisition per stripe, and then waits once for 
+// lock-free weak loads of all of them.
+static void
+releaseBatch_clearDeallocating(objc_object **dead, size_t count)
+{
+    rc_batch_entry_t entries[RC_BATCH_SIZE];
+    size_t entryCount = 0;
+    for (size_t i = 0; i < count; i++) {
+        objc_object *obj = dead[i];
+#if SUPPORT_NONPOINTER_ISA
+        if (obj->isa.indexed  &&  
+            !obj->isa.weakly_referenced  &&  !obj->isa.has_sidetable_rc) 
+        {
+            continue;
+        }
+#endif
+        rc_batch_add(entries, entryCount, obj);
+    }
+    if (entryCount == 0) return;
+
+    std::sort(entries, entries + entryCount, rc_batch_entry_less);
+
+    id cleared[RC_BATCH_SIZE];
+    size_t clearedCount = 0;
+    size_t i = 0;
+    while (i < entryCount) {
+        unsigned int stripe = entries[i].stripe;
+        SideTable& table = SideTables().stripe(stripe);
+        table.lock();
+        do {
+            objc_object *obj = entries[i].obj;
+            if (obj->clearDeallocating_batchLocked(table)) {
+                cleared[clearedCount++] = (id)obj;
+            }
+        } while (++i < entryCount  &&  entries[i].stripe == stripe);
+        table.unlock();
+    }
+
+    weak_wait_for_readers_batch(cleared, clearedCount);
+}
+
+static void
+releaseBatch_dealloc(objc_object **dead, size_t count)
+{
+    // The objects are already deallocating, so weak loads of them 
+    // return nil whether or not their weak variables are cleared yet.
+    releaseBatch_clearDeallocating(dead, count);
+
+    for (size_t i = 0; i < count; i++) {
+        ((void(*)(objc_object *, SEL))objc_msgSend)(dead[i], SEL_dealloc);
+    }
+}
+
+
+void
+objc_retainBatch(id *objs, size_t count)
+{
+    rc_batch_entry_t slow[RC_BATCH_SIZE];
+    size_t slowCount = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (i + RC_BATCH_PREFETCH < count) {
+            __builtin_prefetch(objs[i + RC_BATCH_PREFETCH], 1);
+        }
+
+        id obj = objs[i];
+        if (!obj  ||  obj->isTaggedPointer()) continue;
+        if (obj->ISA()->hasCustomRR()) {
+            obj->retain();
+            continue;
+        }
+        if (obj->rootRetain_batchFast()) continue;
+
+        rc_batch_add(slow, slowCount, obj);
+        if (slowCount == RC_BATCH_SIZE) {
+            retainBatch_locked(slow, slowCount);
+            slowCount = 0;
+        }
+    }
+
+    retainBatch_locked(slow, slowCount);
+}
+
+
+void
+objc_releaseBatch(id *objs, size_t count)
+{
+    rc_batch_entry_t slow[RC_BATCH_SIZE];
+    size_t slowCount = 0;
+    // Each slow entry adds at most one dead object, so flushing
+    // at RC_BATCH_SIZE total leaves room for the slow path's deaths.
+    objc_object *dead[RC_BATCH_SIZE];
+    size_t deadCount = 0;
+
+    for (size_t i = 0; i < count; i++) {
+        if (i + RC_BATCH_PREFETCH < count) {
+            __builtin_prefetch(objs[i + RC_BATCH_PREFETCH], 1);
+        }
+
+        id obj = objs[i];
+        if (!obj  ||  obj->isTaggedPointer()) continue;
+        if (obj->ISA()->hasCustomRR()) {
+            obj->release();
+            continue;
+        }
+
+        bool shouldDealloc;
+        if (obj->rootRelease_batchFast(shouldDealloc)) {
+            if (shouldDealloc) dead[deadCount++] = obj;
+        } else {
+            rc_batch_add(slow, slowCount, obj);
+        }
+
+        if (slowCount + deadCount == RC_BATCH_SIZE) {
+            releaseBatch_locked(slow, slowCount, dead, deadCount);
+            slowCount = 0;
+            releaseBatch_dealloc(dead, deadCount);
+            deadCount = 0;
+        }
+    }
+
+    releaseBatch_locked(slow, slowCount, dead, deadCount);
+    releaseBatch_dealloc(dead, deadCount);
+}
+
+
+void
+releaseBatch_inOrder(id *objs, size_t count)
+{
+    // The side table still locked from the previous object, if any.
+    SideTable *locked = nil;
+
+    for (size_t i = 0; i < count; i++) {
+        if (i + RC_BATCH_PREFETCH < count) {
+            __builtin_prefetch(objs[i + RC_BATCH_PREFETCH], 1);
+        }
+
+        id obj = objs[i];
+        if (!obj  ||  obj->isTaggedPointer()) continue;
+        Class cls = obj->ISA();
+
+        bool shouldDealloc;
+        if (locked  &&  &SideTables()[obj] == locked  &&  
+            !cls->hasCustomRR()  &&  
+            !cls->inlineRCOffset()  &&  !cls->biasedRCOffset())
+        {
+            // Same stripe as the previous object. Stay locked.
+            shouldDealloc = obj->rootRelease_batchLocked(*locked);
+            if (shouldDealloc) {
+                locked->unlock();
+                locked = nil;
+            }
+        } else {
+            // Anything else may take locks of its own.
+            if (locked) {
+                locked->unlock();
+                locked = nil;
+            }
+            if (cls->hasCustomRR()) {
+                obj->release();
+                continue;
+            }
+            if (!obj->rootRelease_batchFast(shouldDealloc)) {
+                SideTable& table = SideTables()[obj];
+                table.lock();
+                shouldDealloc = obj->rootRelease_batchLocked(table);
+                if (shouldDealloc) table.unlock();
+                else locked = &table;
+            }
+        }
+
+        if (shouldDealloc) {
+            ((void(*)(objc_object *, SEL))objc_msgSend)(obj, SEL_dealloc);
+        }
+    }
+
+    if (locked) locked->unlock();
+}
+
+// OBJC2
+#else
+// not OBJC2
+
+void
+objc_retainBatch(id *objs, size_t count)
+{
+    for (size_t i = 0; i < count; i++) objc_retain(objs[i]);
+}
+
+void
+objc_releaseBatch(id *objs, size_t count)
+{
+    for (size_t i = 0; i < count; i++) objc_release(objs[i]);
+}
+
+void
+releaseBatch_inOrder(id *objs, size_t count)
+{
+    for (size_t i = 0; i < count; i++) objc_release(objs[i]);
+}
+
+#endif
+
+
 /***********************************************************************
 * Basic operations for root class implementations a.k.a. _objc_root*()
 **********************************************************************/
@@ -1767,6 +3123,9 @@ objc_autoreleasePoolPop(void *ctxt)
 {
     if (UseGC) return;
     AutoreleasePoolPage::pop(ctxt);
+#if SUPPORT_NONPOINTER_ISA
+    biasedRC_mergePending();
+#endif
 }
 
 
@@ -1789,6 +3148,21 @@ _objc_autoreleasePoolPrint(void)
     AutoreleasePoolPage::printAll();
 }
 
+void
+objc_autoreleasePoolPageStatistics(objc_autorelease_page_statistics_t *outStats)
+{
+    AutoreleasePoolPage::statistics(outStats);
+}
+
+void
+autoreleasePageCache_threadExit(_objc_pthread_data *data)
+{
+    if (data->autoreleasePageCache) {
+        AutoreleasePoolPage::threadExit(data->autoreleasePageCache);
+        data->autoreleasePageCache = nil;
+    }
+}
+
 
 // Same as objc_release but suitable for tail-calling 
 // if you need the value back and don't want to push a frame before this point.
@@ -1881,6 +3255,372 @@ void arr_init(void)
     SideTableInit();
 }
 
+
+/***********************************************************************
+* arr_memoryStatistics
+* Adds the heap memory of the side tables and autorelease pools to stats.
+* Locking: acquires each side table lock in turn
+**********************************************************************/
+void arr_memoryStatistics(objc_memory_statistic_t *stats)
+{
+    for (unsigned int i = 0; i < StripedMap<SideTable>::count(); i++) {
+        SideTable& table = SideTables().stripe(i);
+        table.lock();
+
+        stats[MEMSTAT_REFCOUNT].count += table.refcnts.size();
+        stats[MEMSTAT_REFCOUNT].bytes += table.refcnts.getMemorySize();
+
+        weak_table_t *weak_table = &table.weak_table;
+        stats[MEMSTAT_WEAK].count += weak_table->num_entries;
+        if (weak_table->weak_entries) {
+            stats[MEMSTAT_WEAK].bytes += malloc_size(weak_table->weak_entries);
+            size_t size = weak_table->mask + 1;
+            for (size_t j = 0; j < size; j++) {
+                weak_entry_t *entry = &weak_table->weak_entries[j];
+                if (entry->referent  &&  entry->out_of_line) {
+                    stats[MEMSTAT_WEAK].bytes += malloc_size(entry->referrers);
+                }
+            }
+        }
+
+        table.unlock();
+    }
+
+    AutoreleasePoolPage::memoryStatistics(stats);
+}
+
+
+/***********************************************************************
+* arr_printStripeContention
+* Logs contended side table lock acquisitions.
+* Locking: none
+**********************************************************************/
+void arr_printStripeContention(void)
+{
+    SideTables().printContention("side tables");
+}
+
+
+/***********************************************************************
+* arr_printHashStatistics
+* Logs the load and probe lengths of the side table retain count maps.
+* Locking: acquires each side table lock in turn
+**********************************************************************/
+void arr_printHashStatistics(void)
+{
+    objc::HashProbeStatistics stats = {};
+    for (unsigned int i = 0; i < StripedMap<SideTable>::count(); i++) {
+        SideTable& table = SideTables().stripe(i);
+        table.lock();
+        table.refcnts.getProbeStatistics(stats);
+        table.unlock();
+    }
+
+    _objc_inform("HASH: side table retain counts for %s[%d] (%s):", 
+                 getprogname(), getpid(), 
+                 SUPPORT_SWISS_REFCOUNTS ? "SwissMap" : "DenseMap");
+    _objc_inform("HASH: %zu entries in %zu buckets (%zu%% full)", 
+                 stats.lookups, stats.buckets, 
+                 stats.buckets ? stats.lookups * 100 / stats.buckets : 0);
+    if (stats.lookups) {
+        _objc_inform("HASH: %.2f probes and %.2f key compares per lookup, "
+                     "longest %zu probes", 
+                     (double)stats.probes / stats.lookups, 
+                     (double)stats.compares / stats.lookups, 
+                     stats.longest);
+    }
+}
+
+
+/***********************************************************************
+* Retain profiler
+* While OBJC_PRINT_RETAIN_PROFILE is set, rootRetain(), rootRelease(),
+* sidetable_retain(), and sidetable_release() report each operation to
+* retainProfile_record(). Each thread keeps one sample in
+* RETAIN_PROFILE_INTERVAL, plus every operation that retried its isa
+* update or waited for its side table lock, in its own small tables of
+* objects and classes. A key that finds no free slot near its hash
+* evicts the least-sampled entry there, so hot keys stay put.
+* Threads write only their own tables, so recording takes no locks.
+* Readers merge every thread's tables; counts may be slightly stale.
+**********************************************************************/
+
+// Prime, so loops with power-of-two strides are not aliased.
+#define RETAIN_PROFILE_INTERVAL 61
+#define RETAIN_PROFILE_OBJECTS 1024
+#define RETAIN_PROFILE_CLASSES 256
+#define RETAIN_PROFILE_PROBES 8
+// Entries of each kind logged at exit.
+#define RETAIN_PROFILE_REPORT 20
+
+struct retain_profile_entry_t {
+    uintptr_t key;  // object or class; 0 if unused
+    Class cls;
+    uint64_t samples;
+    uint64_t casRetries;
+    uint64_t lockWaits;
+};
+
+struct retain_profile_t {
+    retain_profile_t *next;
+    uint32_t countdown;
+    retain_profile_entry_t objects[RETAIN_PROFILE_OBJECTS];
+    retain_profile_entry_t classes[RETAIN_PROFILE_CLASSES];
+};
+
+// Live threads' profiles, and the merged profiles of exited threads.
+static spinlock_t RetainProfileLock;
+static retain_profile_t *RetainProfiles;
+static retain_profile_t RetiredRetainProfile;
+
+static void
+retainProfile_add(retain_profile_entry_t *entries, unsigned count,
+                  uintptr_t key, Class cls, uint64_t samples,
+                  uint64_t casRetries, uint64_t lockWaits)
+{
+    unsigned mask = count - 1;
+    unsigned start = ptr_hash(key) & mask;
+    retain_profile_entry_t *entry = nil;
+    for (unsigned i = 0; i < RETAIN_PROFILE_PROBES; i++) {
+        retain_profile_entry_t *candidate = &entries[(start + i) & mask];
+        if (candidate->key == key) {
+            entry = candidate;
+            break;
+        }
+        if (candidate->key == 0) {
+            entry = candidate;
+            entry->key = key;
+            break;
+        }
+        if (!entry  ||  candidate->samples < entry->samples) {
+            entry = candidate;
+        }
+    }
+
+    if (entry->key != key) {
+        // Evict the coldest nearby entry.
+        bzero(entry, sizeof(*entry));
+        entry->key = key;
+    }
+    entry->cls = cls;
+    entry->samples += samples;
+    entry->casRetries += casRetries;
+    entry->lockWaits += lockWaits;
+}
+
+static void
+retainProfile_merge(retain_profile_t *dst, const retain_profile_t *src)
+{
+    for (unsigned i = 0; i < RETAIN_PROFILE_OBJECTS; i++) {
+        const retain_profile_entry_t& e = src->objects[i];
+        if (!e.key) continue;
+        retainProfile_add(dst->objects, RETAIN_PROFILE_OBJECTS, e.key,
+                          e.cls, e.samples, e.casRetries, e.lockWaits);
+    }
+    for (unsigned i = 0; i < RETAIN_PROFILE_CLASSES; i++) {
+        const retain_profile_entry_t& e = src->classes[i];
+        if (!e.key) continue;
+        retainProfile_add(dst->classes, RETAIN_PROFILE_CLASSES, e.key,
+                          e.cls, e.samples, e.casRetries, e.lockWaits);
+    }
+}
+
+static retain_profile_t *
+retainProfile_registerThread(_objc_pthread_data *data)
+{
+    retain_profile_t *profile = (retain_profile_t *)
+        calloc(1, sizeof(retain_profile_t));
+    profile->countdown = RETAIN_PROFILE_INTERVAL;
+
+    RetainProfileLock.lock();
+    profile->next = RetainProfiles;
+    RetainProfiles = profile;
+    RetainProfileLock.unlock();
+
+    data->retainProfile = profile;
+    return profile;
+}
+
+
+/***********************************************************************
+* retainProfile_record
+* Records one retain or release of obj by this thread.
+* casRetries is the number of failed isa updates. lockWaited is true
+* if the side table lock was already held.
+* Locking: none, except the first time on each thread
+**********************************************************************/
+void
+retainProfile_record(objc_object *obj, uint32_t casRetries, bool lockWaited)
+{
+    _objc_pthread_data *data = _objc_fetch_pthread_data(true);
+    retain_profile_t *profile = data->retainProfile;
+    if (!profile) profile = retainProfile_registerThread(data);
+
+    uint64_t sampled = 0;
+    if (--profile->countdown == 0) {
+        profile->countdown = RETAIN_PROFILE_INTERVAL;
+        sampled = 1;
+    }
+    if (!sampled  &&  !casRetries  &&  !lockWaited) return;
+
+    Class cls = obj->ISA();
+    retainProfile_add(profile->objects, RETAIN_PROFILE_OBJECTS,
+                      (uintptr_t)obj, cls, sampled, casRetries, lockWaited);
+    retainProfile_add(profile->classes, RETAIN_PROFILE_CLASSES,
+                      (uintptr_t)cls, cls, sampled, casRetries, lockWaited);
+}
+
+// Tail-called from the frameless retain and release paths.
+id
+retainProfile_retain(objc_object *obj, uint32_t casRetries)
+{
+    retainProfile_record(obj, casRetries, false);
+    return (id)obj;
+}
+
+bool
+retainProfile_release(objc_object *obj, uint32_t casRetries)
+{
+    retainProfile_record(obj, casRetries, false);
+    return false;
+}
+
+
+/***********************************************************************
+* retainProfile_threadExit
+* Moves an exiting thread's profile into RetiredRetainProfile.
+* Locking: acquires RetainProfileLock
+**********************************************************************/
+void
+retainProfile_threadExit(_objc_pthread_data *data)
+{
+    retain_profile_t *profile = data->retainProfile;
+    if (!profile) return;
+
+    RetainProfileLock.lock();
+    for (retain_profile_t **p = &RetainProfiles; *p; p = &(*p)->next) {
+        if (*p == profile) {
+            *p = profile->next;
+            break;
+        }
+    }
+    retainProfile_merge(&RetiredRetainProfile, profile);
+    RetainProfileLock.unlock();
+
+    data->retainProfile = nil;
+    free(profile);
+}
+
+
+static void
+retainProfile_collect(vector<retain_profile_entry_t>& entries,
+                      const retain_profile_t *profile, bool byClass)
+{
+    const retain_profile_entry_t *table =
+        byClass ? profile->classes : profile->objects;
+    unsigned count = byClass ? RETAIN_PROFILE_CLASSES : RETAIN_PROFILE_OBJECTS;
+    for (unsigned i = 0; i < count; i++) {
+        if (table[i].key) entries.push_back(table[i]);
+    }
+}
+
+
+static bool
+retainProfile_byKey(const retain_profile_entry_t& a,
+                    const retain_profile_entry_t& b)
+{
+    return a.key < b.key;
+}
+
+static bool
+retainProfile_hottestFirst(const retain_profile_entry_t& a,
+                           const retain_profile_entry_t& b)
+{
+    return a.samples > b.samples;
+}
+
+
+/***********************************************************************
+* objc_copyRetainProfile
+* Returns the recorded objects or classes, hottest first.
+* Locking: acquires RetainProfileLock
+**********************************************************************/
+objc_retain_profile_entry_t *
+objc_copyRetainProfile(BOOL byClass, unsigned int *outCount)
+{
+    vector<retain_profile_entry_t> entries;
+
+    RetainProfileLock.lock();
+    retainProfile_collect(entries, &RetiredRetainProfile, byClass);
+    for (retain_profile_t *p = RetainProfiles; p; p = p->next) {
+        retainProfile_collect(entries, p, byClass);
+    }
+    RetainProfileLock.unlock();
+
+    // Combine each key's entries from different threads.
+    std::sort(entries.begin(), entries.end(), retainProfile_byKey);
+    size_t count = 0;
+    for (size_t i = 0; i < entries.size(); i++) {
+        if (count > 0  &&  entries[count-1].key == entries[i].key) {
+            entries[count-1].samples += entries[i].samples;
+            entries[count-1].casRetries += entries[i].casRetries;
+            entries[count-1].lockWaits += entries[i].lockWaits;
+        } else {
+            entries[count++] = entries[i];
+        }
+    }
+    entries.resize(count);
+
+    std::sort(entries.begin(), entries.end(), retainProfile_hottestFirst);
+
+    if (outCount) *outCount = (unsigned int)count;
+    if (count == 0) return nil;
+
+    objc_retain_profile_entry_t *result = (objc_retain_profile_entry_t *)
+        calloc(count, sizeof(objc_retain_profile_entry_t));
+    for (size_t i = 0; i < count; i++) {
+        result[i].object = byClass ? nil : (const void *)entries[i].key;
+        result[i].className = class_getName(entries[i].cls);
+        result[i].samples = entries[i].samples;
+        result[i].casRetries = entries[i].casRetries;
+        result[i].lockWaits = entries[i].lockWaits;
+    }
+    return result;
+}
+
+
+/***********************************************************************
+* arr_printRetainProfile
+* atexit() handler for OBJC_PRINT_RETAIN_PROFILE.
+* Locking: acquires RetainProfileLock
+**********************************************************************/
+void arr_printRetainProfile(void)
+{
+    _objc_inform("RETAIN: retain/release profile for %s[%d], "
+                 "1 in %d sampled:", getprogname(), getpid(),
+                 RETAIN_PROFILE_INTERVAL);
+
+    unsigned int count;
+    objc_retain_profile_entry_t *classes = objc_copyRetainProfile(YES, &count);
+    for (unsigned int i = 0; i < count  &&  i < RETAIN_PROFILE_REPORT; i++) {
+        _objc_inform("RETAIN: class  %-32s %10llu samples  "
+                     "%8llu CAS retries  %8llu lock waits",
+                     classes[i].className, classes[i].samples,
+                     classes[i].casRetries, classes[i].lockWaits);
+    }
+    free(classes);
+
+    objc_retain_profile_entry_t *objects = objc_copyRetainProfile(NO, &count);
+    for (unsigned int i = 0; i < count  &&  i < RETAIN_PROFILE_REPORT; i++) {
+        _objc_inform("RETAIN: object %-18p %-13s %10llu samples  "
+                     "%8llu CAS retries  %8llu lock waits",
+                     objects[i].object, objects[i].className,
+                     objects[i].samples,
+                     objects[i].casRetries, objects[i].lockWaits);
+    }
+    free(objects);
+}
+
 @implementation NSObject
 
 + (void)load {
@@ -47,6 +47,17 @@ template<typename KeyT, typename ValueT,
          bool IsConst = false>
 class DenseMapIterator;
 
+// Probe lengths for finding every entry of a hash table once.
+// probes counts buckets examined (DenseMap) or groups of control bytes 
+// examined (SwissMap). compares counts key comparisons.
+struct HashProbeStatistics {
+  size_t buckets;
+  size_t lookups;
+  size_t probes;
+  size_t compares;
+  size_t longest;
+};
+
 // ZeroValuesArePurgeable=true is used by the refcount table.
 // A key/value pair with value==0 is not required to be stored 
 //   in the refcount table; it could correctly be erased instead.
@@ -200,6 +211,31 @@ public:
     }
   }
 
+  // Shrink if at least 7/8 of the buckets are empty, not counting
+  // entries whose values are purgeable zeros. Larger than MIN_BUCKETS.
+  // Unlike compact() this scans every bucket, so call it occasionally.
+  void shrinkIfSparse() {
+    unsigned NumBuckets = getNumBuckets();
+    if (NumBuckets <= MIN_BUCKETS) return;
+
+    unsigned Live = getNumEntries();
+    if (ZeroValuesArePurgeable) {
+      const KeyT EmptyKey = getEmptyKey();
+      const KeyT TombstoneKey = getTombstoneKey();
+      Live = 0;
+      for (BucketT *B = getBuckets(), *E = getBucketsEnd(); B != E; ++B) {
+        if (!KeyInfoT::isEqual(B->first, EmptyKey) &&
+            !KeyInfoT::isEqual(B->first, TombstoneKey) &&
+            B->second != 0)
+          Live++;
+      }
+    }
+
+    if (NumBuckets / 8 < Live) return;
+    if (getNumEntries() == 0) shrink_and_clear();
+    else grow(Live * 2);
+  }
+
   bool erase(const KeyT &Val) {
     BucketT *TheBucket;
     if (!LookupBucketFor(Val, TheBucket))
@@ -570,6 +606,35 @@ public:
   size_t getMemorySize() const {
     return getNumBuckets() * sizeof(BucketT);
   }
+
+  /// Add the probe lengths of every entry to Stats.
+  /// Replays each entry's quadratic probe sequence; does not modify the map.
+  void getProbeStatistics(HashProbeStatistics &Stats) const {
+    const BucketT *BucketsPtr = getBuckets();
+    const unsigned NumBuckets = getNumBuckets();
+    const KeyT EmptyKey = getEmptyKey();
+    const KeyT TombstoneKey = getTombstoneKey();
+
+    Stats.buckets += NumBuckets;
+    for (const BucketT *B = BucketsPtr, *E = getBucketsEnd(); B != E; ++B) {
+      if (KeyInfoT::isEqual(B->first, EmptyKey) ||
+          KeyInfoT::isEqual(B->first, TombstoneKey))
+        continue;
+
+      unsigned BucketNo = getHashValue(B->first) & (NumBuckets-1);
+      unsigned ProbeAmt = 1;
+      size_t Probes = 1;
+      while (BucketsPtr + BucketNo != B) {
+        BucketNo += ProbeAmt++;
+        BucketNo &= (NumBuckets-1);
+        Probes++;
+      }
+      Stats.lookups++;
+      Stats.probes += Probes;
+      Stats.compares += Probes;
+      if (Probes > Stats.longest) Stats.longest = Probes;
+    }
+  }
 };
 
 template<typename KeyT, typename ValueT,
@@ -41,7 +41,9 @@
 - (id)mutableCopyWithZone:(void *)zone;
 @end
 
-static StripedMap<spinlock_t> PropertyLocks;
+typedef spinlock_tt<LOCKCLASS_PROPERTY> PropertyLock;
+
+static StripedMap<PropertyLock> PropertyLocks;
 
 #define MUTABLE_COPY 2
 
@@ -55,7 +57,7 @@ id objc_getProperty_non_gc(id self, SEL _cmd, ptrdiff_t offset, BOOL atomic) {
     if (!atomic) return *slot;
         
     // Atomic retain release world
-    spinlock_t& slotlock = PropertyLocks[slot];
+    PropertyLock& slotlock = PropertyLocks[slot];
     slotlock.lock();
     id value = objc_retain(*slot);
     slotlock.unlock();
@@ -90,7 +92,7 @@ static inline void reallySetProperty(id self, SEL _cmd, id newValue, ptrdiff_t o
         oldValue = *slot;
         *slot = newValue;
     } else {
-        spinlock_t& slotlock = PropertyLocks[slot];
+        PropertyLock& slotlock = PropertyLocks[slot];
         slotlock.lock();
         oldValue = *slot;
         *slot = newValue;        
@@ -166,13 +168,13 @@ objc_setProperty(id self, SEL _cmd, ptrdiff_t offset, id newValue,
 // if simultaneously used for a setter then there would be contention on src.
 // So we need two locks - one of which will be contended.
 void objc_copyStruct(void *dest, const void *src, ptrdiff_t size, BOOL atomic, BOOL hasStrong) {
-    static StripedMap<spinlock_t> StructLocks;
-    spinlock_t *srcLock = nil;
-    spinlock_t *dstLock = nil;
+    static StripedMap<PropertyLock> StructLocks;
+    PropertyLock *srcLock = nil;
+    PropertyLock *dstLock = nil;
     if (atomic) {
         srcLock = &StructLocks[src];
         dstLock = &StructLocks[dest];
-        spinlock_t::lockTwo(srcLock, dstLock);
+        PropertyLock::lockTwo(srcLock, dstLock);
     }
 #if SUPPORT_GC
     if (UseGC && hasStrong) {
@@ -183,18 +185,25 @@ void objc_copyStruct(void *dest, const void *src, ptrdiff_t size, BOOL atomic, B
         memmove(dest, src, size);
     }
     if (atomic) {
-        spinlock_t::unlockTwo(srcLock, dstLock);
+        PropertyLock::unlockTwo(srcLock, dstLock);
     }
 }
 
 void objc_copyCppObjectAtomic(void *dest, const void *src, void (*copyHelper) (void *dest, const void *source)) {
-    static StripedMap<spinlock_t> CppObjectLocks;
-    spinlock_t *srcLock = &CppObjectLocks[src];
-    spinlock_t *dstLock = &CppObjectLocks[dest];
-    spinlock_t::lockTwo(srcLock, dstLock);
+    static StripedMap<PropertyLock> CppObjectLocks;
+    PropertyLock *srcLock = &CppObjectLocks[src];
+    PropertyLock *dstLock = &CppObjectLocks[dest];
+    PropertyLock::lockTwo(srcLock, dstLock);
 
     // let C++ code perform the actual copy.
     copyHelper(dest, src);
     
-    spinlock_t::unlockTwo(srcLock, dstLock);
+    PropertyLock::unlockTwo(srcLock, dstLock);
+}
+
+
+// Logs contended atomic property lock acquisitions.
+void property_printStripeContention(void)
+{
+    PropertyLocks.printContention("atomic properties");
 }
@@ -156,6 +156,16 @@
 #   define SUPPORT_QOS_HACK 1
 #endif
 
+// Define SUPPORT_SWISS_REFCOUNTS to keep side table retain counts in 
+// objc::SwissMap (objc-swissmap.h) instead of objc::DenseMap. 
+// SwissMap probes 16 slots at a time with SSE2; elsewhere it falls back 
+// to 8-slot word operations, and DenseMap remains the default there.
+#if __SSE2__
+#   define SUPPORT_SWISS_REFCOUNTS 1
+#else
+#   define SUPPORT_SWISS_REFCOUNTS 0
+#endif
+
 // OBJC_INSTRUMENTED controls whether message dispatching is dynamically
 // monitored.  Monitoring introduces substantial overhead.
 // NOTE: To define this condition, do so in the build command, NOT by
@@ -26,6 +26,12 @@ OPTION( PrintPoolHiwat,           OBJC_PRINT_POOL_HIGHWATER,       "log high-wat
 OPTION( PrintCustomRR,            OBJC_PRINT_CUSTOM_RR,            "log classes with un-optimized custom retain/release methods")
 OPTION( PrintCustomAWZ,           OBJC_PRINT_CUSTOM_AWZ,           "log classes with un-optimized custom allocWithZone methods")
 OPTION( PrintRawIsa,              OBJC_PRINT_RAW_ISA,              "log classes that require raw pointer isa fields")
+OPTION( PrintMemoryStatistics,    OBJC_PRINT_MEMORY_STATISTICS,    "log heap memory used by runtime data structures at process exit")
+OPTION( PrintStripeContention,    OBJC_PRINT_STRIPE_CONTENTION,    "log contended acquisitions of striped runtime locks at process exit")
+OPTION( PrintHashStatistics,      OBJC_PRINT_HASH_STATISTICS,      "log load factors and probe lengths of side table retain count maps at process exit")
+OPTION( PrintLockStatistics,      OBJC_PRINT_LOCK_STATISTICS,      "record runtime spin lock acquisitions and wait times, and log them at process exit")
+OPTION( PrintRetainProfile,       OBJC_PRINT_RETAIN_PROFILE,       "sample retains and releases, and log the most frequently retained objects and classes at process exit")
+OPTION( PrintWeakStatistics,      OBJC_PRINT_WEAK_STATISTICS,      "log how many weak variables deallocated objects had, and how weak referrer storage grew, at process exit")
 
 OPTION( DebugUnload,              OBJC_DEBUG_UNLOAD,               "warn about poorly-behaving bundles when unloaded")
 OPTION( DebugFragileSuperclasses, OBJC_DEBUG_FRAGILE_SUPERCLASSES, "warn about subclasses that may have been broken by subsequent changes to superclasses")
@@ -36,9 +42,12 @@ OPTION( DebugAltHandlers,         OBJC_DEBUG_ALT_HANDLERS,         "record more
 OPTION( DebugMissingPools,        OBJC_DEBUG_MISSING_POOLS,        "warn about autorelease with no pool in place, which may be a leak")
 OPTION( DebugPoolAllocation,      OBJC_DEBUG_POOL_ALLOCATION,      "halt when autorelease pools are popped out of order, and allow heap debuggers to track autorelease pools")
 OPTION( DebugDuplicateClasses,    OBJC_DEBUG_DUPLICATE_CLASSES,    "halt when multiple classes with the same name are present")
+OPTION( UsePoolSuperpages,        OBJC_USE_POOL_SUPERPAGES,        "back autorelease pool pages with 2 MB superpages where available; implies OBJC_AUTORELEASE_POOL_PAGE_SIZE=2M")
 
 OPTION( DisableGC,                OBJC_DISABLE_GC,                 "force GC OFF, even if the executable wants it on")
 OPTION( DisableVtables,           OBJC_DISABLE_VTABLES,            "disable vtable dispatch")
 OPTION( DisablePreopt,            OBJC_DISABLE_PREOPTIMIZATION,    "disable preoptimization courtesy of dyld shared cache")
 OPTION( DisableTaggedPointers,    OBJC_DISABLE_TAGGED_POINTERS,    "disable tagged pointer optimization of NSNumber et al.") 
 OPTION( DisableIndexedIsa,        OBJC_DISABLE_NONPOINTER_ISA,     "disable non-pointer isa fields")
+OPTION( DisableLazyMethodLists,   OBJC_DISABLE_LAZY_METHOD_LISTS,  "fix up method lists when classes are realized instead of when first searched")
+OPTION( ParallelImageReads,       OBJC_PARALLEL_IMAGE_READS,       "process images loaded after launch on several threads")
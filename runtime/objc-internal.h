@@ -73,6 +73,122 @@ OBJC_EXPORT Class objc_readClassPair(Class cls,
     __OSX_AVAILABLE_STARTING(__MAC_10_10, __IPHONE_8_0);
 #endif
 
+// Non-realizing class enumeration.
+// Returns a nil-terminated snapshot of the classes defined by the named 
+// image, or by all images if image is NULL. If superclass is non-nil, 
+// only superclass and its subclasses are returned. If protocol is non-nil, 
+// only classes conforming to it are returned. No class is realized, 
+// unlike objc_copyClassList(). The result must be freed with free().
+#if __OBJC2__
+OBJC_EXPORT Class *objc_copyClassListForImage(const char *image, 
+                                              Class superclass, 
+                                              Protocol *protocol, 
+                                              unsigned int *outCount)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+#endif
+
+// Reserve a word at the end of each instance of cls for retain counts 
+// that overflow the non-pointer isa, so heavily retained objects never 
+// spill to the global side tables. Subclasses inherit the word.
+// Must be called before cls is initialized or subclassed, and before 
+// any instance is created. Returns NO if that is too late, or if cls 
+// does not use non-pointer isa.
+#if __OBJC2__
+OBJC_EXPORT BOOL class_setUsesInlineRetainCount(Class cls)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+#endif
+
+// Bias the retain counts of cls's instances toward the thread that 
+// allocated each one. That thread's objc_retain() and objc_release() 
+// update a plain counter in the object without atomic instructions; 
+// other threads use the usual atomic retain count. Releases by other 
+// threads that would free the object are merged by the owning thread 
+// at its next autorelease pool pop, or when it exits.
+// Grows instances by two words. Subclasses inherit the behavior.
+// Same restrictions as class_setUsesInlineRetainCount().
+#if __OBJC2__
+OBJC_EXPORT BOOL class_setUsesBiasedRetainCount(Class cls)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+#endif
+
+// Make obj live forever. Retain, release, and autorelease of obj 
+// return immediately, obj is never deallocated, and its retainCount 
+// is saturated. Meant for singletons and sentinel values.
+// obj must not be deallocating.
+OBJC_EXPORT void objc_setImmortal(id obj)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+
+// Heap memory used by the runtime's own data structures.
+// Returns a malloc'd array with one entry per runtime subsystem, 
+// such as "class_rw_t", "method caches", or "weak table". 
+// count is the number of allocations or table entries; bytes is the 
+// heap memory they occupy. The result must be freed with free().
+// Set OBJC_PRINT_MEMORY_STATISTICS=YES to log the same data at exit.
+typedef struct objc_memory_statistic {
+    const char *name;
+    size_t count;
+    size_t bytes;
+} objc_memory_statistic_t;
+
+OBJC_EXPORT objc_memory_statistic_t *
+objc_copyMemoryStatistics(unsigned int *outCount)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+
+// Contention on the runtime's internal spin locks, by lock class: 
+// "side tables", "@synchronized", "associated objects", 
+// "atomic properties", and "other". 
+// Recorded only when OBJC_PRINT_LOCK_STATISTICS=YES, which also logs 
+// the same data at exit; otherwise every count is zero. 
+// waitNanoseconds is the total time spent waiting in contended acquisitions.
+// The result must be freed with free().
+typedef struct objc_lock_statistic {
+    const char *name;
+    uint64_t acquisitions;
+    uint64_t contentions;
+    uint64_t waitNanoseconds;
+} objc_lock_statistic_t;
+
+OBJC_EXPORT objc_lock_statistic_t *
+objc_copyLockStatistics(unsigned int *outCount)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+
+// Objects and classes whose retain counts are updated most often.
+// Recorded only when OBJC_PRINT_RETAIN_PROFILE=YES, which also logs
+// the hottest entries at exit. Each thread samples a fraction of its
+// retains and releases; samples counts those. casRetries and lockWaits
+// count every isa compare-and-swap retry and contended side table lock.
+// Entries are sorted by samples, most first. object is NULL when byClass
+// is YES, and may already have been deallocated otherwise.
+// Returns NULL if nothing was recorded. The result must be freed with free().
+typedef struct objc_retain_profile_entry {
+    const void *object;
+    const char *className;
+    uint64_t samples;
+    uint64_t casRetries;
+    uint64_t lockWaits;
+} objc_retain_profile_entry_t;
+
+OBJC_EXPORT objc_retain_profile_entry_t *
+objc_copyRetainProfile(BOOL byClass, unsigned int *outCount)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+
+// Autorelease pool page allocation by the calling thread since it started.
+// Sample before and after a unit of work and subtract to see how many pool 
+// pages the work took from malloc, reused from this thread's free pages, 
+// or reused from pages released by other threads, and how long malloc 
+// and free took.
+typedef struct objc_autorelease_page_statistics {
+    uint64_t pagesAllocated;
+    uint64_t pagesFreed;
+    uint64_t threadCacheHits;
+    uint64_t globalPoolHits;
+    uint64_t allocatorTime;  // nanoseconds
+} objc_autorelease_page_statistics_t;
+
+OBJC_EXPORT void
+objc_autoreleasePoolPageStatistics(objc_autorelease_page_statistics_t *outStats)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+
 // Batch object allocation using malloc_zone_batch_malloc().
 OBJC_EXPORT unsigned class_createInstances(Class cls, size_t extraBytes, 
                                            id *results, unsigned num_requested)
@@ -452,6 +568,24 @@ OBJC_EXPORT id objc_autorelease(id obj)
     __asm__("_objc_autorelease")
     __OSX_AVAILABLE_STARTING(__MAC_10_7, __IPHONE_5_0);
 
+// Retain or release every object in objs[0..count).
+// Equivalent to calling objc_retain() or objc_release() on each one,
+// but side table locks are taken once per batch instead of once per object.
+// nil entries are ignored and an object may appear more than once.
+//
+// objc_releaseBatch() is NOT equivalent when a -dealloc matters:
+// objects are released in groups, and every object a group frees is 
+// committed to deallocating, with its weak references cleared, before 
+// the first -dealloc of the group runs. A -dealloc must 
+// not retain or weakly load another object in the same batch that the 
+// batch may free. Use it only on objects whose deallocation order does 
+// not matter; autorelease pool drains do not use it.
+OBJC_EXPORT void objc_retainBatch(id *objs, size_t count)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+
+OBJC_EXPORT void objc_releaseBatch(id *objs, size_t count)
+    __OSX_AVAILABLE_STARTING(__MAC_10_11, __IPHONE_9_0);
+
 // Prepare a value at +1 for return through a +0 autoreleasing convention.
 OBJC_EXPORT
 id
@@ -132,6 +132,8 @@ objc_object::initInstanceIsa(Class cls, bool hasCxxDtor)
     assert(hasCxxDtor == cls->hasCxxDtor());
 
     initIsa(cls, true, hasCxxDtor);
+
+    if (cls->usesBiasedRC()) biasedRC_init(cls->biasedRCOffset());
 }
 
 inline void 
@@ -171,7 +173,11 @@ objc_object::changeIsa(Class newCls)
     do {
         transcribeToSideTable = false;
         oldisa = LoadExclusive(&isa.bits);
-        if ((oldisa.bits == 0  ||  oldisa.indexed)  &&
+        Class oldIndexedCls = (Class)((uintptr_t)oldisa.shiftcls << 3);
+        if ((oldisa.bits == 0  ||  
+             (oldisa.indexed  &&  
+              oldIndexedCls->inlineRCOffset() == newCls->inlineRCOffset()  &&
+              oldIndexedCls->biasedRCOffset() == newCls->biasedRCOffset()))  &&
             !newCls->isFuture()  &&  newCls->canAllocIndexed())
         {
             // 0 -> indexed
@@ -185,6 +191,8 @@ objc_object::changeIsa(Class newCls)
         }
         else if (oldisa.indexed) {
             // indexed -> not indexed
+            // (or between classes that keep overflow retain counts 
+            // or biased retain counts in different places)
             // Need to copy retain count et al to side table.
             // Acquire side table lock before setting isa to 
             // prevent races such as concurrent -release.
@@ -204,8 +212,32 @@ objc_object::changeIsa(Class newCls)
         // oldisa.weakly_referenced: nothing to do
         // oldisa.has_assoc: nothing to do
         // oldisa.has_cxx_dtor: nothing to do
-        sidetable_moveExtraRC_nolock(oldisa.extra_rc, 
-                                     oldisa.deallocating, 
+        Class oldCls = (Class)((uintptr_t)oldisa.shiftcls << 3);
+        size_t extra_rc = oldisa.extra_rc;
+        bool deallocating = oldisa.deallocating;
+        // Raw isa objects are never biased. Unbias the object, 
+        // and count its owner's references in the side table instead.
+        size_t biased = 0;
+        if (uint32_t offset = oldCls->biasedRCOffset()) {
+            biased = biasedRC_unbias(offset, newCls->biasedRCOffset());
+        }
+        if (oldisa.isImmortal()) {
+            // Pin the side table retain count instead.
+            extra_rc = SIZE_MAX;
+            deallocating = false;
+        }
+        else if (oldisa.has_sidetable_rc) {
+            // Empty the old class's inline retain count word, if any.
+            if (uintptr_t *rcWord = inlineRC_lock(oldCls)) {
+                size_t inlineRC = inlineRC_getExtraRC_nolock(rcWord);
+                inlineRC_subExtraRC_nolock(rcWord, inlineRC);
+                inlineRC_unlock(rcWord);
+                extra_rc += inlineRC;
+            }
+        }
+        if (!oldisa.isImmortal()) extra_rc += biased;
+        sidetable_moveExtraRC_nolock(extra_rc, 
+                                     deallocating, 
                                      oldisa.weakly_referenced);
     }
 
@@ -288,7 +320,8 @@ objc_object::rootIsDeallocating()
     assert(!UseGC);
 
     if (isTaggedPointer()) return false;
-    if (isa.indexed) return isa.deallocating;
+    isa_t bits = isa;
+    if (bits.indexed) return bits.deallocating  &&  !bits.isImmortal();
     return sidetable_isDeallocating();
 }
 
@@ -342,6 +375,10 @@ objc_object::retain()
         return rootRetain();
     }
 
+    if (ISA()->usesBiasedRC()) {
+        return rootRetainBiased(ISA()->biasedRCOffset());
+    }
+
     return ((id(*)(objc_object *, SEL))objc_msgSend)(this, SEL_retain);
 }
 
@@ -375,27 +412,43 @@ objc_object::rootRetain(bool tryRetain, bool handleOverflow)
 
     bool sideTableLocked = false;
     bool transcribeToSideTable = false;
+    // Locked inline retain count word, if the class has one.
+    // Used instead of the side table.
+    uintptr_t *rcWord = nil;
+    // Attempts at the isa update, for OBJC_PRINT_RETAIN_PROFILE.
+    uint32_t attempts = 0;
 
     isa_t oldisa;
     isa_t newisa;
 
     do {
+        attempts++;
         transcribeToSideTable = false;
         oldisa = LoadExclusive(&isa.bits);
         newisa = oldisa;
         if (!newisa.indexed) goto unindexed;
         // don't check newisa.fast_rr; we already called any RR overrides
-        if (tryRetain && newisa.deallocating) goto tryfail;
+        if (tryRetain && newisa.deallocating && !newisa.isImmortal()) {
+            goto tryfail;
+        }
         uintptr_t carry;
         newisa.bits = addc(newisa.bits, RC_ONE, 0, &carry);  // extra_rc++
 
         if (carry) {
             // newisa.extra_rc++ overflowed
+            if (oldisa.isImmortal()) goto immortal;
             if (!handleOverflow) return rootRetain_overflow(tryRetain);
             // Leave half of the retain counts inline and 
             // prepare to copy the other half to the side table.
-            if (!tryRetain && !sideTableLocked) sidetable_lock();
-            sideTableLocked = true;
+            // tryRetain's caller already holds the side table lock, 
+            // but not the inline word's lock.
+            if (!sideTableLocked  &&  !rcWord) {
+                rcWord = inlineRC_lock();
+                if (!rcWord) {
+                    if (!tryRetain) sidetable_lock();
+                    sideTableLocked = true;
+                }
+            }
             transcribeToSideTable = true;
             newisa.extra_rc = RC_HALF;
             newisa.has_sidetable_rc = true;
@@ -404,17 +457,29 @@ objc_object::rootRetain(bool tryRetain, bool handleOverflow)
 
     if (transcribeToSideTable) {
         // Copy the other half of the retain counts to the side table.
-        sidetable_addExtraRC_nolock(RC_HALF);
+        if (rcWord) inlineRC_addExtraRC_nolock(rcWord, RC_HALF);
+        else sidetable_addExtraRC_nolock(RC_HALF);
     }
 
+    if (rcWord) inlineRC_unlock(rcWord);
     if (!tryRetain && sideTableLocked) sidetable_unlock();
+    if (__builtin_expect(PrintRetainProfile, 0)) {
+        return retainProfile_retain(this, attempts - 1);
+    }
     return (id)this;
 
  tryfail:
+    if (rcWord) inlineRC_unlock(rcWord);
     if (!tryRetain && sideTableLocked) sidetable_unlock();
     return nil;
 
+ immortal:
+    if (rcWord) inlineRC_unlock(rcWord);
+    if (!tryRetain && sideTableLocked) sidetable_unlock();
+    return (id)this;
+
  unindexed:
+    if (rcWord) inlineRC_unlock(rcWord);
     if (!tryRetain && sideTableLocked) sidetable_unlock();
     if (tryRetain) return sidetable_tryRetain() ? (id)this : nil;
     else return sidetable_retain();
@@ -434,6 +499,11 @@ objc_object::release()
         return;
     }
 
+    if (ISA()->usesBiasedRC()) {
+        rootReleaseBiased(ISA()->biasedRCOffset());
+        return;
+    }
+
     ((void(*)(objc_object *, SEL))objc_msgSend)(this, SEL_release);
 }
 
@@ -467,22 +537,34 @@ objc_object::rootRelease(bool performDealloc, bool handleUnderflow)
     if (isTaggedPointer()) return false;
 
     bool sideTableLocked = false;
+    // Locked inline retain count word, if the class has one.
+    // Used instead of the side table.
+    uintptr_t *rcWord = nil;
+    // Attempts at the isa update, for OBJC_PRINT_RETAIN_PROFILE.
+    uint32_t attempts = 0;
 
     isa_t oldisa;
     isa_t newisa;
 
  retry:
     do {
+        attempts++;
         oldisa = LoadExclusive(&isa.bits);
         newisa = oldisa;
         if (!newisa.indexed) goto unindexed;
+        if (newisa.isImmortal()) goto immortal;
         // don't check newisa.fast_rr; we already called any RR overrides
         uintptr_t carry;
         newisa.bits = subc(newisa.bits, RC_ONE, 0, &carry);  // extra_rc--
         if (carry) goto underflow;
     } while (!StoreReleaseExclusive(&isa.bits, oldisa.bits, newisa.bits));
 
+ immortal:
+    if (rcWord) inlineRC_unlock(rcWord);
     if (sideTableLocked) sidetable_unlock();
+    if (__builtin_expect(PrintRetainProfile, 0)) {
+        return retainProfile_release(this, attempts - 1);
+    }
     return false;
 
  underflow:
@@ -498,9 +580,12 @@ objc_object::rootRelease(bool performDealloc, bool handleUnderflow)
 
         // Transfer retain count from side table to inline storage.
 
-        if (!sideTableLocked) {
-            sidetable_lock();
-            sideTableLocked = true;
+        if (!sideTableLocked  &&  !rcWord) {
+            rcWord = inlineRC_lock();
+            if (!rcWord) {
+                sidetable_lock();
+                sideTableLocked = true;
+            }
             if (!isa.indexed) {
                 // Lost a race vs the indexed -> not indexed transition
                 // before we got the side table lock. Stop now to avoid 
@@ -510,7 +595,9 @@ objc_object::rootRelease(bool performDealloc, bool handleUnderflow)
         }
 
         // Try to remove some retain counts from the side table.        
-        size_t borrowed = sidetable_subExtraRC_nolock(RC_HALF);
+        size_t borrowed = rcWord 
+            ? inlineRC_subExtraRC_nolock(rcWord, RC_HALF) 
+            : sidetable_subExtraRC_nolock(RC_HALF);
 
         // To avoid races, has_sidetable_rc must remain set 
         // even if the side table count is now zero.
@@ -541,7 +628,8 @@ objc_object::rootRelease(bool performDealloc, bool handleUnderflow)
             if (!stored) {
                 // Inline update failed.
                 // Put the retains back in the side table.
-                sidetable_addExtraRC_nolock(borrowed);
+                if (rcWord) inlineRC_addExtraRC_nolock(rcWord, borrowed);
+                else sidetable_addExtraRC_nolock(borrowed);
                 goto retry;
             }
 
@@ -549,7 +637,8 @@ objc_object::rootRelease(bool performDealloc, bool handleUnderflow)
             // This decrement cannot be the deallocating decrement - the side 
             // table lock and has_sidetable_rc bit ensure that if everyone 
             // else tried to -release while we worked, the last one would block.
-            sidetable_unlock();
+            if (rcWord) inlineRC_unlock(rcWord);
+            else sidetable_unlock();
             return false;
         }
         else {
@@ -559,11 +648,19 @@ objc_object::rootRelease(bool performDealloc, bool handleUnderflow)
 
     // Really deallocate.
 
+    if (rcWord) inlineRC_unlock(rcWord);
     if (sideTableLocked) sidetable_unlock();
+    // Don't unlock again if the store below fails and we retry.
+    rcWord = nil;
+    sideTableLocked = false;
 
     if (newisa.deallocating) {
         return overrelease_error();
     }
+    if (uint32_t offset = ISA()->biasedRCOffset()) {
+        // This may be the isa reference held for a biased owner.
+        if (biasedRC_absorbRelease(offset)) return false;
+    }
     newisa.deallocating = true;
     if (!StoreExclusive(&isa.bits, oldisa.bits, newisa.bits)) goto retry;
     __sync_synchronize();
@@ -573,11 +670,115 @@ objc_object::rootRelease(bool performDealloc, bool handleUnderflow)
     return true;
 
  unindexed:
+    if (rcWord) inlineRC_unlock(rcWord);
     if (sideTableLocked) sidetable_unlock();
     return sidetable_release(performDealloc);
 }
 
 
+// Batched retain/release.
+// The fast paths handle everything that does not touch the side table,
+// including inline retain count words and biased counts, which they
+// pass to rootRetain() and rootReleaseShouldDealloc().
+// They return false if the object needs its side table.
+// Like rootRetain() and rootRelease(), they record each operation 
+// for OBJC_PRINT_RETAIN_PROFILE.
+
+ALWAYS_INLINE bool
+objc_object::rootRetain_batchFast()
+{
+    isa_t oldisa;
+    isa_t newisa;
+    uint32_t attempts = 0;
+
+    do {
+        attempts++;
+        oldisa = LoadExclusive(&isa.bits);
+        newisa = oldisa;
+        if (!newisa.indexed) return false;
+        uintptr_t carry;
+        newisa.bits = addc(newisa.bits, RC_ONE, 0, &carry);  // extra_rc++
+        if (carry) {
+            if (oldisa.isImmortal()) return true;
+            if (!ISA()->inlineRCOffset()) return false;
+            rootRetain();
+            return true;
+        }
+    } while (!StoreExclusive(&isa.bits, oldisa.bits, newisa.bits));
+
+    if (__builtin_expect(PrintRetainProfile, 0)) {
+        retainProfile_record(this, attempts - 1, false);
+    }
+    return true;
+}
+
+ALWAYS_INLINE bool
+objc_object::rootRelease_batchFast(bool& shouldDealloc)
+{
+    isa_t oldisa;
+    isa_t newisa;
+    uint32_t attempts = 0;
+
+    shouldDealloc = false;
+    do {
+        attempts++;
+        oldisa = LoadExclusive(&isa.bits);
+        newisa = oldisa;
+        if (!newisa.indexed) return false;
+        if (newisa.isImmortal()) return true;
+        uintptr_t carry;
+        newisa.bits = subc(newisa.bits, RC_ONE, 0, &carry);  // extra_rc--
+        if (carry) {
+            // Borrow from the side table, or deallocate.
+            Class cls = ISA();
+            if (oldisa.has_sidetable_rc  &&
+                !cls->inlineRCOffset()  &&  !cls->biasedRCOffset())
+            {
+                return false;
+            }
+            shouldDealloc = rootReleaseShouldDealloc();
+            return true;
+        }
+    } while (!StoreReleaseExclusive(&isa.bits, oldisa.bits, newisa.bits));
+
+    if (__builtin_expect(PrintRetainProfile, 0)) {
+        retainProfile_record(this, attempts - 1, false);
+    }
+    return true;
+}
+
+
+// Lock-free try-retain for weak loads. The caller has checked for custom 
+// RR. Overflow needs the side table lock, which tryRetain's slow path 
+// expects its caller to hold, so it is left to the locked path.
+ALWAYS_INLINE bool
+objc_object::rootTryRetain_weakFast(bool& retained)
+{
+    isa_t oldisa;
+    isa_t newisa;
+
+    do {
+        oldisa = LoadExclusive(&isa.bits);
+        newisa = oldisa;
+        if (!newisa.indexed) return false;
+        if (newisa.isImmortal()) {
+            retained = true;
+            return true;
+        }
+        if (newisa.deallocating) {
+            retained = false;
+            return true;
+        }
+        uintptr_t carry;
+        newisa.bits = addc(newisa.bits, RC_ONE, 0, &carry);  // extra_rc++
+        if (carry) return false;
+    } while (!StoreExclusive(&isa.bits, oldisa.bits, newisa.bits));
+
+    retained = true;
+    return true;
+}
+
+
 // Equivalent to [this autorelease], with shortcuts if there is no override
 inline id 
 objc_object::autorelease()
@@ -599,6 +800,7 @@ objc_object::rootAutorelease()
     assert(!UseGC);
 
     if (isTaggedPointer()) return (id)this;
+    if (isa.isImmortal()) return (id)this;
     if (prepareOptimizedReturn(ReturnAtPlus1)) return (id)this;
 
     return rootAutorelease2();
@@ -610,6 +812,27 @@ objc_object::rootRetainCount()
 {
     assert(!UseGC);
     if (isTaggedPointer()) return (uintptr_t)this;
+    if (isa.isImmortal()) return UINTPTR_MAX;
+
+    // Owner references not counted in the isa, if biased.
+    intptr_t biased = 0;
+    if (uint32_t offset = ISA()->biasedRCOffset()) {
+        biased = biasedRC_extraRetainCount(offset);
+    }
+
+    if (uintptr_t *rcWord = inlineRC_lock()) {
+        isa_t bits = LoadExclusive(&isa.bits);
+        if (bits.indexed) {
+            uintptr_t rc = 1 + bits.extra_rc;
+            if (bits.has_sidetable_rc) {
+                rc += inlineRC_getExtraRC_nolock(rcWord);
+            }
+            inlineRC_unlock(rcWord);
+            return rc + biased;
+        }
+        // Lost a race vs the indexed -> not indexed transition.
+        inlineRC_unlock(rcWord);
+    }
 
     sidetable_lock();
     isa_t bits = LoadExclusive(&isa.bits);
@@ -619,11 +842,31 @@ objc_object::rootRetainCount()
             rc += sidetable_getExtraRC_nolock();
         }
         sidetable_unlock();
-        return rc;
+        return rc + biased;
     }
 
     sidetable_unlock();
-    return sidetable_retainCount();
+    return sidetable_retainCount() + biased;
+}
+
+
+inline void 
+objc_object::rootSetImmortal()
+{
+    assert(!UseGC);
+    if (isTaggedPointer()) return;
+
+ retry:
+    isa_t oldisa = LoadExclusive(&isa.bits);
+    isa_t newisa = oldisa;
+    if (!newisa.indexed) return sidetable_setImmortal();
+    if (newisa.isImmortal()) return;
+    if (newisa.deallocating) {
+        _objc_fatal("objc_setImmortal() called on deallocating object %p", 
+                    this);
+    }
+    newisa.bits |= ISA_IMMORTAL_MASK;
+    if (!StoreExclusive(&isa.bits, oldisa.bits, newisa.bits)) goto retry;
 }
 
 
@@ -870,6 +1113,29 @@ objc_object::rootReleaseShouldDealloc()
 }
 
 
+// Batched retain/release. Every retain count is in the side table.
+inline bool
+objc_object::rootRetain_batchFast()
+{
+    return false;
+}
+
+inline bool
+objc_object::rootRelease_batchFast(bool& shouldDealloc)
+{
+    shouldDealloc = false;
+    return false;
+}
+
+
+// Weak loads always take the side table lock.
+inline bool
+objc_object::rootTryRetain_weakFast(bool& retained)
+{
+    return false;
+}
+
+
 // Equivalent to [this autorelease], with shortcuts if there is no override
 inline id 
 objc_object::autorelease()
@@ -920,6 +1186,15 @@ objc_object::rootRetainCount()
 }
 
 
+inline void 
+objc_object::rootSetImmortal()
+{
+    assert(!UseGC);
+    if (isTaggedPointer()) return;
+    sidetable_setImmortal();
+}
+
+
 // not SUPPORT_NONPOINTER_ISA
 #endif
 
@@ -237,19 +237,61 @@ StoreReleaseExclusive(uintptr_t *dst, uintptr_t oldvalue, uintptr_t value)
 #endif
 
 
-class spinlock_t {
+// Lock classes for contention statistics. See objc_copyLockStatistics().
+enum lock_class_t {
+    LOCKCLASS_OTHER = 0, 
+    LOCKCLASS_SIDETABLE,      // SideTable::slock
+    LOCKCLASS_SYNCLIST,       // SyncList::lock (@synchronized)
+    LOCKCLASS_ASSOCIATIONS,   // AssociationsManager::_lock
+    LOCKCLASS_PROPERTY,       // atomic property and struct copy locks
+    LOCKCLASS_COUNT
+};
+
+// Set by OBJC_PRINT_LOCK_STATISTICS. 
+// Per-class statistics are recorded only while this is set.
+extern bool PrintLockStatistics;
+extern void lock_recordAcquisition(lock_class_t cls);
+extern void lock_recordContention(lock_class_t cls, uint64_t waitStart);
+
+template <lock_class_t LockClass> class spinlock_tt;
+typedef spinlock_tt<LOCKCLASS_OTHER> spinlock_t;
+
+template <lock_class_t LockClass>
+class spinlock_tt {
     os_lock_handoff_s mLock;
+    // Acquisitions that found the lock already held. 
+    // Updated while holding the lock, so no atomics are needed.
+    uint32_t mContentions;
+
+    void lockSlow();
+
  public:
-    spinlock_t() : mLock(OS_LOCK_HANDOFF_INIT) { }
+    spinlock_tt() : mLock(OS_LOCK_HANDOFF_INIT), mContentions(0) { }
     
-    void lock() { os_lock_lock(&mLock); }
+    void lock() { 
+        if (__builtin_expect(os_lock_trylock(&mLock), 1)) {
+            if (__builtin_expect(PrintLockStatistics, 0)) {
+                lock_recordAcquisition(LockClass);
+            }
+            return;
+        }
+        lockSlow();
+    }
     void unlock() { os_lock_unlock(&mLock); }
-    bool trylock() { return os_lock_trylock(&mLock); }
+    bool trylock() { 
+        bool result = os_lock_trylock(&mLock);
+        if (result  &&  __builtin_expect(PrintLockStatistics, 0)) {
+            lock_recordAcquisition(LockClass);
+        }
+        return result;
+    }
+
+    uint32_t contentions() const { return mContentions; }
 
 
     // Address-ordered lock discipline for a pair of locks.
 
-    static void lockTwo(spinlock_t *lock1, spinlock_t *lock2) {
+    static void lockTwo(spinlock_tt *lock1, spinlock_tt *lock2) {
         if (lock1 > lock2) {
             lock1->lock();
             lock2->lock();
@@ -259,7 +301,7 @@ class spinlock_t {
         }
     }
 
-    static void unlockTwo(spinlock_t *lock1, spinlock_t *lock2) {
+    static void unlockTwo(spinlock_tt *lock1, spinlock_tt *lock2) {
         lock1->unlock();
         if (lock2 != lock1) lock2->unlock();
     }
@@ -660,8 +702,24 @@ OBJC_EXTERN IMAGE_DOS_HEADER __ImageBase;
 
 // OS compatibility
 
+// mach_absolute_time() counts ticks, which are not nanoseconds 
+// everywhere (on arm64 a tick is 125/3 ns), so scale by the timebase.
+// mach_timebase_info() caches its answer after the first call.
 static inline uint64_t nanoseconds() {
-    return mach_absolute_time();
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+    uint64_t ticks = mach_absolute_time();
+    if (timebase.numer == timebase.denom) return ticks;
+    return ticks * timebase.numer / timebase.denom;
+}
+
+template <lock_class_t LockClass>
+NEVER_INLINE void spinlock_tt<LockClass>::lockSlow()
+{
+    uint64_t start = PrintLockStatistics ? nanoseconds() : 0;
+    os_lock_lock(&mLock);
+    mContentions++;
+    if (PrintLockStatistics) lock_recordContention(LockClass, start);
 }
 
 // Internal data types
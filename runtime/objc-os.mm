@@ -991,6 +991,70 @@ const char *CRSetCrashLogMessage2(const char *msg)
 
 #endif
 
+
+/***********************************************************************
+* Lock statistics
+* Per-class totals for spinlock_tt, recorded while PrintLockStatistics 
+* is set. Each class has its own cache line so that unrelated lock 
+* classes do not contend on their counters.
+**********************************************************************/
+struct lock_statistics_t {
+    int64_t acquisitions alignas(64);
+    int64_t contentions;
+    int64_t waitTime;
+};
+
+static lock_statistics_t LockStatistics[LOCKCLASS_COUNT];
+
+void lock_recordAcquisition(lock_class_t cls)
+{
+    OSAtomicIncrement64(&LockStatistics[cls].acquisitions);
+}
+
+void lock_recordContention(lock_class_t cls, uint64_t waitStart)
+{
+    lock_statistics_t& stats = LockStatistics[cls];
+    OSAtomicIncrement64(&stats.acquisitions);
+    OSAtomicIncrement64(&stats.contentions);
+    OSAtomicAdd64((int64_t)(nanoseconds() - waitStart), &stats.waitTime);
+}
+
+void lock_getStatistics(lock_class_t cls, uint64_t *acquisitions, 
+                        uint64_t *contentions, uint64_t *waitTime)
+{
+    *acquisitions = LockStatistics[cls].acquisitions;
+    *contentions = LockStatistics[cls].contentions;
+    *waitTime = LockStatistics[cls].waitTime;
+}
+
+
+/***********************************************************************
+* stripedMapInit
+* Chooses the stripe count shared by every StripedMap: 
+* four stripes per online CPU, rounded up to a power of two and clamped.
+* Called the first time any StripedMap is used, which may be before 
+* _objc_init() and on several threads at once. Every caller computes 
+* and stores the same value, and the value never changes afterwards.
+* Locking: none
+**********************************************************************/
+unsigned int StripedMapShift;
+
+unsigned int stripedMapInit(void)
+{
+    typedef StripedMap<spinlock_t> AnyStripedMap;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1) cpus = 1;
+
+    unsigned int shift = 0;
+    while ((1UL << shift) < (unsigned long)cpus * 4) shift++;
+    while ((1U << shift) < AnyStripedMap::MinStripeCount) shift++;
+    while ((1U << shift) > AnyStripedMap::MaxStripeCount) shift--;
+
+    StripedMapShift = shift;
+    return shift;
+}
+
 // TARGET_OS_MAC
 #else
 
@@ -93,6 +93,7 @@ union isa_t
         uintptr_t extra_rc          : 19;
 #       define RC_ONE   (1ULL<<45)
 #       define RC_HALF  (1ULL<<18)
+#       define ISA_IMMORTAL_MASK 0xffffe80000000000ULL
     };
 
 # elif __x86_64__
@@ -111,6 +112,7 @@ union isa_t
         uintptr_t extra_rc          : 8;
 #       define RC_ONE   (1ULL<<56)
 #       define RC_HALF  (1ULL<<7)
+#       define ISA_IMMORTAL_MASK 0xff40000000000000ULL
     };
 
 # else
@@ -118,6 +120,14 @@ union isa_t
 #   error unknown architecture
 # endif
 
+    // ISA_IMMORTAL_MASK is deallocating plus every bit of extra_rc. 
+    // Objects never reach that state by retaining, so objc_setImmortal() 
+    // uses it to mark objects whose retain count is ignored.
+    // Every retain of such an object overflows extra_rc.
+    bool isImmortal() {
+        return (bits & ISA_IMMORTAL_MASK) == ISA_IMMORTAL_MASK;
+    }
+
 // SUPPORT_NONPOINTER_ISA
 #endif
 
@@ -178,6 +188,22 @@ public:
     bool rootTryRetain();
     bool rootReleaseShouldDealloc();
     uintptr_t rootRetainCount();
+    void rootSetImmortal();
+
+    // Batched retain/release for objc_retainBatch() and objc_releaseBatch().
+    // The fast paths return false if the object needs its side table;
+    // the caller then locks SideTables()[this] and uses the locked path.
+    // Release paths report whether the object should now be deallocated.
+    bool rootRetain_batchFast();
+    bool rootRelease_batchFast(bool& shouldDealloc);
+    void rootRetain_batchLocked(SideTable& table);
+    bool rootRelease_batchLocked(SideTable& table);
+    bool clearDeallocating_batchLocked(SideTable& table);
+
+    // Try-retain for objc_loadWeakRetained() without the side table lock.
+    // Returns false if the object needs its side table; otherwise 
+    // sets retained to false if the object is deallocating.
+    bool rootTryRetain_weakFast(bool& retained);
 
     // Implementation of dealloc methods
     bool rootIsDeallocating();
@@ -208,6 +234,28 @@ private:
     bool sidetable_addExtraRC_nolock(size_t delta_rc);
     size_t sidetable_subExtraRC_nolock(size_t delta_rc);
     size_t sidetable_getExtraRC_nolock();
+
+    // Inline retain count word overflow for nonpointer isa, 
+    // used instead of the side table if the class reserves one.
+    // inlineRC_lock() returns the locked word, or nil if there is none.
+    uintptr_t *inlineRC_lock(Class cls);
+    uintptr_t *inlineRC_lock() { return inlineRC_lock(ISA()); }
+    static void inlineRC_unlock(uintptr_t *word);
+    static void inlineRC_addExtraRC_nolock(uintptr_t *word, size_t delta_rc);
+    static size_t inlineRC_subExtraRC_nolock(uintptr_t *word, size_t delta_rc);
+    static size_t inlineRC_getExtraRC_nolock(uintptr_t *word);
+
+    // Biased retain counts for nonpointer isa, 
+    // used by retain() and release() if the class reserves them.
+    void biasedRC_init(uint32_t offset);
+    id rootRetainBiased(uint32_t offset);
+    void rootReleaseBiased(uint32_t offset);
+    bool biasedRC_absorbRelease(uint32_t offset);
+    intptr_t biasedRC_extraRetainCount(uint32_t offset);
+    void biasedRC_enqueue(uint32_t owner, uint32_t offset);
+    void biasedRC_merge(uint32_t offset);
+    size_t biasedRC_unbias(uint32_t offset, uint32_t newOffset);
+    friend void biasedRC_mergeQueue(struct biased_rc_queue_t *queue);
 #endif
 
     // Side-table-only retain count
@@ -226,6 +274,7 @@ private:
     bool sidetable_tryRetain();
 
     uintptr_t sidetable_retainCount();
+    void sidetable_setImmortal();
 #if DEBUG
     bool sidetable_present();
 #endif
@@ -408,6 +457,7 @@ extern bool _hasObjcContents(const header_info *hi);
 /* selectors */
 extern void sel_init(bool gc, size_t selrefCount);
 extern SEL sel_registerNameNoLock(const char *str, bool copy);
+extern SEL sel_lookUpRegisteredNameNoLock(const char *str);
 extern void sel_lock(void);
 extern void sel_unlock(void);
 
@@ -644,6 +694,9 @@ extern bool _objc_dumpHeap(auto_zone_t *zone, const char *filename);
 #include "objc-env.h"
 #undef OPTION
 
+// Value of OBJC_AUTORELEASE_POOL_PAGE_SIZE, or nil.
+extern const char *AutoreleasePoolPageSize;
+
 extern void environ_init(void);
 
 extern void logReplacedMethod(const char *className, SEL s, bool isMeta, const char *catName, IMP oldImp, IMP newImp);
@@ -655,6 +708,11 @@ typedef struct {
     struct SyncCache *syncCache;  // for @synchronize
     struct alt_handler_list *handlerList;  // for exception alt handlers
     char *printableNames[4];  // temporary demangled names for logging
+    uint32_t biasedRCThread;  // owner ID for biased retain counts, or 0
+    struct biased_rc_queue_t *biasedRCQueue;  // released by other threads
+    struct retain_profile_t *retainProfile;  // for OBJC_PRINT_RETAIN_PROFILE
+    struct weak_hazard_t *weakHazard;  // for lock-free weak loads
+    struct autorelease_page_cache_t *autoreleasePageCache;  // free pool pages
 
     // If you add new fields here, don't forget to update 
     // _objc_pthread_destroyspecific()
@@ -678,11 +736,55 @@ extern void _destroySyncCache(struct SyncCache *cache);
 
 // arr
 extern void arr_init(void);
+extern void releaseBatch_inOrder(id *objs, size_t count);
+#if SUPPORT_NONPOINTER_ISA
+extern void biasedRC_threadExit(_objc_pthread_data *data);
+#endif
+extern void retainProfile_record(objc_object *obj, uint32_t casRetries, 
+                                 bool lockWaited);
+extern id retainProfile_retain(objc_object *obj, uint32_t casRetries);
+extern bool retainProfile_release(objc_object *obj, uint32_t casRetries);
+extern void retainProfile_threadExit(_objc_pthread_data *data);
+extern void weak_threadExit(_objc_pthread_data *data);
+extern void autoreleasePageCache_threadExit(_objc_pthread_data *data);
 extern id objc_autoreleaseReturnValue(id obj);
 
 // block trampolines
 extern IMP _imp_implementationWithBlockNoCopy(id block);
 
+// memory statistics
+// objc_copyMemoryStatistics() returns one entry per subsystem, in this order.
+// Each subsystem adds its allocations to its own entries.
+enum {
+    MEMSTAT_CLASS_RW, 
+    MEMSTAT_CLASS_RW_EXT, 
+    MEMSTAT_CLASS_RO_COPY, 
+    MEMSTAT_METHOD_LIST, 
+    MEMSTAT_CACHE, 
+    MEMSTAT_REFCOUNT, 
+    MEMSTAT_WEAK, 
+    MEMSTAT_ASSOCIATION, 
+    MEMSTAT_SYNC, 
+    MEMSTAT_AUTORELEASE, 
+    MEMSTAT_COUNT
+};
+#if __OBJC2__
+extern void class_memoryStatistics(objc_memory_statistic_t *stats);
+#endif
+extern void arr_memoryStatistics(objc_memory_statistic_t *stats);
+extern void _object_associations_memoryStatistics(objc_memory_statistic_t *stats);
+extern void sync_memoryStatistics(objc_memory_statistic_t *stats);
+
+extern void lock_getStatistics(lock_class_t cls, uint64_t *acquisitions, 
+                               uint64_t *contentions, uint64_t *waitTime);
+
+extern void arr_printStripeContention(void);
+extern void arr_printHashStatistics(void);
+extern void arr_printRetainProfile(void);
+extern void weak_printStatistics(void);
+extern void sync_printStripeContention(void);
+extern void property_printStripeContention(void);
+
 // layout.h
 typedef struct {
     uint8_t *bits;
@@ -831,49 +933,119 @@ class TimeLogger {
 };
 
 
+// Stripe count shared by every StripedMap: 1<<StripedMapShift.
+// Chosen from the online CPU count the first time any StripedMap is used.
+extern unsigned int StripedMapShift;
+extern unsigned int stripedMapInit(void);
+
+// Lock used to count contention for a StripedMap stripe. 
+// Stripe types that are not themselves spin locks overload this.
+template <lock_class_t LockClass>
+static inline spinlock_tt<LockClass>& lockForStripe(spinlock_tt<LockClass>& lock) 
+{
+    return lock;
+}
+
 // StripedMap<T> is a map of void* -> T, sized appropriately 
 // for cache-friendly lock striping. 
 // For example, this may be used as StripedMap<spinlock_t>
 // or as StripedMap<SomeStruct> where SomeStruct stores a spin lock.
+// 
+// The stripe count is four stripes per CPU, rounded up to a power of two 
+// and clamped to [MinStripeCount, MaxStripeCount]. Storage is reserved 
+// for MaxStripeCount stripes but only the stripes in use are constructed, 
+// so the unused tail stays as untouched zero-fill memory.
 template<typename T>
 class StripedMap {
-
+ public:
     enum { CacheLineSize = 64 };
 
 #if TARGET_OS_EMBEDDED
-    enum { StripeCount = 8 };
+    enum { MinStripeCount = 8, MaxStripeCount = 8 };
 #else
-    enum { StripeCount = 64 };
+    enum { MinStripeCount = 64, MaxStripeCount = 1024 };
 #endif
 
+ private:
     struct PaddedT {
         T value alignas(CacheLineSize);
     };
 
-    PaddedT array[StripeCount];
+    alignas(CacheLineSize) uint8_t storage[sizeof(PaddedT) * MaxStripeCount];
+
+    PaddedT *array() { return reinterpret_cast<PaddedT *>(storage); }
+
+    static unsigned int shift() {
+        unsigned int result = StripedMapShift;
+        if (__builtin_expect(result == 0, 0)) result = stripedMapInit();
+        return result;
+    }
 
     static unsigned int indexForPointer(const void *p) {
+        // Fibonacci hashing: multiply by 2^N/phi and keep the top bits.
+        // Unlike the low bits of the address, the top bits of the product 
+        // depend on every address bit, including allocation-aligned ones.
         uintptr_t addr = reinterpret_cast<uintptr_t>(p);
-        return ((addr >> 4) ^ (addr >> 9)) % StripeCount;
+#if __LP64__
+        uintptr_t hash = addr * 0x9E3779B97F4A7C15ULL;
+#else
+        uintptr_t hash = addr * 0x9E3779B9U;
+#endif
+        return (unsigned int)(hash >> (sizeof(uintptr_t)*8 - shift()));
     }
 
  public:
     T& operator[] (const void *p) { 
-        return array[indexForPointer(p)].value; 
+        return array()[indexForPointer(p)].value; 
     }
     const T& operator[] (const void *p) const { 
         return const_cast<StripedMap<T> >(this)[p];
     }
 
-#if DEBUG
+    // Stripe-by-stripe access, for visiting every T.
+    static unsigned int count() { return 1U << shift(); }
+    static unsigned int stripeIndex(const void *p) {
+        return indexForPointer(p);
+    }
+    T& stripe(unsigned int i) { 
+        assert(i < count());
+        return array()[i].value; 
+    }
+
+    // Logs contended lock acquisitions per stripe. 
+    // Unlocked; the counts may be slightly stale.
+    void printContention(const char *name) {
+        unsigned int stripes = count();
+        uint64_t total = 0;
+        unsigned int busiest = 0;
+        uint32_t busiestCount = 0;
+        for (unsigned int i = 0; i < stripes; i++) {
+            uint32_t n = lockForStripe(stripe(i)).contentions();
+            total += n;
+            if (n > busiestCount) {
+                busiest = i;
+                busiestCount = n;
+            }
+        }
+        _objc_inform("STRIPES: %-16s %5u stripes  %10llu contended  "
+                     "busiest stripe %u (%u contended)", 
+                     name, stripes, (unsigned long long)total, 
+                     busiest, busiestCount);
+    }
+
     StripedMap() {
+        unsigned int stripes = count();
+        for (unsigned int i = 0; i < stripes; i++) {
+            new (&array()[i]) PaddedT();
+        }
+#if DEBUG
         // Verify alignment expectations.
-        uintptr_t base = (uintptr_t)&array[0].value;
-        uintptr_t delta = (uintptr_t)&array[1].value - base;
+        uintptr_t base = (uintptr_t)&array()[0].value;
+        uintptr_t delta = (uintptr_t)&array()[1].value - base;
         assert(delta % CacheLineSize == 0);
         assert(base % CacheLineSize == 0);
-    }
 #endif
+    }
 };
 
 
@@ -191,7 +191,7 @@ using namespace objc_references_support;
 // lazily allocates it.
 
 class AssociationsManager {
-    static spinlock_t _lock;
+    static spinlock_tt<LOCKCLASS_ASSOCIATIONS> _lock;
     static AssociationsHashMap *_map;               // associative references:  object pointer -> PtrPtrHashMap.
 public:
     AssociationsManager()   { _lock.lock(); }
@@ -204,7 +204,7 @@ public:
     }
 };
 
-spinlock_t AssociationsManager::_lock;
+spinlock_tt<LOCKCLASS_ASSOCIATIONS> AssociationsManager::_lock;
 AssociationsHashMap *AssociationsManager::_map = NULL;
 
 // expanded policy bits.
@@ -332,3 +332,34 @@ void _object_remove_assocations(id object) {
     // the calls to releaseValue() happen outside of the lock.
     for_each(elements.begin(), elements.end(), ReleaseValue());
 }
+
+/***********************************************************************
+* _object_associations_memoryStatistics
+* Adds the heap memory of associated object storage to stats.
+* The containers don't expose their node allocations, so node sizes 
+* are estimated from the libc++ node layouts.
+* Locking: acquires the associations lock
+**********************************************************************/
+void _object_associations_memoryStatistics(objc_memory_statistic_t *stats) {
+    // rb-tree node: three links and a color, then the value
+    const size_t mapNodeSize = 
+        4 * sizeof(void *) + sizeof(ObjectAssociationMap::value_type);
+    // hash node: next link and cached hash, then the value
+    const size_t hashNodeSize = 
+        2 * sizeof(void *) + sizeof(AssociationsHashMap::value_type);
+
+    AssociationsManager manager;
+    AssociationsHashMap &associations(manager.associations());
+    size_t count = 0;
+    size_t bytes = malloc_size(&associations) + 
+        associations.bucket_count() * sizeof(void *) + 
+        associations.size() * hashNodeSize;
+    for (AssociationsHashMap::iterator i = associations.begin(), end = associations.end(); i != end; ++i) {
+        ObjectAssociationMap *refs = i->second;
+        count += refs->size();
+        bytes += malloc_size(refs) + refs->size() * mapNodeSize;
+    }
+
+    stats[MEMSTAT_ASSOCIATION].count += count;
+    stats[MEMSTAT_ASSOCIATION].bytes += bytes;
+}
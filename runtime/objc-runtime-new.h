@@ -297,6 +297,11 @@ struct protocol_t : objc_object {
     bool isFixedUp() const;
     void setFixedUp();
 
+    // The one protocol_t installed for each name is canonical. 
+    // Other definitions with the same name are duplicates of it.
+    bool isCanonical() const;
+    void setCanonical();
+
     bool hasExtendedMethodTypesField() const {
         return size >= (offsetof(protocol_t, extendedMethodTypes) 
                         + sizeof(extendedMethodTypes));
@@ -408,10 +413,15 @@ struct locstamped_category_list_t {
 #endif
 // class has instance-specific GC layout
 #define RW_HAS_INSTANCE_SPECIFIC_LAYOUT (1 << 21)
-// available for use
-// #define RW_20       (1<<20)
+// instances keep overflow retain counts in a word at ext->inlineRCOffset
+#define RW_HAS_INLINE_RC      (1<<20)
 // class has started realizing but not yet completed it
 #define RW_REALIZING          (1<<19)
+// instances reserve biased retain count words at ext->biasedRCOffset
+#define RW_HAS_BIASED_RC      (1<<15)
+// new instances are biased and retain()/release() use the owner count
+// (cleared if the class or a superclass overrides retain/release)
+#define RW_USES_BIASED_RC     (1<<14)
 
 // NOTE: MORE RW_ FLAGS DEFINED BELOW
 
@@ -619,6 +629,8 @@ class list_array_tt {
     }
 
  public:
+    list_array_tt() : list(nil) { }
+    list_array_tt(List *l) : list(l) { }
 
     uint32_t count() {
         uint32_t result = 0;
@@ -739,6 +751,9 @@ class method_array_t :
     typedef list_array_tt<method_t, method_list_t> Super;
 
  public:
+    method_array_t() : Super() { }
+    method_array_t(method_list_t *l) : Super(l) { }
+
     method_list_t **beginCategoryMethodLists() {
         return beginLists();
     }
@@ -757,6 +772,9 @@ class property_array_t :
     typedef list_array_tt<property_t, property_list_t> Super;
 
  public:
+    property_array_t() : Super() { }
+    property_array_t(property_list_t *l) : Super(l) { }
+
     property_array_t duplicate() {
         return Super::duplicate<property_array_t>();
     }
@@ -769,27 +787,66 @@ class protocol_array_t :
     typedef list_array_tt<protocol_ref_t, protocol_list_t> Super;
 
  public:
+    protocol_array_t() : Super() { }
+    protocol_array_t(protocol_list_t *l) : Super(l) { }
+
     protocol_array_t duplicate() {
         return Super::duplicate<protocol_array_t>();
     }
 };
 
 
+// Method, property, and protocol lists of a class that has been 
+// changed at runtime by categories, class_addMethod(), etc.
+// Classes that are never changed read their lists straight from class_ro_t.
+struct class_rw_ext_t {
+    method_array_t methods;
+    property_array_t properties;
+    protocol_array_t protocols;
+    // Valid if RW_HAS_INLINE_RC. See class_setUsesInlineRetainCount().
+    uint32_t inlineRCOffset;
+    // Valid if RW_HAS_BIASED_RC. See class_setUsesBiasedRetainCount().
+    uint32_t biasedRCOffset;
+};
+
+
 struct class_rw_t {
     uint32_t flags;
     uint32_t version;
 
     const class_ro_t *ro;
 
-    method_array_t methods;
-    property_array_t properties;
-    protocol_array_t protocols;
+    // nil until the class's lists are first changed. Use extAllocIfNeeded().
+    class_rw_ext_t *ext;
 
     Class firstSubclass;
     Class nextSiblingClass;
 
     char *demangledName;
 
+    // nil until class_conformsToProtocol() is first called on this class.
+    struct conformance_cache_t *conformanceCache;
+
+    // These return the lists by value. A class without ext gets an 
+    // array holding only its ro base list. Bind the result to a local 
+    // before using beginLists()/endLists() on it.
+    method_array_t methods() const {
+        if (ext) return ext->methods;
+        return method_array_t(ro->baseMethods());
+    }
+
+    property_array_t properties() const {
+        if (ext) return ext->properties;
+        return property_array_t(ro->baseProperties);
+    }
+
+    protocol_array_t protocols() const {
+        if (ext) return ext->protocols;
+        return protocol_array_t(ro->baseProtocols);
+    }
+
+    class_rw_ext_t *extAllocIfNeeded();
+
     void setFlags(uint32_t set) 
     {
         OSAtomicOr32Barrier(set, &flags);
@@ -1069,6 +1126,30 @@ struct objc_class : objc_object {
         assert(!isFuture());
         return !requiresRawIsa();
     }
+
+    // Offset of the inline retain count word in instances, or 0 if 
+    // instances overflow their retain counts to the side table.
+    // addSubclass() propagates this from the superclass.
+    uint32_t inlineRCOffset() {
+        class_rw_t *rw = data();
+        if (!(rw->flags & RW_HAS_INLINE_RC)) return 0;
+        return rw->ext->inlineRCOffset;
+    }
+    void setInlineRCOffset(uint32_t offset);
+
+    // Offset of the biased retain count words in instances, or 0 if 
+    // every thread uses the atomic isa retain count.
+    // addSubclass() propagates this from the superclass.
+    uint32_t biasedRCOffset() {
+        class_rw_t *rw = data();
+        if (!(rw->flags & RW_HAS_BIASED_RC)) return 0;
+        return rw->ext->biasedRCOffset;
+    }
+    // Existing instances may stay biased after this becomes false.
+    bool usesBiasedRC() {
+        return data()->flags & RW_USES_BIASED_RC;
+    }
+    void setBiasedRCOffset(uint32_t offset, bool uses);
     bool canAllocFast() {
         assert(!isFuture());
         return bits.canAllocFast();
@@ -32,6 +32,7 @@
 #include "objc-runtime-new.h"
 #include "objc-file.h"
 #include "objc-cache.h"
+#include "llvm-DenseMap.h"
 #include <Block.h>
 #include <objc/message.h>
 #include <mach/shared_region.h>
@@ -54,6 +55,7 @@ static bool methodListImplementsAWZ(const method_list_t *mlist);
 static void updateCustomRR_AWZ(Class cls, method_t *meth);
 static method_t *search_method_list(const method_list_t *mlist, SEL sel);
 static void flushCaches(Class cls);
+static void flushConformanceCache(Class cls);
 #if SUPPORT_FIXUP
 static void fixupMessageRef(message_ref_t *msg);
 #endif
@@ -79,6 +81,7 @@ id objc_noop_imp(id self, SEL _cmd __unused) {
 rwlock_t runtimeLock;
 rwlock_t selLock;
 mutex_t cacheUpdateLock;
+static mutex_t methodFixupLock;
 recursive_mutex_t loadMethodLock;
 
 #if SUPPORT_QOS_HACK
@@ -169,13 +172,18 @@ disableSharedCacheOptimizations(void)
 }
 
 bool method_list_t::isFixedUp() const {
-    return flags() == fixed_up_method_list;
+    // Acquire pairs with the release in setFixedUp(). 
+    // Lazily fixed-up lists are checked without methodFixupLock.
+    uint32_t bits = __atomic_load_n(&entsizeAndFlags, __ATOMIC_ACQUIRE);
+    return (bits & 0x3) == fixed_up_method_list;
 }
 
 void method_list_t::setFixedUp() {
-    runtimeLock.assertWriting();
+    // Write-locked runtimeLock, or read-locked plus methodFixupLock.
+    runtimeLock.assertLocked();
     assert(!isFixedUp());
-    entsizeAndFlags = entsize() | fixed_up_method_list;
+    __atomic_store_n(&entsizeAndFlags, entsize() | fixed_up_method_list, 
+                     __ATOMIC_RELEASE);
 }
 
 bool protocol_t::isFixedUp() const {
@@ -302,12 +310,12 @@ static class_ro_t *make_ro_writeable(class_rw_t *rw)
 * Returns the class => categories map of unattached categories.
 * Locking: runtimeLock must be held by the caller.
 **********************************************************************/
+static NXMapTable *category_map = nil;
+
 static NXMapTable *unattachedCategories(void)
 {
     runtimeLock.assertWriting();
 
-    static NXMapTable *category_map = nil;
-
     if (category_map) return category_map;
 
     // fixme initial map size
@@ -320,9 +328,10 @@ static NXMapTable *unattachedCategories(void)
 /***********************************************************************
 * addUnattachedCategoryForClass
 * Records an unattached category.
+* Returns YES if cls had no other unattached categories.
 * Locking: runtimeLock must be held by the caller.
 **********************************************************************/
-static void addUnattachedCategoryForClass(category_t *cat, Class cls, 
+static bool addUnattachedCategoryForClass(category_t *cat, Class cls, 
                                           header_info *catHeader)
 {
     runtimeLock.assertWriting();
@@ -341,6 +350,8 @@ static void addUnattachedCategoryForClass(category_t *cat, Class cls,
     }
     list->list[list->count++] = (locstamped_category_t){cat, catHeader};
     NXMapInsert(cats, cls, list);
+
+    return list->count == 1;
 }
 
 
@@ -388,6 +399,22 @@ unattachedCategoriesForClass(Class cls, bool realizing)
 }
 
 
+/***********************************************************************
+* peekUnattachedCategoriesForClass
+* Returns the list of unattached categories for a class, or nil.
+* The list is NOT removed from the map and must not be freed.
+* Locking: runtimeLock must be read- or write-locked by the caller.
+**********************************************************************/
+static const category_list *
+peekUnattachedCategoriesForClass(Class cls)
+{
+    runtimeLock.assertLocked();
+
+    if (!category_map) return nil;
+    return (const category_list *)NXMapGet(category_map, cls);
+}
+
+
 /***********************************************************************
 * removeAllUnattachedCategoriesForClass
 * Deletes all unattached categories (loaded or not) for a class.
@@ -463,7 +490,7 @@ static void printReplacements(Class cls, category_list *cats)
             }
 
             // Look for method in cls
-            for (const auto& meth2 : cls->data()->methods) {
+            for (const auto& meth2 : cls->data()->methods()) {
                 SEL s2 = sel_registerName(sel_cname(meth2.name));
                 if (s == s2) {
                     logReplacedMethod(cls->nameForLogging(), s, 
@@ -486,10 +513,16 @@ static bool isBundleClass(Class cls)
 }
 
 
+/***********************************************************************
+* fixupMethodList
+* Uniques mlist's selectors, optionally sorts it, and marks it fixed up.
+* Locking: runtimeLock must be write-locked by the caller, or 
+*   read-locked with methodFixupLock held (see fixupMethodListIfNeeded).
+**********************************************************************/
 static void 
 fixupMethodList(method_list_t *mlist, bool bundleCopy, bool sort)
 {
-    runtimeLock.assertWriting();
+    runtimeLock.assertLocked();
     assert(!mlist->isFixedUp());
 
     // fixme lock less in attachMethodLists ?
@@ -520,6 +553,37 @@ fixupMethodList(method_list_t *mlist, bool bundleCopy, bool sort)
 }
 
 
+/***********************************************************************
+* fixupMethodListIfNeeded
+* Lazy method list fixup.
+* prepareMethodLists() attaches method lists without uniquing or sorting 
+* them, unless OBJC_DISABLE_LAZY_METHOD_LISTS is set or the list comes 
+* from a bundle. Such a list is fixed up here the first time it is 
+* searched, so lists of methods that are never called stay untouched.
+* 
+* Fixup may happen while runtimeLock is only read-locked, so it is 
+* serialized by methodFixupLock, and the fixed-up bit is published last. 
+* Any code that reads an attached method list's entries with runtimeLock 
+* read-locked must call this first: another reader may be sorting the 
+* same list in place.
+* Locking: runtimeLock must be read- or write-locked by the caller. 
+*   Acquires methodFixupLock and selLock if the list is not fixed up.
+**********************************************************************/
+static ALWAYS_INLINE void 
+fixupMethodListIfNeeded(const method_list_t *mlist)
+{
+    if (__builtin_expect(mlist->isFixedUp(), 1)) return;
+
+    runtimeLock.assertLocked();
+
+    mutex_locker_t lock(methodFixupLock);
+    if (mlist->isFixedUp()) return;  // another thread won the race
+
+    // Bundle lists were fixed up eagerly, so nothing here needs copying.
+    fixupMethodList((method_list_t *)mlist, false/*bundleCopy*/, true/*sort*/);
+}
+
+
 static void 
 prepareMethodLists(Class cls, method_list_t **addedLists, int addedCount, 
                    bool baseMethods, bool methodsFromBundle)
@@ -529,7 +593,9 @@ prepareMethodLists(Class cls, method_list_t **addedLists, int addedCount,
     if (addedCount == 0) return;
 
     // Don't scan redundantly
-    bool scanForCustomRR = !UseGC && !cls->hasCustomRR();
+    // (Initialized biased classes use custom RR without an override.)
+    bool scanForCustomRR = !UseGC && 
+        (!cls->hasCustomRR() || (cls->usesBiasedRC() && cls->isInitialized()));
     bool scanForCustomAWZ = !UseGC && !cls->hasCustomAWZ();
 
     // There exist RR/AWZ special cases for some class's base methods. 
@@ -548,8 +614,12 @@ prepareMethodLists(Class cls, method_list_t **addedLists, int addedCount,
         method_list_t *mlist = addedLists[i];
         assert(mlist);
 
-        // Fixup selectors if necessary
-        if (!mlist->isFixedUp()) {
+        // Fixup selectors if necessary. Lists from bundles are fixed up 
+        // now so their selector names are copied. Other lists are left 
+        // for fixupMethodListIfNeeded() when first searched.
+        if (!mlist->isFixedUp()  &&  
+            (methodsFromBundle  ||  DisableLazyMethodLists)) 
+        {
             fixupMethodList(mlist, methodsFromBundle, true/*sort*/);
         }
 
@@ -566,63 +636,90 @@ prepareMethodLists(Class cls, method_list_t **addedLists, int addedCount,
 }
 
 
+/***********************************************************************
+* class_rw_t::extAllocIfNeeded
+* Returns the class's changeable method, property, and protocol lists,
+* allocating them first if the class has never been changed.
+* New lists start out holding ro's base lists.
+* Locking: runtimeLock must be write-locked by the caller
+**********************************************************************/
+class_rw_ext_t *class_rw_t::extAllocIfNeeded()
+{
+    runtimeLock.assertWriting();
+
+    if (!ext) {
+        class_rw_ext_t *e = (class_rw_ext_t *)calloc(sizeof(*e), 1);
+        e->methods = methods();
+        e->properties = properties();
+        e->protocols = protocols();
+        ext = e;
+    }
+
+    return ext;
+}
+
+
 // Attach method lists and properties and protocols from categories to a class.
 // Assumes the categories in cats are all loaded and sorted by load order, 
 // oldest categories first.
+// Does not flush caches. Callers attaching to a class that may already 
+// have cached methods must flush its caches afterwards.
 static void 
-attachCategories(Class cls, category_list *cats, bool flush_caches)
+attachCategories(Class cls, category_list *cats)
 {
     if (!cats) return;
     if (PrintReplacedMethods) printReplacements(cls, cats);
 
     bool isMeta = cls->isMetaClass();
 
-    // fixme rearrange to remove these intermediate allocations
-    method_list_t **mlists = (method_list_t **)
-        malloc(cats->count * sizeof(*mlists));
-    property_list_t **proplists = (property_list_t **)
-        malloc(cats->count * sizeof(*proplists));
-    protocol_list_t **protolists = (protocol_list_t **)
-        malloc(cats->count * sizeof(*protolists));
+    // Lists are gathered on the stack, ATTACH_BUFSIZ categories at a time.
+    // Each batch is newer than the one before it, and attachLists() 
+    // puts lists in front of those already attached, so the newest 
+    // categories still end up first.
+    enum { ATTACH_BUFSIZ = 64 };
+    method_list_t *mlists[ATTACH_BUFSIZ];
+    property_list_t *proplists[ATTACH_BUFSIZ];
+    protocol_list_t *protolists[ATTACH_BUFSIZ];
+
+    uint32_t next = 0;
+    while (next < cats->count) {
+        uint32_t first = next;
+        next = first + MIN(cats->count - first, (uint32_t)ATTACH_BUFSIZ);
+
+        // Count backwards through this batch to get newest categories first
+        uint32_t mcount = 0;
+        uint32_t propcount = 0;
+        uint32_t protocount = 0;
+        bool fromBundle = NO;
+        for (uint32_t i = next; i-- > first; ) {
+            auto& entry = cats->list[i];
+
+            method_list_t *mlist = entry.cat->methodsForMeta(isMeta);
+            if (mlist) {
+                mlists[mcount++] = mlist;
+                fromBundle |= entry.hi->isBundle();
+            }
 
-    // Count backwards through cats to get newest categories first
-    int mcount = 0;
-    int propcount = 0;
-    int protocount = 0;
-    int i = cats->count;
-    bool fromBundle = NO;
-    while (i--) {
-        auto& entry = cats->list[i];
+            property_list_t *proplist = entry.cat->propertiesForMeta(isMeta);
+            if (proplist) {
+                proplists[propcount++] = proplist;
+            }
 
-        method_list_t *mlist = entry.cat->methodsForMeta(isMeta);
-        if (mlist) {
-            mlists[mcount++] = mlist;
-            fromBundle |= entry.hi->isBundle();
+            protocol_list_t *protolist = entry.cat->protocols;
+            if (protolist) {
+                protolists[protocount++] = protolist;
+            }
         }
 
-        property_list_t *proplist = entry.cat->propertiesForMeta(isMeta);
-        if (proplist) {
-            proplists[propcount++] = proplist;
-        }
+        // Categories with nothing to attach don't need rw's lists.
+        if (mcount + propcount + protocount == 0) continue;
+        class_rw_ext_t *ext = cls->data()->extAllocIfNeeded();
 
-        protocol_list_t *protolist = entry.cat->protocols;
-        if (protolist) {
-            protolists[protocount++] = protolist;
-        }
+        prepareMethodLists(cls, mlists, mcount, NO, fromBundle);
+        ext->methods.attachLists(mlists, mcount);
+        ext->properties.attachLists(proplists, propcount);
+        ext->protocols.attachLists(protolists, protocount);
     }
-
-    auto rw = cls->data();
-
-    prepareMethodLists(cls, mlists, mcount, NO, fromBundle);
-    rw->methods.attachLists(mlists, mcount);
-    free(mlists);
-    if (flush_caches  &&  mcount > 0) flushCaches(cls);
-
-    rw->properties.attachLists(proplists, propcount);
-    free(proplists);
-
-    rw->protocols.attachLists(protolists, protocount);
-    free(protolists);
 }
 
 
@@ -646,21 +743,12 @@ static void methodizeClass(Class cls)
                      cls->nameForLogging(), isMeta ? "(meta)" : "");
     }
 
-    // Install methods and properties that the class implements itself.
+    // Prepare the methods that the class implements itself.
+    // The base lists are not copied into rw. rw->methods() and friends 
+    // read them from ro until something changes the class's lists.
     method_list_t *list = ro->baseMethods();
     if (list) {
         prepareMethodLists(cls, &list, 1, YES, isBundleClass(cls));
-        rw->methods.attachLists(&list, 1);
-    }
-
-    property_list_t *proplist = ro->baseProperties;
-    if (proplist) {
-        rw->properties.attachLists(&proplist, 1);
-    }
-
-    protocol_list_t *protolist = ro->baseProtocols;
-    if (protolist) {
-        rw->protocols.attachLists(&protolist, 1);
     }
 
     // Root classes get bonus method implementations if they don't have 
@@ -672,7 +760,7 @@ static void methodizeClass(Class cls)
 
     // Attach categories.
     category_list *cats = unattachedCategoriesForClass(cls, true /*realizing*/);
-    attachCategories(cls, cats, false /*don't flush caches*/);
+    attachCategories(cls, cats);
 
     if (PrintConnecting) {
         if (cats) {
@@ -688,13 +776,22 @@ static void methodizeClass(Class cls)
 
 #if DEBUG
     // Debug: sanity-check all SELs; log method list contents
-    for (const auto& meth : rw->methods) {
-        if (PrintConnecting) {
-            _objc_inform("METHOD %c[%s %s]", isMeta ? '+' : '-', 
-                         cls->nameForLogging(), sel_getName(meth.name));
+    // Lazily fixed-up lists don't have uniqued SELs yet.
+    method_array_t methods = rw->methods();
+    for (auto mlists = methods.beginLists(), 
+              end = methods.endLists(); 
+         mlists != end;
+         ++mlists)
+    {
+        if (!(*mlists)->isFixedUp()) continue;
+        for (const auto& meth : **mlists) {
+            if (PrintConnecting) {
+                _objc_inform("METHOD %c[%s %s]", isMeta ? '+' : '-', 
+                             cls->nameForLogging(), sel_getName(meth.name));
+            }
+            assert(ignoreSelector(meth.name)  ||  
+                   sel_registerName(sel_getName(meth.name)) == meth.name); 
         }
-        assert(ignoreSelector(meth.name)  ||  
-               sel_registerName(sel_getName(meth.name)) == meth.name); 
     }
 #endif
 }
@@ -704,7 +801,8 @@ static void methodizeClass(Class cls)
 * remethodizeClass
 * Attach outstanding categories to an existing class.
 * Fixes up cls's method list, protocol list, and property list.
-* Updates method caches for cls and its subclasses.
+* Does not update method caches. The caller must flush the caches of 
+* cls and its subclasses, usually with flushCachesForClasses().
 * Locking: runtimeLock must be held by the caller
 **********************************************************************/
 static void remethodizeClass(Class cls)
@@ -723,7 +821,7 @@ static void remethodizeClass(Class cls)
                          cls->nameForLogging(), isMeta ? "(meta)" : "");
         }
         
-        attachCategories(cls, cats, true /*flush caches*/);        
+        attachCategories(cls, cats);
         free(cats);
     }
 }
@@ -1438,6 +1536,14 @@ static void addSubclass(Class supercls, Class subcls)
         if (supercls->requiresRawIsa()) {
             subcls->setRequiresRawIsa(true);
         }
+
+        if (uint32_t offset = supercls->inlineRCOffset()) {
+            subcls->setInlineRCOffset(offset);
+        }
+
+        if (uint32_t offset = supercls->biasedRCOffset()) {
+            subcls->setBiasedRCOffset(offset, supercls->usesBiasedRC());
+        }
     }
 }
 
@@ -1489,17 +1595,15 @@ static NXMapTable *protocols(void)
 * Looks up a protocol by name. Demangled Swift names are recognized.
 * Locking: runtimeLock must be read- or write-locked by the caller.
 **********************************************************************/
-static Protocol *getProtocol(const char *name)
+static Protocol *getProtocolInMap(NXMapTable *protocol_map, const char *name)
 {
-    runtimeLock.assertLocked();
-
     // Try name as-is.
-    Protocol *result = (Protocol *)NXMapGet(protocols(), name);
+    Protocol *result = (Protocol *)NXMapGet(protocol_map, name);
     if (result) return result;
 
     // Try Swift-mangled equivalent of the given name.
     if (char *swName = copySwiftV1MangledName(name, true/*isProtocol*/)) {
-        result = (Protocol *)NXMapGet(protocols(), swName);
+        result = (Protocol *)NXMapGet(protocol_map, swName);
         free(swName);
         return result;
     }
@@ -1507,20 +1611,83 @@ static Protocol *getProtocol(const char *name)
     return nil;
 }
 
+static Protocol *getProtocol(const char *name)
+{
+    runtimeLock.assertLocked();
+
+    return getProtocolInMap(protocols(), name);
+}
+
+
+/***********************************************************************
+* canonicalProtocols
+* Returns the protocol => canonical protocol map.
+* Each canonical protocol maps to itself. readProtocol() also records 
+* every protocol_t it reads that lost to another definition of the 
+* same name, or that was reallocated.
+* Canonical identity is kept here rather than in protocol_t's flags 
+* so that marking a protocol never writes to shared cache pages.
+* Locking: runtimeLock must be read- or write-locked by the caller
+**********************************************************************/
+typedef objc::DenseMap<protocol_t *, protocol_t *> ProtocolRemapMap;
+static ProtocolRemapMap *canonical_protocol_map = nil;
+
+static ProtocolRemapMap *canonicalProtocols(void)
+{
+    runtimeLock.assertLocked();
+    return canonical_protocol_map;
+}
+
+static void setCanonicalProtocol(protocol_t *proto, protocol_t *canonical)
+{
+    runtimeLock.assertWriting();
+
+    if (!canonical_protocol_map) {
+        canonical_protocol_map = new ProtocolRemapMap();
+    }
+    (*canonical_protocol_map)[proto] = canonical;
+}
+
+bool protocol_t::isCanonical() const {
+    ProtocolRemapMap *map = canonicalProtocols();
+    if (!map) return false;
+    auto it = map->find((protocol_t *)this);
+    return it != map->end()  &&  it->second == this;
+}
+
+void protocol_t::setCanonical() {
+    setCanonicalProtocol(this, this);
+}
+
+static void addDuplicateProtocol(protocol_t *dup, protocol_t *canonical)
+{
+    assert(canonical->isCanonical());
+
+    if (dup == canonical) return;
+    setCanonicalProtocol(dup, canonical);
+}
+
 
 /***********************************************************************
 * remapProtocol
-* Returns the live protocol pointer for proto, which may be pointing to 
-* a protocol struct that has been reallocated.
+* Returns the canonical protocol for proto, which may be pointing to 
+* a duplicate definition or to a protocol struct that has been 
+* reallocated. Canonical protocols can be compared by pointer.
 * Locking: runtimeLock must be read- or write-locked by the caller
 **********************************************************************/
 static protocol_t *remapProtocol(protocol_ref_t proto)
 {
     runtimeLock.assertLocked();
 
-    protocol_t *newproto = (protocol_t *)
-        getProtocol(((protocol_t *)proto)->mangledName);
-    return newproto ? newproto : (protocol_t *)proto;
+    protocol_t *oldproto = (protocol_t *)proto;
+    if (ProtocolRemapMap *map = canonicalProtocols()) {
+        auto it = map->find(oldproto);
+        if (it != map->end()) return it->second;
+    }
+
+    // Not read from an image, such as a protocol under construction.
+    protocol_t *newproto = (protocol_t *)getProtocol(oldproto->mangledName);
+    return newproto ? newproto : oldproto;
 }
 
 
@@ -2122,6 +2289,114 @@ static void flushCaches(Class cls)
 }
 
 
+/***********************************************************************
+* flushCachesForClasses
+* Flushes the caches of every class in classes and its subclasses, 
+* taking cacheUpdateLock once. A class with a superclass in classes 
+* is skipped because its superclass's walk already covers it.
+* Unlike flushCaches(cls), cls's metaclass is not flushed unless it 
+* is also in classes. Root classes still cover every metaclass, 
+* because the root metaclass is their subclass.
+* Locking: runtimeLock must be write-locked by the caller
+**********************************************************************/
+static void flushCachesForClasses(Class *classes, uint32_t count)
+{
+    runtimeLock.assertWriting();
+
+    if (count == 0) return;
+
+    NXHashTable *set = NXCreateHashTable(NXPtrPrototype, count, nil);
+    for (uint32_t i = 0; i < count; i++) {
+        NXHashInsert(set, classes[i]);
+    }
+
+    mutex_locker_t lock(cacheUpdateLock);
+
+    for (uint32_t i = 0; i < count; i++) {
+        Class cls = classes[i];
+
+        bool covered = NO;
+        for (Class sup = cls->superclass; sup; sup = sup->superclass) {
+            if (NXHashMember(set, sup)) {
+                covered = YES;
+                break;
+            }
+        }
+        if (covered) continue;
+
+        foreach_realized_class_and_subclass(cls, ^(Class c){
+            cache_erase_nolock(c);
+        });
+    }
+
+    NXFreeHashTable(set);
+}
+
+
+/***********************************************************************
+* class_memoryStatistics
+* Adds the heap memory of realized classes to stats.
+* Method lists count only lists allocated at runtime,
+* such as those from class_addMethod() and objc_duplicateClass().
+* Locking: acquires runtimeLock and cacheUpdateLock
+**********************************************************************/
+static void addClassMemoryStatistics(Class cls, objc_memory_statistic_t *stats)
+{
+    auto rw = cls->data();
+
+    stats[MEMSTAT_CLASS_RW].count++;
+    stats[MEMSTAT_CLASS_RW].bytes += malloc_size(rw);
+
+    if (rw->ext) {
+        stats[MEMSTAT_CLASS_RW_EXT].count++;
+        stats[MEMSTAT_CLASS_RW_EXT].bytes += malloc_size(rw->ext);
+    }
+
+    if (rw->conformanceCache) {
+        stats[MEMSTAT_CLASS_RW].bytes += malloc_size(rw->conformanceCache);
+    }
+
+    if (rw->flags & RW_COPIED_RO) {
+        stats[MEMSTAT_CLASS_RO_COPY].count++;
+        stats[MEMSTAT_CLASS_RO_COPY].bytes += malloc_size(rw->ro);
+    }
+
+    method_array_t methods = rw->methods();
+    for (auto mlists = methods.beginLists(), end = methods.endLists();
+         mlists != end;
+         ++mlists)
+    {
+        if (size_t size = malloc_size(*mlists)) {
+            stats[MEMSTAT_METHOD_LIST].count++;
+            stats[MEMSTAT_METHOD_LIST].bytes += size;
+        }
+    }
+
+    if (cls->cache.canBeFreed()) {
+        stats[MEMSTAT_CACHE].count++;
+        stats[MEMSTAT_CACHE].bytes += malloc_size(cls->cache.buckets());
+    }
+}
+
+void class_memoryStatistics(objc_memory_statistic_t *stats)
+{
+    rwlock_reader_t lock(runtimeLock);
+    mutex_locker_t lock2(cacheUpdateLock);
+
+    Class c;
+    NXHashTable *classes = realizedClasses();
+    NXHashState state = NXInitHashState(classes);
+    while (NXNextHashState(classes, &state, (void **)&c)) {
+        addClassMemoryStatistics(c, stats);
+    }
+    classes = realizedMetaclasses();
+    state = NXInitHashState(classes);
+    while (NXNextHashState(classes, &state, (void **)&c)) {
+        addClassMemoryStatistics(c, stats);
+    }
+}
+
+
 void _objc_flush_caches(Class cls)
 {
     {
@@ -2317,6 +2592,7 @@ readProtocol(protocol_t *newproto, Class protocol_class,
 
     if (oldproto) {
         // Some other definition already won.
+        addDuplicateProtocol(newproto, oldproto);
         if (PrintProtocols) {
             _objc_inform("PROTOCOLS: protocol at %p is %s  "
                          "(duplicate of %p)",
@@ -2343,6 +2619,8 @@ readProtocol(protocol_t *newproto, Class protocol_class,
         
         assert(installedproto->getIsa() == protocol_class);
         assert(installedproto->size >= sizeof(protocol_t));
+        installedproto->setCanonical();
+        addDuplicateProtocol(newproto, installedproto);
         insertFn(protocol_map, installedproto->mangledName, 
                  installedproto);
         
@@ -2362,6 +2640,7 @@ readProtocol(protocol_t *newproto, Class protocol_class,
         // with sufficient storage. Fix it up in place.
         // fixme duplicate protocols from unloadable bundle
         newproto->initIsa(protocol_class);  // fixme pinned
+        newproto->setCanonical();
         insertFn(protocol_map, newproto->mangledName, newproto);
         if (PrintProtocols) {
             _objc_inform("PROTOCOLS: protocol at %p is %s",
@@ -2378,6 +2657,8 @@ readProtocol(protocol_t *newproto, Class protocol_class,
         installedproto->size = (__typeof__(installedproto->size))size;
         
         installedproto->initIsa(protocol_class);  // fixme pinned
+        installedproto->setCanonical();
+        addDuplicateProtocol(newproto, installedproto);
         insertFn(protocol_map, installedproto->mangledName, installedproto);
         if (PrintProtocols) {
             _objc_inform("PROTOCOLS: protocol at %p is %s  ", 
@@ -2390,6 +2671,251 @@ readProtocol(protocol_t *newproto, Class protocol_class,
     }
 }
 
+/***********************************************************************
+* Concurrent image processing
+* _read_images() holds runtimeLock for writing throughout. With 
+* OBJC_PARALLEL_IMAGE_READS set, phases whose work touches only one 
+* image's own metadata are handed to a pool of worker threads while 
+* this thread waits for them. 
+* It is never done for the images present at launch. That pass runs 
+* inside _objc_init(), which libdispatch_init() calls before libdispatch 
+* is ready to run work on other threads. 
+* Workers must not acquire runtimeLock or call anything that asserts it, 
+* because lockdebug attributes runtimeLock to this thread only. 
+* Workers may read-lock selLock. Anything that registers a selector or 
+* mutates a runtime table is left to serial code on this thread, in image 
+* order, so the outcome is identical to a fully serial pass.
+**********************************************************************/
+
+// Fewer work items than this are processed serially.
+#define CONCURRENT_FIXUP_THRESHOLD 4
+
+// Set by _read_images() for each call. 
+static bool concurrentImageReads;
+
+static void 
+applyConcurrently(size_t count, void *ctx, void (*fn)(void *, size_t))
+{
+    if (!concurrentImageReads  ||  count < CONCURRENT_FIXUP_THRESHOLD) {
+        for (size_t i = 0; i < count; i++) fn(ctx, i);
+    } else {
+        dispatch_apply_f(count, 
+                         dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_HIGH, 0),
+                         ctx, fn);
+    }
+}
+
+
+// Per-image state for the concurrent @selector and @protocol fixups.
+struct image_fixup_t {
+    header_info *hi;
+    NXMapTable *protocol_map;
+    size_t *pending;       // selrefs that still need registration
+    size_t pendingCount;
+    size_t remapped;       // protocol refs that changed
+};
+
+// Per-method-list state for the concurrent method list fixups.
+struct mlist_fixup_t {
+    method_list_t *mlist;
+    bool bundleCopy;
+    uint32_t *pending;     // methods whose selectors need registration
+    uint32_t pendingCount;
+};
+
+
+/***********************************************************************
+* fixupSelectorRefsConcurrently
+* Worker. Fixes up one image's selector references that name 
+* already-registered selectors. The rest are recorded in fixup->pending 
+* for serial registration.
+* Locking: read-locks selLock. runtimeLock is held by the waiting thread.
+**********************************************************************/
+static void fixupSelectorRefsConcurrently(void *ctx, size_t index)
+{
+    image_fixup_t *fixup = (image_fixup_t *)ctx + index;
+    if (fixup->hi->isPreoptimized()) return;
+
+    size_t count;
+    SEL *sels = _getObjc2SelectorRefs(fixup->hi, &count);
+    if (count == 0) return;
+
+    rwlock_reader_t lock(selLock);
+    for (size_t i = 0; i < count; i++) {
+        SEL sel = sel_lookUpRegisteredNameNoLock(sel_cname(sels[i]));
+        if (sel) {
+            sels[i] = sel;
+        } else {
+            if (!fixup->pending) {
+                fixup->pending = (size_t *)malloc((count-i) * sizeof(size_t));
+            }
+            fixup->pending[fixup->pendingCount++] = i;
+        }
+    }
+}
+
+
+/***********************************************************************
+* fixupProtocolRefsConcurrently
+* Worker. Remaps one image's @protocol references. 
+* Same as remapProtocolRef(), but fixup->protocol_map is passed in 
+* because protocols() asserts runtimeLock. No protocols are added to 
+* the map while the workers run.
+* Locking: none. runtimeLock is held by the waiting thread.
+**********************************************************************/
+static void fixupProtocolRefsConcurrently(void *ctx, size_t index)
+{
+    image_fixup_t *fixup = (image_fixup_t *)ctx + index;
+
+    size_t count;
+    protocol_t **protolist = _getObjc2ProtocolRefs(fixup->hi, &count);
+    for (size_t i = 0; i < count; i++) {
+        protocol_t *newproto = (protocol_t *)
+            getProtocolInMap(fixup->protocol_map, protolist[i]->mangledName);
+        if (newproto  &&  newproto != protolist[i]) {
+            protolist[i] = newproto;
+            fixup->remapped++;
+        }
+    }
+}
+
+
+/***********************************************************************
+* lookUpMethodSelectorsConcurrently
+* Worker. Uniques the selectors of one method list that are already 
+* registered. The rest are recorded in fixup->pending.
+* Locking: read-locks selLock. runtimeLock is held by the waiting thread.
+**********************************************************************/
+static void lookUpMethodSelectorsConcurrently(void *ctx, size_t index)
+{
+    mlist_fixup_t *fixup = (mlist_fixup_t *)ctx + index;
+    method_list_t *mlist = fixup->mlist;
+
+    rwlock_reader_t lock(selLock);
+    for (uint32_t i = 0; i < mlist->count; i++) {
+        method_t& meth = mlist->get(i);
+        SEL sel = sel_lookUpRegisteredNameNoLock(sel_cname(meth.name));
+        if (sel) {
+            meth.name = sel;
+        } else {
+            if (!fixup->pending) {
+                fixup->pending = (uint32_t *)
+                    malloc((mlist->count-i) * sizeof(uint32_t));
+            }
+            fixup->pending[fixup->pendingCount++] = i;
+        }
+    }
+}
+
+
+/***********************************************************************
+* sortMethodListConcurrently
+* Worker. Finishes fixupMethodList() for one method list whose 
+* selectors are all uniqued, except for the final setFixedUp().
+* Locking: none. runtimeLock is held by the waiting thread.
+**********************************************************************/
+static void sortMethodListConcurrently(void *ctx, size_t index)
+{
+    mlist_fixup_t *fixup = (mlist_fixup_t *)ctx + index;
+    method_list_t *mlist = fixup->mlist;
+
+    for (auto& meth : *mlist) {
+        if (ignoreSelector(meth.name)) {
+            meth.imp = (IMP)&_objc_ignored_method;
+        }
+    }
+
+    method_t::SortBySELAddress sorter;
+    std::stable_sort(mlist->begin(), mlist->end(), sorter);
+}
+
+
+/***********************************************************************
+* fixupMethodListsConcurrently
+* Equivalent to calling fixupMethodList(mlist, bundleCopy, true) 
+* on each list, with the selector lookups and sorting spread over 
+* worker threads. Each list must appear only once.
+* Locking: runtimeLock must be write-locked by the caller.
+**********************************************************************/
+static void fixupMethodListsConcurrently(mlist_fixup_t *fixups, size_t count)
+{
+    runtimeLock.assertWriting();
+
+    if (count == 0) return;
+
+    applyConcurrently(count, fixups, lookUpMethodSelectorsConcurrently);
+
+    sel_lock();
+    for (size_t i = 0; i < count; i++) {
+        mlist_fixup_t& fixup = fixups[i];
+        for (uint32_t j = 0; j < fixup.pendingCount; j++) {
+            method_t& meth = fixup.mlist->get(fixup.pending[j]);
+            meth.name = sel_registerNameNoLock(sel_cname(meth.name), 
+                                               fixup.bundleCopy);
+        }
+        free(fixup.pending);
+        fixup.pending = nil;
+        fixup.pendingCount = 0;
+    }
+    sel_unlock();
+
+    applyConcurrently(count, fixups, sortMethodListConcurrently);
+
+    for (size_t i = 0; i < count; i++) {
+        fixups[i].mlist->setFixedUp();
+    }
+}
+
+
+/***********************************************************************
+* addNonlazyMethodListFixup
+* Records cls's base method list for fixupMethodListsConcurrently() 
+* if realizeClass() would otherwise fix it up serially.
+* Locking: runtimeLock must be write-locked by the caller.
+**********************************************************************/
+static void addNonlazyMethodListFixup(Class cls, 
+                                      mlist_fixup_t *&fixups, size_t& count, 
+                                      size_t& capacity)
+{
+    runtimeLock.assertWriting();
+
+    if (cls->isRealized()  ||  cls->isFuture()) return;
+
+    const class_ro_t *ro = (const class_ro_t *)cls->data();
+    method_list_t *mlist = ro->baseMethods();
+    if (!mlist  ||  mlist->isFixedUp()) return;
+
+    if (count == capacity) {
+        capacity = capacity ? capacity*2 : 16;
+        fixups = (mlist_fixup_t *)
+            realloc(fixups, capacity * sizeof(mlist_fixup_t));
+    }
+    fixups[count++] = 
+        (mlist_fixup_t){mlist, (bool)(ro->flags & RO_FROM_BUNDLE), nil, 0};
+}
+
+
+/***********************************************************************
+* addRemethodizeClass
+* Records a realized class whose new categories are attached
+* at the end of category discovery.
+* Locking: runtimeLock must be write-locked by the caller.
+**********************************************************************/
+static void addRemethodizeClass(Class cls,
+                                Class *&classes, uint32_t& count,
+                                uint32_t& capacity)
+{
+    runtimeLock.assertWriting();
+    assert(cls->isRealized());
+
+    if (count == capacity) {
+        capacity = capacity ? capacity*2 : 16;
+        classes = (Class *)realloc(classes, capacity * sizeof(Class));
+    }
+    classes[count++] = cls;
+}
+
+
 /***********************************************************************
 * _read_images
 * Perform initial processing of the headers in the linked 
@@ -2416,6 +2942,9 @@ void _read_images(header_info **hList, uint32_t hCount)
 
     runtimeLock.assertWriting();
 
+    // Not the first call: see "Concurrent image processing".
+    concurrentImageReads = ParallelImageReads  &&  doneOnce;
+
 #define EACH_HEADER \
     hIndex = 0;         \
     crashlog_header_name(nil) && hIndex < hCount && (hi = hList[hIndex]) && crashlog_header_name(hi); \
@@ -2547,8 +3076,17 @@ void _read_images(header_info **hList, uint32_t hCount)
 
     ts.log("IMAGE TIMES: remap classes");
 
+    // Per-image state for the concurrent fixups below.
+    image_fixup_t *fixups = (image_fixup_t *)calloc(hCount, sizeof(*fixups));
+    for (EACH_HEADER) {
+        fixups[hIndex].hi = hi;
+    }
+
     // Fix up @selector references
+    // Selectors that are already registered are fixed up concurrently. 
+    // New selectors are then registered serially in image order.
     static size_t UnfixedSelectors;
+    applyConcurrently(hCount, fixups, fixupSelectorRefsConcurrently);
     sel_lock();
     for (EACH_HEADER) {
         if (hi->isPreoptimized()) continue;
@@ -2556,10 +3094,15 @@ void _read_images(header_info **hList, uint32_t hCount)
         bool isBundle = hi->isBundle();
         SEL *sels = _getObjc2SelectorRefs(hi, &count);
         UnfixedSelectors += count;
-        for (i = 0; i < count; i++) {
-            const char *name = sel_cname(sels[i]);
-            sels[i] = sel_registerNameNoLock(name, isBundle);
+        image_fixup_t& fixup = fixups[hIndex];
+        for (i = 0; i < fixup.pendingCount; i++) {
+            size_t index = fixup.pending[i];
+            const char *name = sel_cname(sels[index]);
+            sels[index] = sel_registerNameNoLock(name, isBundle);
         }
+        free(fixup.pending);
+        fixup.pending = nil;
+        fixup.pendingCount = 0;
     }
     sel_unlock();
 
@@ -2604,14 +3147,41 @@ void _read_images(header_info **hList, uint32_t hCount)
     // Fix up @protocol references
     // Preoptimized images may have the right 
     // answer already but we don't know for sure.
+    // The protocol map is not modified while the workers run.
+    NXMapTable *protocol_map = protocols();
     for (EACH_HEADER) {
-        protocol_t **protolist = _getObjc2ProtocolRefs(hi, &count);
-        for (i = 0; i < count; i++) {
-            remapProtocolRef(&protolist[i]);
+        fixups[hIndex].protocol_map = protocol_map;
+    }
+    applyConcurrently(hCount, fixups, fixupProtocolRefsConcurrently);
+    for (EACH_HEADER) {
+        UnfixedProtocolReferences += fixups[hIndex].remapped;
+    }
+    free(fixups);
+
+    ts.log("IMAGE TIMES: fix up @protocol references");
+
+    // Fix up method lists of non-lazy classes concurrently. 
+    // realizeClass() below would otherwise fix them up one at a time.
+    // With lazy method lists they are fixed up when first searched instead.
+    if (DisableLazyMethodLists) {
+        mlist_fixup_t *mfixups = nil;
+        size_t mcount = 0;
+        size_t mcapacity = 0;
+        for (EACH_HEADER) {
+            classref_t *classlist = _getObjc2NonlazyClassList(hi, &count);
+            for (i = 0; i < count; i++) {
+                Class cls = remapClass(classlist[i]);
+                if (!cls) continue;
+                addNonlazyMethodListFixup(cls, mfixups, mcount, mcapacity);
+                addNonlazyMethodListFixup(cls->ISA(), 
+                                          mfixups, mcount, mcapacity);
+            }
         }
+        fixupMethodListsConcurrently(mfixups, mcount);
+        free(mfixups);
     }
 
-    ts.log("IMAGE TIMES: fix up @protocol references");
+    ts.log("IMAGE TIMES: fix up non-lazy method lists");
 
     // Realize non-lazy classes (for +load methods and static instances)
     for (EACH_HEADER) {
@@ -2655,6 +3225,12 @@ void _read_images(header_info **hList, uint32_t hCount)
     ts.log("IMAGE TIMES: realize future classes");
 
     // Discover categories. 
+    // Categories for classes that are already realized are attached 
+    // after every category has been registered, so each class is 
+    // rebuilt once and caches are flushed once for all of them.
+    Class *remethodize = nil;
+    uint32_t remethodizeCount = 0;
+    uint32_t remethodizeCapacity = 0;
     for (EACH_HEADER) {
         category_t **catlist = 
             _getObjc2CategoryList(hi, &count);
@@ -2682,9 +3258,13 @@ void _read_images(header_info **hList, uint32_t hCount)
             if (cat->instanceMethods ||  cat->protocols  
                 ||  cat->instanceProperties) 
             {
-                addUnattachedCategoryForClass(cat, cls, hi);
+                bool first = addUnattachedCategoryForClass(cat, cls, hi);
                 if (cls->isRealized()) {
-                    remethodizeClass(cls);
+                    if (first) {
+                        addRemethodizeClass(cls, remethodize, 
+                                            remethodizeCount, 
+                                            remethodizeCapacity);
+                    }
                     classExists = YES;
                 }
                 if (PrintConnecting) {
@@ -2697,9 +3277,11 @@ void _read_images(header_info **hList, uint32_t hCount)
             if (cat->classMethods  ||  cat->protocols  
                 /* ||  cat->classProperties */) 
             {
-                addUnattachedCategoryForClass(cat, cls->ISA(), hi);
-                if (cls->ISA()->isRealized()) {
-                    remethodizeClass(cls->ISA());
+                bool first = addUnattachedCategoryForClass(cat, cls->ISA(), hi);
+                if (first  &&  cls->ISA()->isRealized()) {
+                    addRemethodizeClass(cls->ISA(), remethodize, 
+                                        remethodizeCount, 
+                                        remethodizeCapacity);
                 }
                 if (PrintConnecting) {
                     _objc_inform("CLASS: found category +%s(%s)", 
@@ -2709,6 +3291,15 @@ void _read_images(header_info **hList, uint32_t hCount)
         }
     }
 
+    for (i = 0; i < remethodizeCount; i++) {
+        remethodizeClass(remethodize[i]);
+    }
+    flushCachesForClasses(remethodize, remethodizeCount);
+    for (i = 0; i < remethodizeCount; i++) {
+        flushConformanceCache(remethodize[i]);
+    }
+    if (remethodize) free(remethodize);
+
     ts.log("IMAGE TIMES: discover categories");
 
     // Category discovery MUST BE LAST to avoid potential races 
@@ -3442,7 +4033,10 @@ protocol_conformsToProtocol_nolock(protocol_t *self, protocol_t *other)
 
     // protocols need not be fixed up
 
-    if (0 == strcmp(self->mangledName, other->mangledName)) {
+    // Canonical protocols are equal only if they are the same protocol.
+    self = remapProtocol((protocol_ref_t)self);
+    other = remapProtocol((protocol_ref_t)other);
+    if (self == other) {
         return YES;
     }
 
@@ -3450,7 +4044,7 @@ protocol_conformsToProtocol_nolock(protocol_t *self, protocol_t *other)
         uintptr_t i;
         for (i = 0; i < self->protocols->count; i++) {
             protocol_t *proto = remapProtocol(self->protocols->list[i]);
-            if (0 == strcmp(other->mangledName, proto->mangledName)) {
+            if (proto == other) {
                 return YES;
             }
             if (protocol_conformsToProtocol_nolock(proto, other)) {
@@ -3486,6 +4080,15 @@ BOOL protocol_isEqual(Protocol *self, Protocol *other)
     if (self == other) return YES;
     if (!self  ||  !other) return NO;
 
+    {
+        rwlock_reader_t lock(runtimeLock);
+        if (remapProtocol((protocol_ref_t)self) == 
+            remapProtocol((protocol_ref_t)other)) 
+        {
+            return YES;
+        }
+    }
+
     if (!protocol_conformsToProtocol(self, other)) return NO;
     if (!protocol_conformsToProtocol(other, self)) return NO;
 
@@ -3729,6 +4332,7 @@ void objc_registerProtocol(Protocol *proto_gen)
     // NOT initProtocolIsa(). The protocol object may already 
     // have been retained and we must preserve that count.
     proto->changeIsa(cls);
+    proto->setCanonical();
 
     NXMapKeyCopyingInsert(protocols(), proto->mangledName, proto);
 }
@@ -3967,6 +4571,165 @@ objc_copyClassList(unsigned int *outCount)
 }
 
 
+/***********************************************************************
+* protocolListConformsToProtocol
+* Returns YES if any protocol in list is proto or conforms to it.
+* Locking: runtimeLock must be read- or write-locked by the caller.
+**********************************************************************/
+static bool 
+protocolListConformsToProtocol(const protocol_list_t *list, protocol_t *proto)
+{
+    runtimeLock.assertLocked();
+
+    if (!list) return NO;
+
+    for (uintptr_t i = 0; i < list->count; i++) {
+        protocol_t *p = remapProtocol(list->list[i]);
+        if (p == proto  ||  protocol_conformsToProtocol_nolock(p, proto)) {
+            return YES;
+        }
+    }
+
+    return NO;
+}
+
+
+/***********************************************************************
+* classConformsToProtocolNoRealize
+* Returns YES if cls or any of its superclasses adopts proto, 
+* directly or through a category.
+* Unrealized classes are not realized. Their class_ro_t and any 
+* still-unattached categories are consulted instead.
+* Locking: runtimeLock must be read- or write-locked by the caller.
+**********************************************************************/
+static bool 
+classConformsToProtocolNoRealize(Class cls, protocol_t *proto)
+{
+    runtimeLock.assertLocked();
+
+    for ( ; cls; cls = remapClass(cls->superclass)) {
+        if (cls->isRealized()) {
+            for (const auto& proto_ref : cls->data()->protocols()) {
+                protocol_t *p = remapProtocol(proto_ref);
+                if (p == proto  ||  protocol_conformsToProtocol_nolock(p, proto)) {
+                    return YES;
+                }
+            }
+            continue;
+        }
+
+        const class_ro_t *ro = cls->isFuture() 
+            ? cls->data()->ro : (const class_ro_t *)cls->data();
+        if (protocolListConformsToProtocol(ro->baseProtocols, proto)) {
+            return YES;
+        }
+
+        if (const category_list *cats = peekUnattachedCategoriesForClass(cls)) {
+            for (uint32_t i = 0; i < cats->count; i++) {
+                if (protocolListConformsToProtocol(cats->list[i].cat->protocols, 
+                                                   proto)) 
+                {
+                    return YES;
+                }
+            }
+        }
+    }
+
+    return NO;
+}
+
+
+/***********************************************************************
+* classInheritsFromNoRealize
+* Returns YES if cls is supercls or one of its subclasses.
+* Unrealized classes are not realized.
+* Locking: runtimeLock must be read- or write-locked by the caller.
+**********************************************************************/
+static bool 
+classInheritsFromNoRealize(Class cls, Class supercls)
+{
+    runtimeLock.assertLocked();
+
+    for ( ; cls; cls = remapClass(cls->superclass)) {
+        if (cls == supercls) return YES;
+    }
+
+    return NO;
+}
+
+
+/***********************************************************************
+* objc_copyClassListForImage
+* Returns pointers to the classes defined by the named image, or by 
+* all images if image is nil. If supercls is non-nil, only supercls and 
+* its subclasses are returned. If proto_gen is non-nil, only classes 
+* that conform to it (including via superclasses and categories) 
+* are returned.
+* Unlike objc_copyClassList(), no class is realized. The result is a 
+* snapshot taken while runtimeLock is briefly read-locked; classes 
+* loaded afterwards are not included.
+* 
+* outCount may be nil. *outCount is the number of classes returned. 
+* If the returned array is not nil, it is nil-terminated and must be 
+* freed with free().
+* Locking: read-locks runtimeLock
+**********************************************************************/
+Class *
+objc_copyClassListForImage(const char *image, Class supercls, 
+                           Protocol *proto_gen, unsigned int *outCount)
+{
+    protocol_t *proto = newprotocol(proto_gen);
+    header_info *hi;
+    size_t count, max, i;
+    Class *result;
+
+    rwlock_reader_t lock(runtimeLock);
+
+    max = 0;
+    for (hi = FirstHeader; hi; hi = hi->next) {
+        if (image  &&  0 != strcmp(image, hi->fname)) continue;
+        _getObjc2ClassList(hi, &count);
+        max += count;
+    }
+
+    if (max == 0) {
+        if (outCount) *outCount = 0;
+        return nil;
+    }
+
+    result = (Class *)malloc((max+1) * sizeof(Class));
+    count = 0;
+
+    for (hi = FirstHeader; hi; hi = hi->next) {
+        if (image  &&  0 != strcmp(image, hi->fname)) continue;
+
+        size_t hcount;
+        classref_t *classlist = _getObjc2ClassList(hi, &hcount);
+        for (i = 0; i < hcount; i++) {
+            Class cls = remapClass(classlist[i]);
+            if (!cls) continue;  // ignored weak-linked class
+            if (supercls  &&  !classInheritsFromNoRealize(cls, supercls)) {
+                continue;
+            }
+            if (proto  &&  !classConformsToProtocolNoRealize(cls, proto)) {
+                continue;
+            }
+            result[count++] = cls;
+        }
+    }
+
+    if (count == 0) {
+        free(result);
+        result = nil;
+    } else {
+        result[count] = nil;
+    }
+
+    if (outCount) *outCount = (unsigned int)count;
+    return result;
+}
+
+
 /***********************************************************************
 * objc_copyProtocolList
 * Returns pointers to all protocols.
@@ -4037,13 +4800,22 @@ class_copyMethodList(Class cls, unsigned int *outCount)
     
     assert(cls->isRealized());
 
-    count = cls->data()->methods.count();
+    method_array_t methods = cls->data()->methods();
+    count = methods.count();
 
     if (count > 0) {
+        for (auto mlists = methods.beginLists(), 
+                  end = methods.endLists(); 
+             mlists != end;
+             ++mlists)
+        {
+            fixupMethodListIfNeeded(*mlists);
+        }
+
         result = (Method *)malloc((count + 1) * sizeof(Method));
         
         count = 0;
-        for (auto& meth : cls->data()->methods) {
+        for (auto& meth : methods) {
             if (! ignoreSelector(meth.name)) {
                 result[count++] = &meth;
             }
@@ -4110,15 +4882,15 @@ class_copyPropertyList(Class cls, unsigned int *outCount)
     rwlock_reader_t lock(runtimeLock);
 
     assert(cls->isRealized());
-    auto rw = cls->data();
+    property_array_t properties = cls->data()->properties();
 
     property_t **result = nil;
-    unsigned int count = rw->properties.count();
+    unsigned int count = properties.count();
     if (count > 0) {
         result = (property_t **)malloc((count + 1) * sizeof(property_t *));
 
         count = 0;
-        for (auto& prop : rw->properties) {
+        for (auto& prop : properties) {
             result[count++] = &prop;
         }
         result[count] = nil;
@@ -4251,13 +5023,14 @@ class_copyProtocolList(Class cls, unsigned int *outCount)
 
     assert(cls->isRealized());
     
-    count = cls->data()->protocols.count();
+    protocol_array_t protocols = cls->data()->protocols();
+    count = protocols.count();
 
     if (count > 0) {
         result = (Protocol **)malloc((count+1) * sizeof(Protocol *));
 
         count = 0;
-        for (const auto& proto : cls->data()->protocols) {
+        for (const auto& proto : protocols) {
             result[count++] = (Protocol *)remapProtocol(proto);
         }
         result[count] = nil;
@@ -4501,6 +5274,8 @@ static method_t *findMethodInSortedMethodList(SEL key, const method_list_t *list
 **********************************************************************/
 static method_t *search_method_list(const method_list_t *mlist, SEL sel)
 {
+    fixupMethodListIfNeeded(mlist);
+
     int methodListIsFixedUp = mlist->isFixedUp();
     int methodListHasExpectedSize = mlist->entsize() == sizeof(method_t);
     
@@ -4536,8 +5311,9 @@ getMethodNoSuper_nolock(Class cls, SEL sel)
     // fixme nil cls? 
     // fixme nil sel?
 
-    for (auto mlists = cls->data()->methods.beginLists(), 
-              end = cls->data()->methods.endLists(); 
+    method_array_t methods = cls->data()->methods();
+    for (auto mlists = methods.beginLists(), 
+              end = methods.endLists(); 
          mlists != end;
          ++mlists)
     {
@@ -4837,7 +5613,7 @@ objc_property_t class_getProperty(Class cls, const char *name)
     assert(cls->isRealized());
 
     for ( ; cls; cls = cls->superclass) {
-        for (auto& prop : cls->data()->properties) {
+        for (auto& prop : cls->data()->properties()) {
             if (0 == strcmp(name, prop.name)) {
                 return (objc_property_t)&prop;
             }
@@ -4909,7 +5685,7 @@ objc_class::setInitialized()
     }
     else if (metacls == classNSObject()->ISA()) {
         // NSObject's metaclass AWZ is default, but we still need to check cats
-        auto& methods = metacls->data()->methods;
+        method_array_t methods = metacls->data()->methods();
         for (auto mlists = methods.beginCategoryMethodLists(), 
                   end = methods.endCategoryMethodLists(metacls); 
              mlists != end;
@@ -4929,7 +5705,7 @@ objc_class::setInitialized()
     } 
     else {
         // Not metaclass NSObject.
-        auto& methods = metacls->data()->methods;
+        method_array_t methods = metacls->data()->methods();
         for (auto mlists = methods.beginLists(),
                   end = methods.endLists(); 
              mlists != end;
@@ -4961,7 +5737,7 @@ objc_class::setInitialized()
     }
     if (cls == classNSObject()) {
         // NSObject's RR is default, but we still need to check categories
-        auto& methods = cls->data()->methods;
+        method_array_t methods = cls->data()->methods();
         for (auto mlists = methods.beginCategoryMethodLists(), 
                   end = methods.endCategoryMethodLists(cls); 
              mlists != end;
@@ -4979,6 +5755,24 @@ objc_class::setInitialized()
         clsCustomRR = YES;
         inherited = NO;
     } 
+    else if (cls->usesBiasedRC()) {
+        // Biased retain counts are handled by the custom RR path 
+        // of objc_object::retain() and release(), 
+        // which must not bypass a real override.
+        bool overridden = (cls->superclass->hasCustomRR()  &&  
+                           !cls->superclass->usesBiasedRC());
+        method_array_t methods = cls->data()->methods();
+        for (auto mlists = methods.beginLists(), 
+                  end = methods.endLists(); 
+             !overridden  &&  mlists != end;
+             ++mlists)
+        {
+            if (methodListImplementsRR(*mlists)) overridden = true;
+        }
+        if (overridden) cls->clearInfo(RW_USES_BIASED_RC);
+        clsCustomRR = YES;
+        inherited = NO;
+    }
     else if (cls->superclass->hasCustomRR()) {
         // Superclass is custom RR, therefore we are too.
         clsCustomRR = YES;
@@ -4986,7 +5780,7 @@ objc_class::setInitialized()
     } 
     else {
         // Not class NSObject.
-        auto& methods = cls->data()->methods;
+        method_array_t methods = cls->data()->methods();
         for (auto mlists = methods.beginLists(), 
                   end = methods.endLists(); 
              mlists != end;
@@ -5033,12 +5827,50 @@ isRRSelector(SEL sel)
 }
 
 
+/***********************************************************************
+* scanUnfixedMethodList
+* If mlist is not fixed up yet, sets result to whether any of its 
+* methods has a selector accepted by matches(), and returns YES. 
+* Names are looked up rather than registered so that the custom RR/AWZ 
+* scans don't force a lazy method list fixup.
+* Returns NO if mlist is already fixed up. Use search_method_list().
+* Locking: runtimeLock must be read- or write-locked by the caller. 
+*   Acquires methodFixupLock and selLock.
+**********************************************************************/
+static bool 
+scanUnfixedMethodList(const method_list_t *mlist, bool (*matches)(SEL), 
+                      bool& result)
+{
+    runtimeLock.assertLocked();
+
+    if (mlist->isFixedUp()) return NO;
+
+    // methodFixupLock keeps another reader from sorting mlist meanwhile.
+    mutex_locker_t lock(methodFixupLock);
+    if (mlist->isFixedUp()) return NO;
+
+    rwlock_reader_t sellock(selLock);
+    result = NO;
+    for (const auto& meth : *mlist) {
+        SEL sel = sel_lookUpRegisteredNameNoLock(sel_cname(meth.name));
+        if (sel  &&  matches(sel)) {
+            result = YES;
+            break;
+        }
+    }
+    return YES;
+}
+
+
 /***********************************************************************
 * Return YES if mlist implements one of the isRRSelector() methods
 **********************************************************************/
 static bool 
 methodListImplementsRR(const method_list_t *mlist)
 {
+    bool result;
+    if (scanUnfixedMethodList(mlist, isRRSelector, result)) return result;
+
     return (search_method_list(mlist, SEL_retain)               ||  
             search_method_list(mlist, SEL_release)              ||  
             search_method_list(mlist, SEL_autorelease)          ||  
@@ -5066,6 +5898,9 @@ isAWZSelector(SEL sel)
 static bool 
 methodListImplementsAWZ(const method_list_t *mlist)
 {
+    bool result;
+    if (scanUnfixedMethodList(mlist, isAWZSelector, result)) return result;
+
     return (search_method_list(mlist, SEL_allocWithZone)  ||
             search_method_list(mlist, SEL_alloc));
 }
@@ -5102,6 +5937,9 @@ objc_class::printRequiresRawIsa(bool inherited)
 }
 
 
+// Set once any class uses biased retain counts.
+static bool BiasedRCClassesExist;
+
 /***********************************************************************
 * Mark this class and all of its subclasses as implementors or 
 * inheritors of custom RR (retain/release/autorelease/retainCount)
@@ -5111,6 +5949,13 @@ void objc_class::setHasCustomRR(bool inherited)
     Class cls = (Class)this;
     runtimeLock.assertWriting();
 
+    if (BiasedRCClassesExist) {
+        // Biased retain counts must not bypass the new override.
+        foreach_realized_class_and_subclass(cls, ^(Class c){
+            if (c->usesBiasedRC()) c->clearInfo(RW_USES_BIASED_RC);
+        });
+    }
+
     if (hasCustomRR()) return;
     
     foreach_realized_class_and_subclass(cls, ^(Class c){
@@ -5186,6 +6031,126 @@ void objc_class::setRequiresRawIsa(bool inherited)
 }
 
 
+/***********************************************************************
+* Mark this class's instances as keeping overflow retain counts 
+* in the word at offset instead of in the side table.
+* Locking: runtimeLock must be held by the caller
+**********************************************************************/
+void objc_class::setInlineRCOffset(uint32_t offset)
+{
+    runtimeLock.assertWriting();
+    assert(!isMetaClass());
+    assert(offset > 0  &&  offset % sizeof(uintptr_t) == 0);
+    assert(offset + sizeof(uintptr_t) <= alignedInstanceSize());
+
+    data()->extAllocIfNeeded()->inlineRCOffset = offset;
+    setInfo(RW_HAS_INLINE_RC);
+}
+
+
+/***********************************************************************
+* Mark this class's instances as keeping biased retain counts 
+* in the two words at offset.
+* Locking: runtimeLock must be held by the caller
+**********************************************************************/
+void objc_class::setBiasedRCOffset(uint32_t offset, bool uses)
+{
+    runtimeLock.assertWriting();
+    assert(!isMetaClass());
+    assert(offset > 0  &&  offset % sizeof(uintptr_t) == 0);
+    assert(offset + 2*sizeof(uintptr_t) <= alignedInstanceSize());
+
+    data()->extAllocIfNeeded()->biasedRCOffset = offset;
+    setInfo(uses ? (RW_HAS_BIASED_RC | RW_USES_BIASED_RC) : RW_HAS_BIASED_RC);
+}
+
+
+/***********************************************************************
+* reserveInstanceWords
+* Grows cls's instances by count words and returns the offset of the 
+* first one, or 0 if it is too late to change cls's instance layout.
+* Subclasses realized afterwards slide their ivars past the new words, 
+* the same way they do for any grown superclass.
+* Locking: runtimeLock must be held by the caller
+**********************************************************************/
+#if SUPPORT_NONPOINTER_ISA
+static uint32_t reserveInstanceWords(Class cls, uint32_t count)
+{
+    runtimeLock.assertWriting();
+    assert(cls->isRealized()  &&  !cls->isMetaClass());
+
+    // Instances of raw isa classes keep their whole retain count 
+    // in the side table. Initialized or subclassed classes may 
+    // already have instances or ivar layouts that depend on our size.
+    if (cls->requiresRawIsa()) return 0;
+    if (cls->isInitializing()  ||  cls->isInitialized()) return 0;
+    if (cls->data()->firstSubclass) return 0;
+
+    make_ro_writeable(cls->data());
+    uint32_t offset = cls->alignedInstanceSize();
+    cls->setInstanceSize(offset + count * (uint32_t)sizeof(uintptr_t));
+    return offset;
+}
+#endif
+
+
+/***********************************************************************
+* class_setUsesInlineRetainCount
+* Grows cls's instances by one word to hold retain counts that overflow 
+* the non-pointer isa.
+* Locking: acquires runtimeLock
+**********************************************************************/
+BOOL class_setUsesInlineRetainCount(Class cls)
+{
+#if SUPPORT_NONPOINTER_ISA
+    if (!cls) return NO;
+
+    rwlock_writer_t lock(runtimeLock);
+
+    realizeClass(cls);
+    if (cls->isMetaClass()) return NO;
+    if (cls->inlineRCOffset()) return YES;
+
+    uint32_t offset = reserveInstanceWords(cls, 1);
+    if (!offset) return NO;
+    cls->setInlineRCOffset(offset);
+
+    return YES;
+#else
+    return NO;
+#endif
+}
+
+
+/***********************************************************************
+* class_setUsesBiasedRetainCount
+* Grows cls's instances by two words that hold a retain count owned 
+* by the allocating thread. See "Biased retain counts" in NSObject.mm.
+* Locking: acquires runtimeLock
+**********************************************************************/
+BOOL class_setUsesBiasedRetainCount(Class cls)
+{
+#if SUPPORT_NONPOINTER_ISA
+    if (!cls) return NO;
+
+    rwlock_writer_t lock(runtimeLock);
+
+    realizeClass(cls);
+    if (cls->isMetaClass()) return NO;
+    if (cls->biasedRCOffset()) return YES;
+
+    uint32_t offset = reserveInstanceWords(cls, 2);
+    if (!offset) return NO;
+    cls->setBiasedRCOffset(offset, true);
+    BiasedRCClassesExist = true;
+
+    return YES;
+#else
+    return NO;
+#endif
+}
+
+
 /***********************************************************************
 * Update custom RR and AWZ when a method changes its IMP
 **********************************************************************/
@@ -5218,7 +6183,7 @@ updateCustomRR_AWZ(Class cls, method_t *meth)
         } else {
             // Don't know the class. 
             // The only special case is class NSObject.
-            for (const auto& meth2 : classNSObject()->data()->methods) {
+            for (const auto& meth2 : classNSObject()->data()->methods()) {
                 if (meth == &meth2) {
                     swizzlingNSObject = YES;
                     break;
@@ -5254,7 +6219,7 @@ updateCustomRR_AWZ(Class cls, method_t *meth)
         } else {
             // Don't know the class. 
             // The only special case is metaclass NSObject.
-            for (const auto& meth2 : metaclassNSObject->data()->methods) {
+            for (const auto& meth2 : metaclassNSObject->data()->methods()) {
                 if (meth == &meth2) {
                     swizzlingNSObject = YES;
                     break;
@@ -5418,9 +6383,48 @@ _class_getVariable(Class cls, const char *name, Class *memberOf)
 }
 
 
+/***********************************************************************
+* Protocol conformance cache
+* class_conformsToProtocol() results for one class, in a small 
+* direct-mapped table hung off its class_rw_t. Each entry is a 
+* protocol_t pointer with the result in its low bit, or 0 if empty. 
+* Entries are read and written as single words, so readers and writers 
+* take no lock beyond runtimeLock for reading. Threads racing to fill 
+* an entry each store a valid answer. A collision replaces the older 
+* answer, so the table never grows.
+* A class's entries are cleared whenever its protocol list changes 
+* (class_addProtocol() and category attachment), and the table is freed 
+* with the class. Those only happen with runtimeLock write-locked, so 
+* no reader is using the table meanwhile.
+**********************************************************************/
+#define CONFORMANCE_CACHE_SIZE 8
+
+struct conformance_cache_t {
+    uintptr_t entries[CONFORMANCE_CACHE_SIZE];
+
+    static uintptr_t entryFor(protocol_t *proto, bool result) {
+        return (uintptr_t)proto | (uintptr_t)result;
+    }
+
+    uintptr_t& entry(protocol_t *proto) {
+        // protocol_t is pointer-aligned, so the low bits carry nothing.
+        return entries[((uintptr_t)proto >> 3) & (CONFORMANCE_CACHE_SIZE-1)];
+    }
+};
+
+static void flushConformanceCache(Class cls)
+{
+    runtimeLock.assertWriting();
+
+    conformance_cache_t *cache = cls->data()->conformanceCache;
+    if (cache) bzero(cache, sizeof(*cache));
+}
+
+
 /***********************************************************************
 * class_conformsToProtocol
-* fixme
+* Returns YES if cls's own protocols conform to proto. 
+* Results are cached; see "Protocol conformance cache".
 * Locking: read-locks runtimeLock
 **********************************************************************/
 BOOL class_conformsToProtocol(Class cls, Protocol *proto_gen)
@@ -5434,14 +6438,35 @@ BOOL class_conformsToProtocol(Class cls, Protocol *proto_gen)
 
     assert(cls->isRealized());
 
-    for (const auto& proto_ref : cls->data()->protocols) {
+    proto = remapProtocol((protocol_ref_t)proto);
+
+    conformance_cache_t *cache = cls->data()->conformanceCache;
+    if (cache) {
+        uintptr_t entry = cache->entry(proto);
+        if ((entry & ~(uintptr_t)1) == (uintptr_t)proto) return entry & 1;
+    }
+
+    bool result = NO;
+    for (const auto& proto_ref : cls->data()->protocols()) {
         protocol_t *p = remapProtocol(proto_ref);
         if (p == proto || protocol_conformsToProtocol_nolock(p, proto)) {
-            return YES;
+            result = YES;
+            break;
         }
     }
 
-    return NO;
+    if (!cache) {
+        cache = (conformance_cache_t *)calloc(sizeof(*cache), 1);
+        if (! OSAtomicCompareAndSwapPtrBarrier(nil, cache, (void**)
+                                               &cls->data()->conformanceCache))
+        {
+            free(cache);
+            cache = cls->data()->conformanceCache;
+        }
+    }
+    cache->entry(proto) = conformance_cache_t::entryFor(proto, result);
+
+    return result;
 }
 
 
@@ -5484,7 +6509,7 @@ addMethod(Class cls, SEL name, IMP imp, const char *types, bool replace)
         }
 
         prepareMethodLists(cls, &newlist, 1, NO, NO);
-        cls->data()->methods.attachLists(&newlist, 1);
+        cls->data()->extAllocIfNeeded()->methods.attachLists(&newlist, 1);
         flushCaches(cls);
 
         result = nil;
@@ -5613,7 +6638,8 @@ BOOL class_addProtocol(Class cls, Protocol *protocol_gen)
     protolist->count = 1;
     protolist->list[0] = (protocol_ref_t)protocol;
 
-    cls->data()->protocols.attachLists(&protolist, 1);
+    cls->data()->extAllocIfNeeded()->protocols.attachLists(&protolist, 1);
+    flushConformanceCache(cls);
 
     // fixme metaclass?
 
@@ -5658,7 +6684,7 @@ _class_addProperty(Class cls, const char *name,
         proplist->first.name = strdup(name);
         proplist->first.attributes = copyPropertyAttributeString(attrs, count);
         
-        cls->data()->properties.attachLists(&proplist, 1);
+        cls->data()->extAllocIfNeeded()->properties.attachLists(&proplist, 1);
         
         return YES;
     }
@@ -5742,11 +6768,16 @@ objc_duplicateClass(Class original, const char *name,
         memdup(original->data()->ro, sizeof(*original->data()->ro));
     *(char **)&rw->ro->name = strdup(name);
 
-    rw->methods = original->data()->methods.duplicate();
+    // The duplicate gets its own copy of every method list, 
+    // including the base list that its copied ro still points to.
+    rw->ext = (class_rw_ext_t *)calloc(sizeof(*rw->ext), 1);
+    rw->ext->methods = original->data()->methods().duplicate();
 
     // fixme dies when categories are added to the base
-    rw->properties = original->data()->properties;
-    rw->protocols = original->data()->protocols;
+    rw->ext->properties = original->data()->properties();
+    rw->ext->protocols = original->data()->protocols();
+    rw->ext->inlineRCOffset = original->inlineRCOffset();
+    rw->ext->biasedRCOffset = original->biasedRCOffset();
 
     if (duplicate->superclass) {
         addSubclass(duplicate->superclass, duplicate);
@@ -6090,10 +7121,11 @@ static void free_class(Class cls)
 
     cache_delete(cls);
     
-    for (auto& meth : rw->methods) {
+    method_array_t methods = rw->methods();
+    for (auto& meth : methods) {
         try_free(meth.types);
     }
-    rw->methods.tryFree();
+    methods.tryFree();
     
     const ivar_list_t *ivars = ro->ivars;
     if (ivars) {
@@ -6105,13 +7137,16 @@ static void free_class(Class cls)
         try_free(ivars);
     }
 
-    for (auto& prop : rw->properties) {
+    property_array_t properties = rw->properties();
+    for (auto& prop : properties) {
         try_free(prop.name);
         try_free(prop.attributes);
     }
-    rw->properties.tryFree();
+    properties.tryFree();
 
-    rw->protocols.tryFree();
+    rw->protocols().tryFree();
+    try_free(rw->ext);
+    try_free(rw->conformanceCache);
     
     try_free(ro->ivarLayout);
     try_free(ro->weakIvarLayout);
@@ -6360,6 +7395,17 @@ _object_copyFromZone(id oldObj, size_t extraBytes, void *zone)
     memmove(copyDst, copySrc, copySize);
 #endif
 
+#if SUPPORT_NONPOINTER_ISA
+    // The copy starts with its own retain count.
+    if (uint32_t offset = cls->inlineRCOffset()) {
+        *(uintptr_t *)((uint8_t *)obj + offset) = 0;
+    }
+    // Unbiased: every thread uses the isa retain count.
+    if (uint32_t offset = cls->biasedRCOffset()) {
+        bzero((uint8_t *)obj + offset, 2*sizeof(uintptr_t));
+    }
+#endif
+
 #if SUPPORT_GC
     if (UseGC)
         gc_fixup_weakreferences(obj, oldObj);
@@ -49,6 +49,9 @@ OBJC_EXPORT Class getOriginalClassForPosingClass(Class);
 #include "objc-env.h"
 #undef OPTION
 
+// Settings from environment variables that take a value rather than YES
+const char *AutoreleasePoolPageSize = nil;
+
 struct option_t {
     bool* var;
     const char *env;
@@ -216,6 +219,140 @@ void removeHeader(header_info *hi)
 }
 
 
+/***********************************************************************
+* objc_copyMemoryStatistics
+* Returns the heap memory used by each runtime subsystem.
+* Each subsystem measures itself while holding its own locks,
+* so the totals are not a single atomic snapshot.
+* Locking: acquires runtimeLock, cacheUpdateLock, and the side table,
+*   association, and @synchronized locks, one at a time
+**********************************************************************/
+objc_memory_statistic_t *objc_copyMemoryStatistics(unsigned int *outCount)
+{
+    static const char * const names[MEMSTAT_COUNT] = {
+        "class_rw_t",
+        "class_rw_ext_t",
+        "class_ro_t copies",
+        "method lists",
+        "method caches",
+        "retain count tables",
+        "weak table",
+        "associated objects",
+        "@synchronized",
+        "autorelease pool pages",
+    };
+
+    objc_memory_statistic_t *stats = (objc_memory_statistic_t *)
+        calloc(MEMSTAT_COUNT, sizeof(objc_memory_statistic_t));
+    for (unsigned int i = 0; i < MEMSTAT_COUNT; i++) {
+        stats[i].name = names[i];
+    }
+
+#if __OBJC2__
+    class_memoryStatistics(stats);
+#endif
+    arr_memoryStatistics(stats);
+    _object_associations_memoryStatistics(stats);
+    sync_memoryStatistics(stats);
+
+    if (outCount) *outCount = MEMSTAT_COUNT;
+    return stats;
+}
+
+
+/***********************************************************************
+* printMemoryStatistics
+* atexit() handler for OBJC_PRINT_MEMORY_STATISTICS.
+**********************************************************************/
+static void printMemoryStatistics(void)
+{
+    unsigned int count;
+    objc_memory_statistic_t *stats = objc_copyMemoryStatistics(&count);
+
+    size_t totalCount = 0;
+    size_t totalBytes = 0;
+    _objc_inform("MEMORY: runtime heap usage for %s[%d]:",
+                 getprogname(), getpid());
+    for (unsigned int i = 0; i < count; i++) {
+        _objc_inform("MEMORY: %-24s %10zu bytes  count %zu",
+                     stats[i].name, stats[i].bytes, stats[i].count);
+        totalCount += stats[i].count;
+        totalBytes += stats[i].bytes;
+    }
+    _objc_inform("MEMORY: %-24s %10zu bytes  count %zu",
+                 "total", totalBytes, totalCount);
+
+    free(stats);
+}
+
+
+/***********************************************************************
+* objc_copyLockStatistics
+* Returns recorded acquisitions, contentions, and wait time 
+* for each class of runtime spin lock.
+* Locking: none; counts may be slightly stale
+**********************************************************************/
+objc_lock_statistic_t *objc_copyLockStatistics(unsigned int *outCount)
+{
+    static const char * const names[LOCKCLASS_COUNT] = {
+        "other",
+        "side tables",
+        "@synchronized",
+        "associated objects",
+        "atomic properties",
+    };
+
+    objc_lock_statistic_t *stats = (objc_lock_statistic_t *)
+        calloc(LOCKCLASS_COUNT, sizeof(objc_lock_statistic_t));
+    for (unsigned int i = 0; i < LOCKCLASS_COUNT; i++) {
+        stats[i].name = names[i];
+        lock_getStatistics((lock_class_t)i, &stats[i].acquisitions, 
+                           &stats[i].contentions, &stats[i].waitNanoseconds);
+    }
+
+    if (outCount) *outCount = LOCKCLASS_COUNT;
+    return stats;
+}
+
+
+/***********************************************************************
+* printLockStatistics
+* atexit() handler for OBJC_PRINT_LOCK_STATISTICS.
+**********************************************************************/
+static void printLockStatistics(void)
+{
+    unsigned int count;
+    objc_lock_statistic_t *stats = objc_copyLockStatistics(&count);
+
+    _objc_inform("LOCKS: spin lock statistics for %s[%d]:",
+                 getprogname(), getpid());
+    for (unsigned int i = 0; i < count; i++) {
+        uint64_t avg = stats[i].contentions 
+            ? stats[i].waitNanoseconds / stats[i].contentions : 0;
+        _objc_inform("LOCKS: %-20s %12llu acquired  %10llu contended  "
+                     "%12llu ns waiting (%llu ns average)", 
+                     stats[i].name, stats[i].acquisitions, 
+                     stats[i].contentions, stats[i].waitNanoseconds, avg);
+    }
+
+    free(stats);
+}
+
+
+/***********************************************************************
+* printStripeContention
+* atexit() handler for OBJC_PRINT_STRIPE_CONTENTION.
+**********************************************************************/
+static void printStripeContention(void)
+{
+    _objc_inform("STRIPES: striped lock contention for %s[%d]:",
+                 getprogname(), getpid());
+    arr_printStripeContention();
+    sync_printStripeContention();
+    property_printStripeContention();
+}
+
+
 /***********************************************************************
 * environ_init
 * Read environment variables that affect the runtime.
@@ -252,6 +389,10 @@ void environ_init(void)
             PrintOptions = true;
             continue;
         }
+        if (0 == strncmp(*p, "OBJC_AUTORELEASE_POOL_PAGE_SIZE=", 32)) {
+            AutoreleasePoolPageSize = *p + 32;
+            continue;
+        }
         
         const char *value = strchr(*p, '=');
         if (!*value) continue;
@@ -305,6 +446,36 @@ void environ_init(void)
             if (PrintHelp) _objc_inform("%s: %s", opt->env, opt->help);
             if (PrintOptions && *opt->var) _objc_inform("%s is set", opt->env);
         }
+
+        // Options that take a value rather than YES.
+        if (PrintHelp) {
+            _objc_inform("OBJC_AUTORELEASE_POOL_PAGE_SIZE: size of autorelease "
+                         "pool pages in bytes, or with a K or M suffix; "
+                         "a power of 2 from 4K to 2M");
+        }
+        if (PrintOptions && AutoreleasePoolPageSize) {
+            _objc_inform("OBJC_AUTORELEASE_POOL_PAGE_SIZE is %s", 
+                         AutoreleasePoolPageSize);
+        }
+    }
+
+    if (PrintMemoryStatistics) {
+        atexit(printMemoryStatistics);
+    }
+    if (PrintStripeContention) {
+        atexit(printStripeContention);
+    }
+    if (PrintLockStatistics) {
+        atexit(printLockStatistics);
+    }
+    if (PrintHashStatistics) {
+        atexit(arr_printHashStatistics);
+    }
+    if (PrintRetainProfile) {
+        atexit(arr_printRetainProfile);
+    }
+    if (PrintWeakStatistics) {
+        atexit(weak_printStatistics);
     }
 }
 
@@ -386,6 +557,12 @@ void _objc_pthread_destroyspecific(void *arg)
         _destroyInitializingClassList(data->initializingClasses);
         _destroySyncCache(data->syncCache);
         _destroyAltHandlerList(data->handlerList);
+#if SUPPORT_NONPOINTER_ISA
+        biasedRC_threadExit(data);
+#endif
+        retainProfile_threadExit(data);
+        weak_threadExit(data);
+        autoreleasePageCache_threadExit(data);
         for (int i = 0; i < (int)countof(data->printableNames); i++) {
             if (data->printableNames[i]) {
                 free(data->printableNames[i]);  
@@ -189,6 +189,29 @@ static SEL __sel_registerName(const char *name, int lock, int copy)
 }
 
 
+/***********************************************************************
+* sel_lookUpRegisteredNameNoLock
+* Returns the registered selector for name, or nil if name has not 
+* been registered yet. Never registers anything, so several threads 
+* may call this at once.
+* Locking: selLock must be read- or write-locked by the caller.
+**********************************************************************/
+SEL sel_lookUpRegisteredNameNoLock(const char *name)
+{
+    selLock.assertLocked();
+
+    if (!name) return (SEL)0;
+
+    SEL result = search_builtins(name);
+    if (result) return result;
+
+    if (namedSelectors) {
+        result = (SEL)NXMapGet(namedSelectors, name);
+    }
+    return result;
+}
+
+
 SEL sel_registerName(const char *name) {
     return __sel_registerName(name, 1, 1);     // YES lock, YES copy
 }
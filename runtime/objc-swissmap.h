@@ -0,0 +1,655 @@
+/*
+ * Copyright (c) 2015 Apple Inc. All rights reserved.
+ *
+ * @APPLE_LICENSE_HEADER_START@
+ *
+ * This file contains Original Code and/or Modifications of Original Code
+ * as defined in and that are subject to the Apple Public Source License
+ * Version 2.0 (the 'License'). You may not use this file except in
+ * compliance with the License. Please obtain a copy of the License at
+ * http://www.opensource.apple.com/apsl/ and read it before using this
+ * file.
+ *
+ * The Original Code and all software distributed under the License are
+ * distributed on an 'AS IS' basis, WITHOUT WARRANTY OF ANY KIND, EITHER
+ * EXPRESS OR IMPLIED, AND APPLE HEREBY DISCLAIMS ALL SUCH WARRANTIES,
+ * INCLUDING WITHOUT LIMITATION, ANY WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE, QUIET ENJOYMENT OR NON-INFRINGEMENT.
+ * Please see the License for the specific language governing rights and
+ * limitations under the License.
+ *
+ * @APPLE_LICENSE_HEADER_END@
+ */
+
+/***********************************************************************
+* objc-swissmap.h
+* Open-addressed hash map probed a group of slots at a time.
+*
+* Each slot has a control byte: empty, deleted, or the low 7 bits of
+* the key's hash. A probe loads a whole group of control bytes and
+* compares them all against the hash bits at once, with SSE2 where
+* available and with word-sized bit tricks otherwise. Keys are compared
+* only for slots whose control byte matches, so a lookup usually costs
+* one group load and one key comparison at load factors up to 7/8.
+* Erased slots become empty instead of deleted whenever no probe could
+* have passed them, so tombstones accumulate far more slowly than in
+* DenseMap.
+*
+* SwissMap has the same interface and the same ZeroValuesArePurgeable
+* behavior as objc::DenseMap, and can replace it for any key type
+* with a DenseMapInfo.
+**********************************************************************/
+
+#ifndef _OBJC_SWISSMAP_H_
+#define _OBJC_SWISSMAP_H_
+
+#include "llvm-DenseMap.h"
+
+#if __SSE2__
+#   include <emmintrin.h>
+#endif
+
+namespace objc {
+
+// Control bytes of unused slots. Full slots are 0..127.
+enum : int8_t {
+    SwissEmpty   = -128,  // 0b10000000
+    SwissDeleted = -2,    // 0b11111110
+};
+
+
+// A group of consecutive control bytes, matched by a single probe.
+// Masks have one set bit (or byte) per matching slot.
+struct SwissGroup {
+#if __SSE2__
+    enum { Width = 16 };
+    typedef uint32_t Mask;
+
+    __m128i ctrl;
+
+    explicit SwissGroup(const int8_t *pos)
+        : ctrl(_mm_loadu_si128((const __m128i *)pos)) { }
+
+    Mask match(int8_t h2) const {
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl));
+    }
+    Mask matchEmpty() const {
+        return match(SwissEmpty);
+    }
+    // Empty and deleted are the only control bytes below -1.
+    Mask matchEmptyOrDeleted() const {
+        return _mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1), ctrl));
+    }
+
+    // Index of the first matching slot. m must not be zero.
+    static unsigned firstSlot(Mask m) { return __builtin_ctz(m); }
+    // Number of slots after the last matching slot. m must not be zero.
+    static unsigned slotsAfterLast(Mask m) { return __builtin_clz(m) - 16; }
+#else
+    // Eight control bytes in a word. match() may report a false match
+    // in a byte following a true one; callers compare keys anyway.
+    enum { Width = 8 };
+    typedef uint64_t Mask;
+
+    static const uint64_t Lsbs = 0x0101010101010101ULL;
+    static const uint64_t Msbs = 0x8080808080808080ULL;
+
+    uint64_t ctrl;
+
+    explicit SwissGroup(const int8_t *pos) {
+        memcpy(&ctrl, pos, sizeof(ctrl));
+    }
+
+    Mask match(int8_t h2) const {
+        uint64_t x = ctrl ^ (Lsbs * (uint8_t)h2);
+        return (x - Lsbs) & ~x & Msbs;
+    }
+    Mask matchEmpty() const {
+        return (ctrl & (~ctrl << 6)) & Msbs;
+    }
+    Mask matchEmptyOrDeleted() const {
+        return (ctrl & (~ctrl << 7)) & Msbs;
+    }
+
+    static unsigned firstSlot(Mask m) { return __builtin_ctzll(m) >> 3; }
+    static unsigned slotsAfterLast(Mask m) { return __builtin_clzll(m) >> 3; }
+#endif
+
+    static Mask clearFirst(Mask m) { return m & (m - 1); }
+};
+
+
+template<typename KeyT, typename ValueT, bool IsConst = false>
+class SwissMapIterator;
+
+
+template<typename KeyT, typename ValueT,
+         bool ZeroValuesArePurgeable = false,
+         typename KeyInfoT = DenseMapInfo<KeyT> >
+class SwissMap {
+  typedef std::pair<KeyT, ValueT> BucketT;
+  enum { Width = SwissGroup::Width };
+
+  // NumBuckets is zero or a power of two no smaller than Width.
+  // Ctrl has NumBuckets + Width bytes. The last Width bytes repeat
+  // the first Width so a group can be loaded at any slot.
+  BucketT *Buckets;
+  int8_t *Ctrl;
+  unsigned NumEntries;
+  unsigned NumDeleted;
+  unsigned NumBuckets;
+
+public:
+  typedef KeyT key_type;
+  typedef ValueT mapped_type;
+  typedef BucketT value_type;
+
+  typedef SwissMapIterator<KeyT, ValueT> iterator;
+  typedef SwissMapIterator<KeyT, ValueT, true> const_iterator;
+
+  explicit SwissMap(unsigned NumInitBuckets = 0) {
+    init(NumInitBuckets);
+  }
+
+  SwissMap(const SwissMap &other) {
+    init(0);
+    copyFrom(other);
+  }
+
+  ~SwissMap() {
+    destroyAll();
+    free(Buckets);
+  }
+
+  SwissMap& operator=(const SwissMap& other) {
+    copyFrom(other);
+    return *this;
+  }
+
+  void swap(SwissMap& RHS) {
+    std::swap(Buckets, RHS.Buckets);
+    std::swap(Ctrl, RHS.Ctrl);
+    std::swap(NumEntries, RHS.NumEntries);
+    std::swap(NumDeleted, RHS.NumDeleted);
+    std::swap(NumBuckets, RHS.NumBuckets);
+  }
+
+  inline iterator begin() {
+    return empty() ? end() : iterator(Buckets, Ctrl, Buckets + NumBuckets);
+  }
+  inline iterator end() {
+    return iterator(Buckets + NumBuckets, Ctrl + NumBuckets,
+                    Buckets + NumBuckets, true);
+  }
+  inline const_iterator begin() const {
+    return empty() ? end()
+      : const_iterator(Buckets, Ctrl, Buckets + NumBuckets);
+  }
+  inline const_iterator end() const {
+    return const_iterator(Buckets + NumBuckets, Ctrl + NumBuckets,
+                          Buckets + NumBuckets, true);
+  }
+
+  bool empty() const { return NumEntries == 0; }
+  unsigned size() const { return NumEntries; }
+
+  /// Grow the map so that it has at least Size buckets. Does not shrink
+  void resize(size_t Size) {
+    if (Size > NumBuckets)
+      rehash(bucketsFor(Size));
+  }
+
+  void clear() {
+    if (NumEntries == 0 && NumDeleted == 0) return;
+
+    // If the capacity of the array is huge, and the # elements used is small,
+    // shrink the array.
+    if (NumEntries * 4 < NumBuckets && NumBuckets > Width) {
+      shrink_and_clear();
+      return;
+    }
+
+    destroyAll();
+    initEmpty();
+  }
+
+  /// count - Return true if the specified key is in the map.
+  bool count(const KeyT &Val) const {
+    return findBucket(Val) != 0;
+  }
+
+  iterator find(const KeyT &Val) {
+    if (BucketT *B = findBucket(Val))
+      return iterator(B, Ctrl + (B - Buckets), Buckets + NumBuckets, true);
+    return end();
+  }
+  const_iterator find(const KeyT &Val) const {
+    if (const BucketT *B = findBucket(Val))
+      return const_iterator(B, Ctrl + (B - Buckets),
+                            Buckets + NumBuckets, true);
+    return end();
+  }
+
+  /// lookup - Return the entry for the specified key, or a default
+  /// constructed value if no such entry exists.
+  ValueT lookup(const KeyT &Val) const {
+    if (const BucketT *B = findBucket(Val))
+      return B->second;
+    return ValueT();
+  }
+
+  // Inserts key,value pair into the map if the key isn't already in the map.
+  // If the key is already in the map, it returns false and doesn't update the
+  // value.
+  std::pair<iterator, bool> insert(const std::pair<KeyT, ValueT> &KV) {
+    bool inserted = false;
+    BucketT *B = findBucket(KV.first);
+    if (!B) {
+      B = insertNew(KV.first, KV.second);
+      inserted = true;
+    }
+    return std::make_pair(iterator(B, Ctrl + (B - Buckets),
+                                   Buckets + NumBuckets, true),
+                          inserted);
+  }
+
+  /// insert - Range insertion of pairs.
+  template<typename InputIt>
+  void insert(InputIt I, InputIt E) {
+    for (; I != E; ++I)
+      insert(*I);
+  }
+
+  // Clear if empty.
+  // Shrink if at least 15/16 empty and larger than MIN_COMPACT.
+  void compact() {
+    if (NumEntries == 0) {
+      shrink_and_clear();
+    }
+    else if (NumBuckets / 16 > NumEntries  &&  NumBuckets > MIN_COMPACT) {
+      rehash(bucketsFor(NumEntries * 2));
+    }
+  }
+
+  // Shrink if at least 7/8 of the buckets are empty, not counting
+  // entries whose values are purgeable zeros. Larger than one group.
+  // Unlike compact() this scans every bucket, so call it occasionally.
+  void shrinkIfSparse() {
+    if (NumBuckets <= Width) return;
+
+    unsigned Live = NumEntries;
+    if (ZeroValuesArePurgeable) {
+      Live = 0;
+      for (unsigned i = 0; i < NumBuckets; i++) {
+        if (Ctrl[i] >= 0  &&  Buckets[i].second != 0) Live++;
+      }
+    }
+
+    if (NumBuckets / 8 < Live) return;
+    if (NumEntries == 0) shrink_and_clear();
+    else rehash(bucketsFor(Live * 2));
+  }
+
+  bool erase(const KeyT &Val) {
+    BucketT *B = findBucket(Val);
+    if (!B) return false; // not in map.
+    eraseBucket(B);
+    compact();
+    return true;
+  }
+  void erase(iterator I) {
+    eraseBucket(&*I);
+    compact();
+  }
+
+  value_type& FindAndConstruct(const KeyT &Key) {
+    if (BucketT *B = findBucket(Key))
+      return *B;
+    return *insertNew(Key, ValueT());
+  }
+
+  ValueT &operator[](const KeyT &Key) {
+    return FindAndConstruct(Key).second;
+  }
+
+  /// Return the approximate size (in bytes) of the actual map.
+  /// If entries are pointers to objects, the size of the referenced objects
+  /// are not included.
+  size_t getMemorySize() const {
+    if (NumBuckets == 0) return 0;
+    return NumBuckets * sizeof(BucketT) + NumBuckets + Width;
+  }
+
+  /// Add the probe lengths of every entry to Stats.
+  /// Replays each entry's probe sequence; does not modify the map.
+  void getProbeStatistics(HashProbeStatistics &Stats) const {
+    const unsigned BucketMask = NumBuckets - 1;
+    Stats.buckets += NumBuckets;
+    for (unsigned i = 0; i < NumBuckets; i++) {
+      if (Ctrl[i] < 0) continue;
+
+      unsigned Hash = KeyInfoT::getHashValue(Buckets[i].first);
+      unsigned Pos = probeStart(Hash);
+      unsigned Step = 0;
+      size_t Probes = 1;
+      while (1) {
+        SwissGroup G(Ctrl + Pos);
+        unsigned Offset = (i - Pos) & BucketMask;
+        bool Found = false;
+        for (SwissGroup::Mask M = G.match(Ctrl[i]); M;
+             M = SwissGroup::clearFirst(M)) {
+          Stats.compares++;
+          if (SwissGroup::firstSlot(M) == Offset) {
+            Found = true;
+            break;
+          }
+        }
+        if (Found) break;
+        Step += Width;
+        Pos = (Pos + Step) & BucketMask;
+        Probes++;
+      }
+      Stats.lookups++;
+      Stats.probes += Probes;
+      if (Probes > Stats.longest) Stats.longest = Probes;
+    }
+  }
+
+  void shrink_and_clear() {
+    unsigned OldNumEntries = NumEntries;
+    destroyAll();
+
+    // Reduce the number of buckets.
+    unsigned NewNumBuckets = 0;
+    if (OldNumEntries)
+      NewNumBuckets = bucketsFor(OldNumEntries * 2);
+    if (NewNumBuckets == NumBuckets) {
+      initEmpty();
+      return;
+    }
+
+    free(Buckets);
+    init(NewNumBuckets);
+  }
+
+private:
+  static int8_t h2(unsigned Hash) { return Hash & 0x7f; }
+
+  unsigned probeStart(unsigned Hash) const {
+    return (Hash >> 7) & (NumBuckets - 1);
+  }
+
+  // Smallest valid bucket count that holds Count entries
+  // without exceeding the maximum load factor.
+  static unsigned bucketsFor(size_t Count) {
+    unsigned Result = Width;
+    while (Result - Result/8 < Count) Result *= 2;
+    return Result;
+  }
+
+  void setCtrl(unsigned i, int8_t h) {
+    Ctrl[i] = h;
+    if (i < Width) Ctrl[NumBuckets + i] = h;
+  }
+
+  void init(unsigned InitBuckets) {
+    if (allocateBuckets(InitBuckets)) {
+      initEmpty();
+    } else {
+      NumEntries = 0;
+      NumDeleted = 0;
+    }
+  }
+
+  void initEmpty() {
+    NumEntries = 0;
+    NumDeleted = 0;
+    memset(Ctrl, SwissEmpty, NumBuckets + Width);
+  }
+
+  bool allocateBuckets(unsigned Num) {
+    assert((Num == 0 || (Num >= Width && (Num & (Num-1)) == 0)) &&
+           "bucket count must be zero or a power of two >= Width");
+    NumBuckets = Num;
+    if (NumBuckets == 0) {
+      Buckets = 0;
+      Ctrl = 0;
+      return false;
+    }
+
+    size_t BucketBytes = sizeof(BucketT) * NumBuckets;
+    void *Storage = malloc(BucketBytes + NumBuckets + Width);
+    if (!Storage) _objc_fatal("SwissMap: out of memory");
+    Buckets = static_cast<BucketT *>(Storage);
+    Ctrl = reinterpret_cast<int8_t *>(static_cast<char *>(Storage) +
+                                      BucketBytes);
+    return true;
+  }
+
+  void destroyAll() {
+    for (unsigned i = 0; i < NumBuckets; i++) {
+      if (Ctrl[i] >= 0) {
+        Buckets[i].second.~ValueT();
+        Buckets[i].first.~KeyT();
+      }
+    }
+  }
+
+  void copyFrom(const SwissMap& other) {
+    destroyAll();
+    free(Buckets);
+    init(other.NumBuckets);
+    for (unsigned i = 0; i < other.NumBuckets; i++) {
+      if (other.Ctrl[i] >= 0) {
+        new (&Buckets[i].first) KeyT(other.Buckets[i].first);
+        new (&Buckets[i].second) ValueT(other.Buckets[i].second);
+      }
+    }
+    if (NumBuckets) memcpy(Ctrl, other.Ctrl, NumBuckets + Width);
+    NumEntries = other.NumEntries;
+    NumDeleted = other.NumDeleted;
+  }
+
+  template<typename LookupKeyT>
+  BucketT *findBucket(const LookupKeyT &Val) const {
+    if (NumBuckets == 0) return 0;
+
+    assert(!KeyInfoT::isEqual(Val, KeyInfoT::getEmptyKey()) &&
+           !KeyInfoT::isEqual(Val, KeyInfoT::getTombstoneKey()) &&
+           "Empty/Tombstone value shouldn't be inserted into map!");
+
+    const unsigned BucketMask = NumBuckets - 1;
+    const unsigned Hash = KeyInfoT::getHashValue(Val);
+    const int8_t H2 = h2(Hash);
+    unsigned Pos = probeStart(Hash);
+    unsigned Step = 0;
+    while (1) {
+      SwissGroup G(Ctrl + Pos);
+      for (SwissGroup::Mask M = G.match(H2); M; M = SwissGroup::clearFirst(M)) {
+        unsigned i = (Pos + SwissGroup::firstSlot(M)) & BucketMask;
+        if (KeyInfoT::isEqual(Val, Buckets[i].first)) return &Buckets[i];
+      }
+      // An empty slot ends every probe sequence that reaches it.
+      if (G.matchEmpty()) return 0;
+
+      // Triangular probing by whole groups visits every group once.
+      Step += Width;
+      if (Step > NumBuckets) corrupted();
+      Pos = (Pos + Step) & BucketMask;
+    }
+  }
+
+  // First empty or deleted slot on Hash's probe sequence.
+  unsigned findInsertSlot(unsigned Hash) const {
+    const unsigned BucketMask = NumBuckets - 1;
+    unsigned Pos = probeStart(Hash);
+    unsigned Step = 0;
+    while (1) {
+      SwissGroup G(Ctrl + Pos);
+      if (SwissGroup::Mask M = G.matchEmptyOrDeleted()) {
+        return (Pos + SwissGroup::firstSlot(M)) & BucketMask;
+      }
+      Step += Width;
+      if (Step > NumBuckets) corrupted();
+      Pos = (Pos + Step) & BucketMask;
+    }
+  }
+
+  // Key must not already be in the map.
+  BucketT *insertNew(const KeyT &Key, const ValueT &Value) {
+    // Keep at least 1/8 of the slots empty so every probe terminates.
+    // Grow if the table is full of live entries; otherwise rehash at
+    // the same size to clear out deleted slots.
+    if (NumBuckets == 0) {
+      rehash(Width);
+    } else if (NumEntries + NumDeleted + 1 > NumBuckets - NumBuckets/8) {
+      if (ZeroValuesArePurgeable) purgeZeroValues();
+      if (NumEntries + 1 > (NumBuckets - NumBuckets/8) / 2) {
+        rehash(NumBuckets * 2);
+      } else {
+        rehash(NumBuckets);
+      }
+    }
+
+    unsigned Hash = KeyInfoT::getHashValue(Key);
+    unsigned i = findInsertSlot(Hash);
+    if (Ctrl[i] == SwissDeleted) NumDeleted--;
+    setCtrl(i, h2(Hash));
+    new (&Buckets[i].first) KeyT(Key);
+    new (&Buckets[i].second) ValueT(Value);
+    NumEntries++;
+    return &Buckets[i];
+  }
+
+  void eraseBucket(BucketT *B) {
+    unsigned i = B - Buckets;
+    assert(Ctrl[i] >= 0);
+    B->second.~ValueT();
+    B->first.~KeyT();
+    NumEntries--;
+
+    // If every run of non-empty slots through i is shorter than a group,
+    // no probe ever continued past i, so i can become empty again.
+    SwissGroup::Mask EmptyAfter = SwissGroup(Ctrl + i).matchEmpty();
+    SwissGroup::Mask EmptyBefore =
+      SwissGroup(Ctrl + ((i - Width) & (NumBuckets - 1))).matchEmpty();
+    bool WasNeverFull = EmptyAfter && EmptyBefore &&
+      SwissGroup::firstSlot(EmptyAfter) +
+      SwissGroup::slotsAfterLast(EmptyBefore) < Width;
+
+    if (WasNeverFull) {
+      setCtrl(i, SwissEmpty);
+    } else {
+      setCtrl(i, SwissDeleted);
+      NumDeleted++;
+    }
+  }
+
+  // Remove entries whose value is zero, as if they had been erased.
+  void purgeZeroValues() {
+    for (unsigned i = 0; i < NumBuckets; i++) {
+      if (Ctrl[i] >= 0  &&  Buckets[i].second == 0) eraseBucket(&Buckets[i]);
+    }
+  }
+
+  void rehash(unsigned NewNumBuckets) {
+    BucketT *OldBuckets = Buckets;
+    int8_t *OldCtrl = Ctrl;
+    unsigned OldNumBuckets = NumBuckets;
+
+    allocateBuckets(NewNumBuckets);
+    initEmpty();
+
+    for (unsigned i = 0; i < OldNumBuckets; i++) {
+      if (OldCtrl[i] < 0) continue;
+      BucketT *B = &OldBuckets[i];
+      if (!(ZeroValuesArePurgeable && B->second == 0)) {
+        unsigned Hash = KeyInfoT::getHashValue(B->first);
+        unsigned j = findInsertSlot(Hash);
+        setCtrl(j, h2(Hash));
+        new (&Buckets[j].first) KeyT(llvm_move(B->first));
+        new (&Buckets[j].second) ValueT(llvm_move(B->second));
+        NumEntries++;
+      }
+      B->second.~ValueT();
+      B->first.~KeyT();
+    }
+
+    free(OldBuckets);
+  }
+
+  __attribute__((noreturn)) void corrupted() const {
+    _objc_fatal("Hash table corrupted. This is probably a memory error "
+                "somewhere. (table at %p, buckets at %p (%zu bytes), "
+                "%u buckets, %u entries, %u deleted)",
+                this, Buckets, malloc_size(Buckets),
+                NumBuckets, NumEntries, NumDeleted);
+  }
+};
+
+
+template<typename KeyT, typename ValueT, bool IsConst>
+class SwissMapIterator {
+  typedef std::pair<KeyT, ValueT> Bucket;
+  typedef SwissMapIterator<KeyT, ValueT, true> ConstIterator;
+  friend class SwissMapIterator<KeyT, ValueT, true>;
+public:
+  typedef ptrdiff_t difference_type;
+  typedef typename conditional<IsConst, const Bucket, Bucket>::type value_type;
+  typedef value_type *pointer;
+  typedef value_type &reference;
+  typedef std::forward_iterator_tag iterator_category;
+private:
+  pointer Ptr, End;
+  const int8_t *Ctrl;
+public:
+  SwissMapIterator() : Ptr(0), End(0), Ctrl(0) {}
+
+  SwissMapIterator(pointer Pos, const int8_t *C, pointer E,
+                   bool NoAdvance = false)
+    : Ptr(Pos), End(E), Ctrl(C) {
+    if (!NoAdvance) AdvancePastEmptyBuckets();
+  }
+
+  // If IsConst is true this is a converting constructor from iterator to
+  // const_iterator and the default copy constructor is used.
+  // Otherwise this is a copy constructor for iterator.
+  SwissMapIterator(const SwissMapIterator<KeyT, ValueT, false>& I)
+    : Ptr(I.Ptr), End(I.End), Ctrl(I.Ctrl) {}
+
+  reference operator*() const {
+    return *Ptr;
+  }
+  pointer operator->() const {
+    return Ptr;
+  }
+
+  bool operator==(const ConstIterator &RHS) const {
+    return Ptr == RHS.operator->();
+  }
+  bool operator!=(const ConstIterator &RHS) const {
+    return Ptr != RHS.operator->();
+  }
+
+  inline SwissMapIterator& operator++() {  // Preincrement
+    ++Ptr;
+    ++Ctrl;
+    AdvancePastEmptyBuckets();
+    return *this;
+  }
+  SwissMapIterator operator++(int) {  // Postincrement
+    SwissMapIterator tmp = *this; ++*this; return tmp;
+  }
+
+private:
+  void AdvancePastEmptyBuckets() {
+    while (Ptr != End && *Ctrl < 0) {
+      ++Ptr;
+      ++Ctrl;
+    }
+  }
+};
+
+} // end namespace objc
+
+#endif
@@ -56,13 +56,19 @@ typedef struct SyncCache {
   SYNC_COUNT_DIRECT_KEY == SyncCacheItem.lockCount
  */
 
+typedef spinlock_tt<LOCKCLASS_SYNCLIST> SyncListLock;
+
 struct SyncList {
     SyncData *data;
-    spinlock_t lock;
+    SyncListLock lock;
 
     SyncList() : data(nil) { }
 };
 
+static inline SyncListLock& lockForStripe(SyncList& list) {
+    return list.lock;
+}
+
 // Use multiple parallel lists to decrease contention among unrelated objects.
 #define LOCK_FOR_OBJ(obj) sDataLists[obj].lock
 #define LIST_FOR_OBJ(obj) sDataLists[obj].data
@@ -109,7 +115,7 @@ void _destroySyncCache(struct SyncCache *cache)
 
 static SyncData* id2data(id object, enum usage why)
 {
-    spinlock_t *lockp = &LOCK_FOR_OBJ(object);
+    SyncListLock *lockp = &LOCK_FOR_OBJ(object);
     SyncData **listp = &LIST_FOR_OBJ(object);
     SyncData* result = NULL;
 
@@ -325,3 +331,27 @@ int objc_sync_exit(id obj)
     return result;
 }
 
+
+
+// Adds the heap memory of all SyncData blocks to stats.
+// SyncData blocks are never freed, so this includes unused ones.
+// Per-thread SyncCaches are not counted.
+void sync_memoryStatistics(objc_memory_statistic_t *stats)
+{
+    for (unsigned int i = 0; i < StripedMap<SyncList>::count(); i++) {
+        SyncList& list = sDataLists.stripe(i);
+        list.lock.lock();
+        for (SyncData *data = list.data; data; data = data->nextData) {
+            stats[MEMSTAT_SYNC].count++;
+            stats[MEMSTAT_SYNC].bytes += malloc_size(data);
+        }
+        list.lock.unlock();
+    }
+}
+
+
+// Logs contended @synchronized list lock acquisitions.
+void sync_printStripeContention(void)
+{
+    sDataLists.printContention("@synchronized");
+}
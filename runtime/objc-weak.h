@@ -54,27 +54,33 @@ reclamation.
 typedef objc_object ** weak_referrer_t;
 
 #if __LP64__
-#define PTR_MINUS_1 63
+#define PTR_MINUS_2 62
 #else
-#define PTR_MINUS_1 31
+#define PTR_MINUS_2 30
 #endif
 
 /**
  * The internal structure stored in the weak references table. 
- * It maintains and stores
- * a hash set of weak references pointing to an object.
- * If out_of_line==0, the set is instead a small inline array.
+ * It maintains and stores the weak references pointing to an object.
+ * If out_of_line==0, they are in a small inline array.
+ * Otherwise, if hashed==0, they are the first num_refs slots of a 
+ * heap array of mask+1 slots, searched linearly. The array doubles 
+ * from WEAK_VECTOR_MIN slots without rehashing.
+ * Past WEAK_VECTOR_MAX referrers they move to a hash set, which uses 
+ * Robin Hood linear probing like the table itself.
  */
 #define WEAK_INLINE_COUNT 4
+#define WEAK_VECTOR_MIN 8
+#define WEAK_VECTOR_MAX 32
 struct weak_entry_t {
     DisguisedPtr<objc_object> referent;
     union {
         struct {
             weak_referrer_t *referrers;
             uintptr_t        out_of_line : 1;
-            uintptr_t        num_refs : PTR_MINUS_1;
+            uintptr_t        hashed : 1;
+            uintptr_t        num_refs : PTR_MINUS_2;
             uintptr_t        mask;
-            uintptr_t        max_hash_displacement;
         };
         struct {
             // out_of_line=0 is LSB of one of these (don't care which)
@@ -86,12 +92,12 @@ struct weak_entry_t {
 /**
  * The global weak references table. Stores object ids as keys,
  * and weak_entry_t structs as their values.
+ * Open addressing with Robin Hood linear probing; see objc-weak.mm.
  */
 struct weak_table_t {
     weak_entry_t *weak_entries;
     size_t    num_entries;
     uintptr_t mask;
-    uintptr_t max_hash_displacement;
 };
 
 /// Adds an (object, weak pointer) pair to the weak table.
@@ -109,9 +115,20 @@ bool weak_is_registered_no_lock(weak_table_t *weak_table, id referent);
 /// Assert a weak pointer is valid and retain the object during its use.
 id weak_read_no_lock(weak_table_t *weak_table, id *referrer);
 
+/// Like weak_read_no_lock, but without the lock. Returns false if the 
+/// object needs the locked path; otherwise stores the result.
+bool weak_read_unlocked(id *referrer, id *result);
+
 /// Called on object destruction. Sets all remaining weak pointers to nil.
 void weak_clear_no_lock(weak_table_t *weak_table, id referent);
 
+/// Called on object destruction after weak_clear_no_lock, without the lock.
+/// Waits for weak_read_unlocked calls still examining the object.
+void weak_wait_for_readers(id referent);
+
+/// Like weak_wait_for_readers, for several objects at once.
+void weak_wait_for_readers_batch(id *referents, size_t count);
+
 __END_DECLS
 
 #endif /* _OBJC_WEAK_H_ */
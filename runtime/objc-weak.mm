@@ -28,6 +28,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <sys/types.h>
+#include <sched.h>
 #include <libkern/OSAtomic.h>
 
 #define TABLE_SIZE(entry) (entry->mask ? entry->mask + 1 : 0)
@@ -60,9 +61,74 @@ static inline uintptr_t w_hash_pointer(objc_object **key) {
     return ptr_hash((uintptr_t)key);
 }
 
+/*
+  Both the weak table and the out-of-line referrer sets use Robin Hood 
+  linear probing. An insertion that has probed farther from its home 
+  bucket than the current occupant takes that bucket and continues 
+  inserting the occupant instead. This keeps each run of entries sorted by 
+  home bucket, so a lookup can stop as soon as it reaches an empty bucket 
+  or an occupant closer to home than the lookup has probed. Removal shifts 
+  the rest of the run back one bucket, so no holes or tombstones are left.
+*/
+
+/** 
+ * Distance of weak_entries[index] from its home bucket.
+ * 
+ * @param weak_table 
+ * @param index A bucket holding an entry.
+ */
+static inline size_t 
+weak_entry_displacement(weak_table_t *weak_table, size_t index)
+{
+    objc_object *referent = weak_table->weak_entries[index].referent;
+    return (index - hash_pointer(referent)) & weak_table->mask;
+}
+
+/** 
+ * Distance of an out-of-line referrers[index] from its home bucket.
+ * 
+ * @param entry Weak pointer hash set for a particular object.
+ * @param index A bucket holding a referrer.
+ */
+static inline size_t 
+referrer_displacement(weak_entry_t *entry, size_t index)
+{
+    return (index - w_hash_pointer(entry->referrers[index])) & entry->mask;
+}
+
+/*
+  OBJC_PRINT_WEAK_STATISTICS records how many weak variables each object 
+  had when it was deallocated, and how often referrer storage moved out 
+  of line, grew, or became a hash set. Counters are updated with relaxed 
+  atomics because each side table has its own lock.
+*/
+#define WEAK_HISTOGRAM_BUCKETS 8
+
+static uint64_t weak_clear_histogram[WEAK_HISTOGRAM_BUCKETS];
+static uint64_t weak_vector_allocations;
+static uint64_t weak_vector_growths;
+static uint64_t weak_hash_conversions;
+
+static inline void weak_statistics_add(uint64_t *counter)
+{
+    if (PrintWeakStatistics) {
+        __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Buckets are 0-1, 2, 3-4, 5-8, ..., 33-64, and more than 64.
+static inline size_t weak_histogram_bucket(size_t count)
+{
+    if (count <= 1) return 0;
+    size_t bucket = 8*sizeof(unsigned long) - __builtin_clzl(count - 1);
+    return bucket < WEAK_HISTOGRAM_BUCKETS ? bucket : WEAK_HISTOGRAM_BUCKETS-1;
+}
+
 /** 
- * Grow the entry's hash table of referrers. Rehashes each
- * of the referrers.
+ * Grow the entry's referrers and insert new_referrer. 
+ * An unhashed array below WEAK_VECTOR_MAX slots doubles in place. 
+ * A full array at WEAK_VECTOR_MAX, or a hash set, is rehashed into 
+ * a hash set twice its size.
  * 
  * @param entry Weak pointer hash set for a particular object.
  */
@@ -73,16 +139,28 @@ static void grow_refs_and_insert(weak_entry_t *entry,
     assert(entry->out_of_line);
 
     size_t old_size = TABLE_SIZE(entry);
-    size_t new_size = old_size ? old_size * 2 : 8;
+    size_t new_size = old_size * 2;
+
+    if (!entry->hashed  &&  old_size < WEAK_VECTOR_MAX) {
+        entry->referrers = (weak_referrer_t *)
+            realloc(entry->referrers, new_size * sizeof(weak_referrer_t));
+        entry->mask = new_size - 1;
+        entry->referrers[entry->num_refs] = new_referrer;
+        entry->num_refs++;
+        weak_statistics_add(&weak_vector_growths);
+        return;
+    }
+
+    if (!entry->hashed) weak_statistics_add(&weak_hash_conversions);
 
     size_t num_refs = entry->num_refs;
     weak_referrer_t *old_refs = entry->referrers;
+    entry->hashed = 1;
     entry->mask = new_size - 1;
     
     entry->referrers = (weak_referrer_t *)
         calloc(TABLE_SIZE(entry), sizeof(weak_referrer_t));
     entry->num_refs = 0;
-    entry->max_hash_displacement = 0;
     
     for (size_t i = 0; i < old_size && num_refs > 0; i++) {
         if (old_refs[i] != nil) {
@@ -92,7 +170,7 @@ static void grow_refs_and_insert(weak_entry_t *entry,
     }
     // Insert
     append_referrer(entry, new_referrer);
-    if (old_refs) free(old_refs);
+    free(old_refs);
 }
 
 /** 
@@ -114,35 +192,47 @@ static void append_referrer(weak_entry_t *entry, objc_object **new_referrer)
             }
         }
 
-        // Couldn't insert inline. Allocate out of line.
+        // Couldn't insert inline. Move to an out-of-line array, 
+        // which has room for the new referrer.
         weak_referrer_t *new_referrers = (weak_referrer_t *)
-            calloc(WEAK_INLINE_COUNT, sizeof(weak_referrer_t));
-        // This constructed table is invalid, but grow_refs_and_insert
-        // will fix it and rehash it.
+            malloc(WEAK_VECTOR_MIN * sizeof(weak_referrer_t));
         for (size_t i = 0; i < WEAK_INLINE_COUNT; i++) {
             new_referrers[i] = entry->inline_referrers[i];
         }
         entry->referrers = new_referrers;
         entry->num_refs = WEAK_INLINE_COUNT;
         entry->out_of_line = 1;
-        entry->mask = WEAK_INLINE_COUNT-1;
-        entry->max_hash_displacement = 0;
+        entry->hashed = 0;
+        entry->mask = WEAK_VECTOR_MIN-1;
+        weak_statistics_add(&weak_vector_allocations);
     }
 
     assert(entry->out_of_line);
 
+    if (! entry->hashed) {
+        if (entry->num_refs == TABLE_SIZE(entry)) {
+            return grow_refs_and_insert(entry, new_referrer);
+        }
+        entry->referrers[entry->num_refs] = new_referrer;
+        entry->num_refs++;
+        return;
+    }
+
     if (entry->num_refs >= TABLE_SIZE(entry) * 3/4) {
         return grow_refs_and_insert(entry, new_referrer);
     }
     size_t index = w_hash_pointer(new_referrer) & (entry->mask);
     size_t hash_displacement = 0;
     while (entry->referrers[index] != NULL) {
+        size_t resident = referrer_displacement(entry, index);
+        if (resident < hash_displacement) {
+            // Take the bucket and insert its occupant further on.
+            std::swap(new_referrer, entry->referrers[index]);
+            hash_displacement = resident;
+        }
         index = (index+1) & entry->mask;
         hash_displacement++;
     }
-    if (hash_displacement > entry->max_hash_displacement) {
-        entry->max_hash_displacement = hash_displacement;
-    }
     weak_referrer_t &ref = entry->referrers[index];
     ref = new_referrer;
     entry->num_refs++;
@@ -175,12 +265,32 @@ static void remove_referrer(weak_entry_t *entry, objc_object **old_referrer)
         return;
     }
 
+    if (! entry->hashed) {
+        // Move the last referrer into the vacated slot.
+        for (size_t i = 0; i < entry->num_refs; i++) {
+            if (entry->referrers[i] == old_referrer) {
+                size_t last = entry->num_refs - 1;
+                entry->referrers[i] = entry->referrers[last];
+                entry->referrers[last] = nil;
+                entry->num_refs--;
+                return;
+            }
+        }
+        _objc_inform("Attempted to unregister unknown __weak variable "
+                     "at %p. This is probably incorrect use of "
+                     "objc_storeWeak() and objc_loadWeak(). "
+                     "Break on objc_weak_error to debug.\n", 
+                     old_referrer);
+        objc_weak_error();
+        return;
+    }
+
     size_t index = w_hash_pointer(old_referrer) & (entry->mask);
     size_t hash_displacement = 0;
     while (entry->referrers[index] != old_referrer) {
-        index = (index+1) & entry->mask;
-        hash_displacement++;
-        if (hash_displacement > entry->max_hash_displacement) {
+        if (entry->referrers[index] == nil  ||  
+            referrer_displacement(entry, index) < hash_displacement) 
+        {
             _objc_inform("Attempted to unregister unknown __weak variable "
                          "at %p. This is probably incorrect use of "
                          "objc_storeWeak() and objc_loadWeak(). "
@@ -189,6 +299,18 @@ static void remove_referrer(weak_entry_t *entry, objc_object **old_referrer)
             objc_weak_error();
             return;
         }
+        index = (index+1) & entry->mask;
+        hash_displacement++;
+    }
+
+    // Shift the rest of the run back into the vacated bucket.
+    size_t next = (index+1) & entry->mask;
+    while (entry->referrers[next] != nil  &&  
+           referrer_displacement(entry, next) != 0) 
+    {
+        entry->referrers[index] = entry->referrers[next];
+        index = next;
+        next = (next+1) & entry->mask;
     }
     entry->referrers[index] = nil;
     entry->num_refs--;
@@ -203,19 +325,22 @@ static void weak_entry_insert(weak_table_t *weak_table, weak_entry_t *new_entry)
     weak_entry_t *weak_entries = weak_table->weak_entries;
     assert(weak_entries != nil);
 
-    size_t index = hash_pointer(new_entry->referent) & (weak_table->mask);
+    weak_entry_t entry = *new_entry;
+    size_t index = hash_pointer(entry.referent) & (weak_table->mask);
     size_t hash_displacement = 0;
     while (weak_entries[index].referent != nil) {
+        size_t resident = weak_entry_displacement(weak_table, index);
+        if (resident < hash_displacement) {
+            // Take the bucket and insert its occupant further on.
+            std::swap(entry, weak_entries[index]);
+            hash_displacement = resident;
+        }
         index = (index+1) & weak_table->mask;
         hash_displacement++;
     }
 
-    weak_entries[index] = *new_entry;
+    weak_entries[index] = entry;
     weak_table->num_entries++;
-
-    if (hash_displacement > weak_table->max_hash_displacement) {
-        weak_table->max_hash_displacement = hash_displacement;
-    }
 }
 
 
@@ -229,7 +354,6 @@ static void weak_resize(weak_table_t *weak_table, size_t new_size)
 
     weak_table->mask = new_size - 1;
     weak_table->weak_entries = new_entries;
-    weak_table->max_hash_displacement = 0;
     weak_table->num_entries = 0;  // restored by weak_entry_insert below
     
     if (old_entries) {
@@ -270,12 +394,25 @@ static void weak_compact_maybe(weak_table_t *weak_table)
 
 /**
  * Remove entry from the zone's table of weak references.
+ * Moves other entries, so pointers to them are invalid afterwards.
  */
 static void weak_entry_remove(weak_table_t *weak_table, weak_entry_t *entry)
 {
     // remove entry
     if (entry->out_of_line) free(entry->referrers);
-    bzero(entry, sizeof(*entry));
+
+    // Shift the rest of the run back into the vacated bucket.
+    weak_entry_t *weak_entries = weak_table->weak_entries;
+    size_t index = entry - weak_entries;
+    size_t next = (index+1) & weak_table->mask;
+    while (weak_entries[next].referent != nil  &&  
+           weak_entry_displacement(weak_table, next) != 0) 
+    {
+        weak_entries[index] = weak_entries[next];
+        index = next;
+        next = (next+1) & weak_table->mask;
+    }
+    bzero(&weak_entries[index], sizeof(weak_entries[index]));
 
     weak_table->num_entries--;
 
@@ -304,15 +441,17 @@ weak_entry_for_referent(weak_table_t *weak_table, objc_object *referent)
 
     size_t index = hash_pointer(referent) & weak_table->mask;
     size_t hash_displacement = 0;
-    while (weak_table->weak_entries[index].referent != referent) {
-        index = (index+1) & weak_table->mask;
-        hash_displacement++;
-        if (hash_displacement > weak_table->max_hash_displacement) {
+    while (weak_entries[index].referent != referent) {
+        if (weak_entries[index].referent == nil  ||  
+            weak_entry_displacement(weak_table, index) < hash_displacement) 
+        {
             return nil;
         }
+        index = (index+1) & weak_table->mask;
+        hash_displacement++;
     }
     
-    return &weak_table->weak_entries[index];
+    return &weak_entries[index];
 }
 
 /** 
@@ -469,16 +608,18 @@ weak_clear_no_lock(weak_table_t *weak_table, id referent_id)
     
     if (entry->out_of_line) {
         referrers = entry->referrers;
-        count = TABLE_SIZE(entry);
+        count = entry->hashed ? TABLE_SIZE(entry) : entry->num_refs;
     } 
     else {
         referrers = entry->inline_referrers;
         count = WEAK_INLINE_COUNT;
     }
     
+    size_t live = 0;
     for (size_t i = 0; i < count; ++i) {
         objc_object **referrer = referrers[i];
         if (referrer) {
+            live++;
             if (*referrer == referent) {
                 *referrer = nil;
             }
@@ -492,6 +633,7 @@ weak_clear_no_lock(weak_table_t *weak_table, id referent_id)
             }
         }
     }
+    weak_statistics_add(&weak_clear_histogram[weak_histogram_bucket(live)]);
     
     weak_entry_remove(weak_table, entry);
 }
@@ -551,3 +693,187 @@ weak_read_no_lock(weak_table_t *weak_table, id *referrer_id)
     return (id)referent;
 }
 
+
+
+/*
+  Lock-free weak loads use hazard pointers. A reader publishes the object 
+  it read from a weak variable in its thread's hazard record, then checks 
+  that the variable still holds that object. Deallocation clears the weak 
+  variables under the side table lock, then waits in weak_wait_for_readers 
+  until no hazard record names the object, and only then frees it. 
+  Either the reader's second check sees the cleared variable, or the 
+  deallocating thread sees the hazard and waits, so the object's memory 
+  stays valid for as long as the reader examines it.
+  Hazard records are never freed. An exiting thread's record is reused 
+  by the next thread that needs one.
+*/
+struct weak_hazard_t {
+    objc_object *referent;
+    weak_hazard_t *next;
+    int32_t inUse;
+    // Pad to a cache line so readers do not share one.
+    char pad[64 - sizeof(objc_object *) - sizeof(weak_hazard_t *) - sizeof(int32_t)];
+};
+
+static weak_hazard_t *weak_hazards;
+
+static weak_hazard_t *weak_hazard_for_thread(void)
+{
+    _objc_pthread_data *data = _objc_fetch_pthread_data(true);
+    if (data->weakHazard) return data->weakHazard;
+
+    weak_hazard_t *hazard = __atomic_load_n(&weak_hazards, __ATOMIC_ACQUIRE);
+    for ( ; hazard; hazard = hazard->next) {
+        if (!hazard->inUse  &&  
+            OSAtomicCompareAndSwap32Barrier(0, 1, &hazard->inUse)) 
+        {
+            break;
+        }
+    }
+
+    if (!hazard) {
+        posix_memalign((void **)&hazard, 64, sizeof(weak_hazard_t));
+        bzero(hazard, sizeof(*hazard));
+        hazard->inUse = 1;
+        do {
+            hazard->next = weak_hazards;
+        } while (!OSAtomicCompareAndSwapPtrBarrier(hazard->next, hazard, 
+                                                   (void * volatile *)&weak_hazards));
+    }
+
+    data->weakHazard = hazard;
+    return hazard;
+}
+
+
+void 
+weak_threadExit(_objc_pthread_data *data)
+{
+    weak_hazard_t *hazard = data->weakHazard;
+    if (!hazard) return;
+
+    data->weakHazard = nil;
+    __atomic_store_n(&hazard->referent, nil, __ATOMIC_RELAXED);
+    __atomic_store_n(&hazard->inUse, 0, __ATOMIC_RELEASE);
+}
+
+
+/** 
+ * Lock-free version of weak_read_no_lock for objc_loadWeakRetained().
+ * Handles nil, tagged pointers, and objects without custom RR whose 
+ * retain count fits inline. Does not look up the weak table: the variable 
+ * can only hold an object if storeWeak registered it.
+ * 
+ * @param referrer The weak pointer address. 
+ * @param result The retained object, or nil if it is deallocating.
+ * 
+ * @return false if the caller must use the locked path instead.
+ */
+bool 
+weak_read_unlocked(id *referrer_id, id *result) 
+{
+    objc_object **referrer = (objc_object **)referrer_id;
+    objc_object *referent = *referrer;
+    if (!referent  ||  referent->isTaggedPointer()) {
+        *result = (id)referent;
+        return true;
+    }
+
+    weak_hazard_t *hazard = weak_hazard_for_thread();
+    hazard->referent = referent;
+    // Publish the hazard before checking the variable again.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    bool handled = false;
+    if (*(objc_object * volatile *)referrer == referent  &&  
+        !referent->ISA()->hasCustomRR()) 
+    {
+        bool retained;
+        handled = referent->rootTryRetain_weakFast(retained);
+        if (handled) *result = retained ? (id)referent : nil;
+    }
+
+    __atomic_store_n(&hazard->referent, nil, __ATOMIC_RELEASE);
+    return handled;
+}
+
+
+/** 
+ * Called by dealloc after weak_clear_no_lock and after the side table 
+ * is unlocked. Returns once no weak_read_unlocked call can still be 
+ * examining referent, so that its memory can be freed.
+ * 
+ * @param referent The object being deallocated. 
+ */
+void 
+weak_wait_for_readers(id referent)
+{
+    weak_wait_for_readers_batch(&referent, 1);
+}
+
+
+/** 
+ * Like weak_wait_for_readers, but walks the hazard records once 
+ * for all of the objects.
+ * 
+ * @param referents The objects being deallocated. 
+ * @param count The number of objects.
+ */
+void 
+weak_wait_for_readers_batch(id *referents, size_t count)
+{
+    if (count == 0) return;
+
+    // Order the cleared weak variables before reading the hazards.
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+    weak_hazard_t *hazard = 
+        __atomic_load_n(&weak_hazards, __ATOMIC_ACQUIRE);
+    for ( ; hazard; hazard = hazard->next) {
+        objc_object *current;
+        while ((current = __atomic_load_n(&hazard->referent, __ATOMIC_ACQUIRE))) {
+            size_t i;
+            for (i = 0; i < count; i++) {
+                if ((objc_object *)referents[i] == current) break;
+            }
+            if (i == count) break;
+            sched_yield();
+        }
+    }
+}
+
+
+/** 
+ * atexit() handler for OBJC_PRINT_WEAK_STATISTICS. Logs how many weak 
+ * variables objects had when they were deallocated, and how their 
+ * referrer storage grew.
+ */
+void 
+weak_printStatistics(void)
+{
+    uint64_t total = 0;
+    for (size_t i = 0; i < WEAK_HISTOGRAM_BUCKETS; i++) {
+        total += weak_clear_histogram[i];
+    }
+
+    _objc_inform("WEAK: weak variables per deallocated object for %s[%d]:", 
+                 getprogname(), getpid());
+    for (size_t i = 0; i < WEAK_HISTOGRAM_BUCKETS; i++) {
+        uint64_t count = weak_clear_histogram[i];
+        size_t low = i == 0 ? 0 : (1ul << (i-1)) + 1;
+        size_t high = i == 0 ? 1 : 1ul << i;
+        if (i == WEAK_HISTOGRAM_BUCKETS-1) {
+            _objc_inform("WEAK:   %4zu+     %10llu (%llu%%)", low, count, 
+                         total ? count * 100 / total : 0);
+        } else if (low == high) {
+            _objc_inform("WEAK:   %4zu      %10llu (%llu%%)", low, count, 
+                         total ? count * 100 / total : 0);
+        } else {
+            _objc_inform("WEAK:   %4zu-%-4zu %10llu (%llu%%)", low, high, 
+                         count, total ? count * 100 / total : 0);
+        }
+    }
+    _objc_inform("WEAK: %llu out-of-line arrays, %llu array growths, "
+                 "%llu converted to hash sets", weak_vector_allocations, 
+                 weak_vector_growths, weak_hash_conversions);
+}
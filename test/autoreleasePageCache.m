@@ -0,0 +1,88 @@
+// TEST_CONFIG MEM=mrc
+
+// Autorelease pool pages are reused instead of returned to malloc.
+// A worker thread that pushes and pops a large pool per request should
+// allocate pages only for its first request, and a thread started after
+// another one exits should reuse the pages that thread left behind.
+// objc_autoreleasePoolPageStatistics() reports both.
+
+#include "test.h"
+#include <Foundation/NSObject.h>
+#include <objc/runtime.h>
+#include <objc/objc-internal.h>
+#include <pthread.h>
+
+#define REQUESTS 100
+#define OBJECTS_PER_REQUEST 20000
+
+static id object;
+
+static void request(objc_autorelease_page_statistics_t *delta)
+{
+    objc_autorelease_page_statistics_t before, after;
+    objc_autoreleasePoolPageStatistics(&before);
+
+    void *pool = objc_autoreleasePoolPush();
+    for (int i = 0; i < OBJECTS_PER_REQUEST; i++) {
+        objc_autorelease(objc_retain(object));
+    }
+    objc_autoreleasePoolPop(pool);
+
+    objc_autoreleasePoolPageStatistics(&after);
+    delta->pagesAllocated = after.pagesAllocated - before.pagesAllocated;
+    delta->pagesFreed = after.pagesFreed - before.pagesFreed;
+    delta->threadCacheHits = after.threadCacheHits - before.threadCacheHits;
+    delta->globalPoolHits = after.globalPoolHits - before.globalPoolHits;
+    delta->allocatorTime = after.allocatorTime - before.allocatorTime;
+}
+
+static void *worker(void *arg)
+{
+    objc_autorelease_page_statistics_t *first =
+        (objc_autorelease_page_statistics_t *)arg;
+    objc_autorelease_page_statistics_t delta;
+
+    request(first);
+    testprintf("first request: %llu pages allocated, %llu freed, "
+               "%llu from thread cache, %llu from global pool, "
+               "%llu ns in allocator\n", first->pagesAllocated,
+               first->pagesFreed, first->threadCacheHits,
+               first->globalPoolHits, first->allocatorTime);
+
+    uint64_t allocated = 0, freed = 0, reused = 0;
+    for (int i = 1; i < REQUESTS; i++) {
+        request(&delta);
+        allocated += delta.pagesAllocated;
+        freed += delta.pagesFreed;
+        reused += delta.threadCacheHits + delta.globalPoolHits;
+    }
+    testprintf("later requests: %llu pages allocated, %llu freed, "
+               "%llu reused\n", allocated, freed, reused);
+    testassert(allocated == 0);
+    testassert(freed == 0);
+    testassert(reused > 0);
+
+    return NULL;
+}
+
+int main()
+{
+    object = [NSObject new];
+
+    objc_autorelease_page_statistics_t first;
+    pthread_t thread;
+    testassert(0 == pthread_create(&thread, NULL, worker, &first));
+    testassert(0 == pthread_join(thread, NULL));
+    testassert(first.pagesAllocated > 0);
+
+    // The first thread's cached pages went to the global pool
+    // when it exited.
+    testassert(0 == pthread_create(&thread, NULL, worker, &first));
+    testassert(0 == pthread_join(thread, NULL));
+    testassert(first.globalPoolHits > 0);
+
+    testassert([object retainCount] == 1);
+    [object release];
+
+    succeed(__FILE__);
+}
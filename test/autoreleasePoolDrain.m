@@ -0,0 +1,139 @@
+// TEST_CONFIG MEM=mrc
+
+// Autorelease pool drain. Pop pools spanning many pages and time them,
+// and check that objects autoreleased or pools pushed by -dealloc during
+// a drain are handled, however long the chain of such deallocations gets, and
+// that a -dealloc can still retain an object further down the pool.
+
+#include "test.h"
+#include <Foundation/NSObject.h>
+#include <objc/runtime.h>
+#include <objc/objc-internal.h>
+
+#define COUNT 10000
+#define CHAIN 100000
+#define ROUNDS 5
+
+static int deallocs;
+
+@interface Link : NSObject {
+@public
+    Link *next;
+}
+@end
+@implementation Link
+-(void)dealloc {
+    deallocs++;
+    // Hand the next link to the pool being drained.
+    if (next) objc_autorelease(next);
+    [super dealloc];
+}
+@end
+
+@interface Nested : NSObject @end
+@implementation Nested
+-(void)dealloc {
+    deallocs++;
+    void *pool = objc_autoreleasePoolPush();
+    objc_autorelease([Link new]);
+    objc_autoreleasePoolPop(pool);
+    [super dealloc];
+}
+@end
+
+static int victimDeallocs;
+static id victimWeak;
+static id rescued;
+static bool rescuedWeakLoad;
+
+@interface Victim : NSObject @end
+@implementation Victim
+-(void)dealloc {
+    victimDeallocs++;
+    [super dealloc];
+}
+@end
+
+@interface Rescuer : NSObject {
+@public
+    Victim *victim;
+}
+@end
+@implementation Rescuer
+-(void)dealloc {
+    // The victim is autoreleased below us and not released yet.
+    id loaded = objc_loadWeakRetained(&victimWeak);
+    rescuedWeakLoad = (loaded == victim);
+    objc_release(loaded);
+    rescued = objc_retain(victim);
+    [super dealloc];
+}
+@end
+
+int main()
+{
+    // A chain of objects, each autoreleased by the previous one's -dealloc.
+    deallocs = 0;
+    void *pool = objc_autoreleasePoolPush();
+    Link *head = [Link new];
+    Link *link = head;
+    for (int i = 1; i < CHAIN; i++) {
+        link->next = [Link new];
+        link = link->next;
+    }
+    objc_autorelease(head);
+    objc_autoreleasePoolPop(pool);
+    testassert(deallocs == CHAIN);
+
+    // -dealloc with its own pool, mixed with ordinary and repeated objects.
+    deallocs = 0;
+    id shared = [NSObject new];
+    pool = objc_autoreleasePoolPush();
+    for (int i = 0; i < 10000; i++) {
+        objc_autorelease([Nested new]);
+        objc_autorelease(objc_retain(shared));
+        objc_autorelease(objc_retain(shared));
+        objc_autorelease([Link new]);
+    }
+    objc_autoreleasePoolPop(pool);
+    testassert(deallocs == 30000);
+    testassert([shared retainCount] == 1);
+    [shared release];
+
+    // -dealloc of a hotter entry retains a colder one that only the 
+    // pool keeps alive. The colder one must survive the drain.
+    Victim *victim = [Victim new];
+    objc_storeWeak(&victimWeak, victim);
+    Rescuer *rescuer = [Rescuer new];
+    rescuer->victim = victim;
+    pool = objc_autoreleasePoolPush();
+    objc_autorelease(victim);
+    objc_autorelease(rescuer);
+    objc_autoreleasePoolPop(pool);
+    testassert(rescued == victim);
+    testassert(rescuedWeakLoad);
+    testassert(victimDeallocs == 0);
+    testassert([victim retainCount] == 1);
+    objc_release(rescued);
+    testassert(victimDeallocs == 1);
+    testassert(victimWeak == nil);
+
+    // Pools spanning many pages.
+    id *objs = (id *)calloc(COUNT, sizeof(id));
+    uint64_t best = ~0ULL;
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < COUNT; i++) objs[i] = [NSObject new];
+        pool = objc_autoreleasePoolPush();
+        for (int i = 0; i < COUNT; i++) objc_autorelease(objs[i]);
+        uint64_t start = mach_absolute_time();
+        objc_autoreleasePoolPop(pool);
+        uint64_t elapsed = nanoseconds(start, mach_absolute_time());
+        if (elapsed < best) best = elapsed;
+    }
+    free(objs);
+
+    testprintf("%d-object pool pop: %llu ns per object\n",
+               COUNT, best / COUNT);
+
+    succeed(__FILE__);
+}
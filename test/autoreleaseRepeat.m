@@ -0,0 +1,94 @@
+// TEST_CONFIG MEM=mrc
+
+// Autoreleasing the same object repeatedly stores a repeat count instead
+// of one pool slot per autorelease. Check that every autorelease is still
+// balanced by one release, including across nested pools and alternating
+// objects, and time a loop that autoreleases one object many times
+// against one that autoreleases distinct objects.
+
+#include "test.h"
+#include <Foundation/NSObject.h>
+#include <objc/runtime.h>
+#include <objc/objc-internal.h>
+
+#define COUNT 10000
+
+static int deallocs;
+
+@interface Counted : NSObject @end
+@implementation Counted
+-(void)dealloc { deallocs++; [super dealloc]; }
+@end
+
+static uint64_t pagesAllocated(void)
+{
+    objc_autorelease_page_statistics_t stats;
+    objc_autoreleasePoolPageStatistics(&stats);
+    return stats.pagesAllocated + stats.threadCacheHits + stats.globalPoolHits;
+}
+
+int main()
+{
+    Counted *a = [Counted new];
+    Counted *b = [Counted new];
+
+    // Repeats, alternation, and nested pools.
+    void *outer = objc_autoreleasePoolPush();
+    for (int i = 0; i < 5; i++) objc_autorelease(objc_retain(a));
+    testassert([a retainCount] == 6);
+    for (int i = 0; i < 5; i++) {
+        objc_autorelease(objc_retain(a));
+        objc_autorelease(objc_retain(b));
+    }
+    void *inner = objc_autoreleasePoolPush();
+    for (int i = 0; i < 3; i++) objc_autorelease(objc_retain(b));
+    testassert([b retainCount] == 9);
+    objc_autoreleasePoolPop(inner);
+    testassert([b retainCount] == 6);
+    objc_autoreleasePoolPop(outer);
+    testassert([a retainCount] == 1);
+    testassert([b retainCount] == 1);
+
+    // The last release of a repeated object deallocates it.
+    deallocs = 0;
+    outer = objc_autoreleasePoolPush();
+    objc_retain(a);
+    objc_retain(a);
+    for (int i = 0; i < 3; i++) objc_autorelease(a);
+    objc_autoreleasePoolPop(outer);
+    testassert(deallocs == 1);
+
+    // One object autoreleased many times fits in one page.
+    uint64_t pages = pagesAllocated();
+    outer = objc_autoreleasePoolPush();
+    uint64_t start = mach_absolute_time();
+    for (int i = 0; i < COUNT; i++) objc_autorelease(objc_retain(b));
+    uint64_t fillTime = nanoseconds(start, mach_absolute_time());
+    testassert([b retainCount] == COUNT + 1);
+    testassert(pagesAllocated() - pages <= 1);
+    start = mach_absolute_time();
+    objc_autoreleasePoolPop(outer);
+    uint64_t popTime = nanoseconds(start, mach_absolute_time());
+    testassert([b retainCount] == 1);
+
+    // Distinct objects, one slot each.
+    id *objs = (id *)calloc(COUNT, sizeof(id));
+    for (int i = 0; i < COUNT; i++) objs[i] = [NSObject new];
+    outer = objc_autoreleasePoolPush();
+    start = mach_absolute_time();
+    for (int i = 0; i < COUNT; i++) objc_autorelease(objs[i]);
+    uint64_t distinctFillTime = nanoseconds(start, mach_absolute_time());
+    start = mach_absolute_time();
+    objc_autoreleasePoolPop(outer);
+    uint64_t distinctPopTime = nanoseconds(start, mach_absolute_time());
+    free(objs);
+
+    testprintf("%d autoreleases of one object: %llu ns each, pop %llu ns; "
+               "of distinct objects: %llu ns each, pop %llu ns\n", COUNT,
+               fillTime / COUNT, popTime / COUNT,
+               distinctFillTime / COUNT, distinctPopTime / COUNT);
+
+    [b release];
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,206 @@
+// TEST_CONFIG MEM=mrc OS=macosx,iphoneos ARCH=x86_64,arm64
+
+// class_setUsesBiasedRetainCount() lets the allocating thread retain and
+// release without atomics. Check counts when references move between
+// threads, merging at autorelease pool pop and at owner thread exit,
+// and when the object changes class, and compare single-thread and
+// cross-thread throughput.
+
+#include "test.h"
+#include <Foundation/NSObject.h>
+#include <objc/runtime.h>
+#include <objc/objc-internal.h>
+#include <pthread.h>
+
+#define THREADS 8
+#define RETAINS 10000
+#define SHARED_RETAINS 10000
+
+static int deallocs;
+
+@interface Plain : NSObject @end
+@implementation Plain
+-(void)dealloc { OSAtomicIncrement32(&deallocs); [super dealloc]; }
+@end
+
+@interface Biased : NSObject @end
+@implementation Biased
+-(void)dealloc { OSAtomicIncrement32(&deallocs); [super dealloc]; }
+@end
+
+@interface BiasedSub : Biased @end
+@implementation BiasedSub @end
+
+static uint64_t ownerLoop(id obj)
+{
+    uint64_t start = mach_absolute_time();
+    for (int i = 0; i < RETAINS; i++) {
+        objc_retain(obj);
+        objc_release(obj);
+    }
+    return nanoseconds(start, mach_absolute_time());
+}
+
+static id shared;
+
+static void *sharedWorker(void *arg __unused)
+{
+    for (int i = 0; i < SHARED_RETAINS; i++) objc_retain(shared);
+    for (int i = 0; i < SHARED_RETAINS; i++) objc_release(shared);
+    return NULL;
+}
+
+static uint64_t hammer(id obj)
+{
+    pthread_t threads[THREADS];
+    shared = obj;
+    uint64_t start = mach_absolute_time();
+    for (int i = 0; i < THREADS; i++) {
+        testassert(0 == pthread_create(&threads[i], NULL, sharedWorker, NULL));
+    }
+    for (int i = 0; i < THREADS; i++) {
+        testassert(0 == pthread_join(threads[i], NULL));
+    }
+    testassert([obj retainCount] == 1);
+    return nanoseconds(start, mach_absolute_time());
+}
+
+// Releases a reference that the main thread created.
+static void *releaser(void *arg)
+{
+    objc_release((id)arg);
+    return NULL;
+}
+
+// Returns an object biased toward a thread that has exited,
+// holding two references created by that thread.
+static void *allocator(void *arg __unused)
+{
+    id obj = [Biased new];
+    objc_retain(obj);
+    return obj;
+}
+
+static void runOnThread(void *(*fn)(void *), void *arg, void **result)
+{
+    pthread_t thread;
+    testassert(0 == pthread_create(&thread, NULL, fn, arg));
+    testassert(0 == pthread_join(thread, result));
+}
+
+int main()
+{
+    // objc_getClass() does not initialize the class.
+    Class biasedCls = objc_getClass("Biased");
+    size_t oldSize = class_getInstanceSize(biasedCls);
+    testassert(class_setUsesBiasedRetainCount(biasedCls));
+    testassert(class_setUsesBiasedRetainCount(biasedCls));
+    testassert(class_getInstanceSize(biasedCls) == oldSize + 2*sizeof(void*));
+
+    // Too late once the class is initialized.
+    testassert(!class_setUsesBiasedRetainCount([Plain class]));
+    testassert(!class_setUsesBiasedRetainCount(object_getClass(biasedCls)));
+
+    // Owner retains and releases, including overflow-sized counts.
+    deallocs = 0;
+    id obj = [BiasedSub new];
+    for (int i = 0; i < 1000; i++) objc_retain(obj);
+    testassert([obj retainCount] == 1001);
+    [obj retain];
+    testassert([obj retainCount] == 1002);
+    [obj release];
+    for (int i = 0; i < 1000; i++) objc_release(obj);
+    testassert([obj retainCount] == 1);
+    id weak = nil;
+    objc_storeWeak(&weak, obj);
+    objc_release(obj);
+    testassert(deallocs == 1);
+    testassert(objc_loadWeak(&weak) == nil);
+
+    // Another thread releases the owner's last reference.
+    // The owner frees the object at its next pool pop.
+    deallocs = 0;
+    void *pool = objc_autoreleasePoolPush();
+    obj = [Biased new];
+    objc_storeWeak(&weak, obj);
+    runOnThread(releaser, obj, NULL);
+    testassert(deallocs == 0);
+    objc_autoreleasePoolPop(pool);
+    testassert(deallocs == 1);
+    testassert(objc_loadWeak(&weak) == nil);
+
+    // Another thread releases one of several owner references,
+    // and the owner's next release merges it.
+    deallocs = 0;
+    obj = [Biased new];
+    objc_retain(obj);
+    objc_retain(obj);
+    runOnThread(releaser, obj, NULL);
+    testassert([obj retainCount] == 2);
+    objc_release(obj);
+    testassert(deallocs == 0);
+    testassert([obj retainCount] == 1);
+    objc_release(obj);
+    testassert(deallocs == 1);
+
+    // The owner exits before its references are released.
+    deallocs = 0;
+    runOnThread(allocator, NULL, (void **)&obj);
+    testassert([obj retainCount] == 2);
+    objc_release(obj);
+    testassert(deallocs == 0);
+    objc_release(obj);
+    testassert(deallocs == 1);
+
+    // object_setClass() to a class without biased counts keeps 
+    // the owner's references.
+    deallocs = 0;
+    obj = [Biased new];
+    for (int i = 0; i < 5; i++) objc_retain(obj);
+    object_setClass(obj, [Plain class]);
+    testassert([obj retainCount] == 6);
+    for (int i = 0; i < 5; i++) objc_release(obj);
+    testassert(deallocs == 0);
+    objc_release(obj);
+    testassert(deallocs == 1);
+
+    // The same, while another thread's release waits for the owner.
+    deallocs = 0;
+    pool = objc_autoreleasePoolPush();
+    obj = [Biased new];
+    objc_retain(obj);
+    objc_retain(obj);
+    runOnThread(releaser, obj, NULL);
+    object_setClass(obj, [Plain class]);
+    objc_autoreleasePoolPop(pool);
+    testassert(deallocs == 0);
+    testassert([obj retainCount] == 2);
+    objc_release(obj);
+    objc_release(obj);
+    testassert(deallocs == 1);
+
+    // Single-thread retain/release by the owner.
+    id plain = [Plain new];
+    id biased = [Biased new];
+    uint64_t plainTime = ownerLoop(plain);
+    uint64_t biasedTime = ownerLoop(biased);
+    testprintf("owner thread retain+release: "
+               "atomic %llu ns/op, biased %llu ns/op\n",
+               plainTime / RETAINS, biasedTime / RETAINS);
+
+    // Cross-thread retain/release by non-owners.
+    plainTime = hammer(plain);
+    biasedTime = hammer(biased);
+    testprintf("%d threads x %d retains+releases of one object: "
+               "atomic %llu ns/op, biased %llu ns/op\n",
+               THREADS, SHARED_RETAINS,
+               plainTime / (2ULL * THREADS * SHARED_RETAINS),
+               biasedTime / (2ULL * THREADS * SHARED_RETAINS));
+
+    deallocs = 0;
+    objc_release(plain);
+    objc_release(biased);
+    testassert(deallocs == 2);
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,22 @@
+// Many categories on classes that are already realized. 
+// See bundlecats.m.
+
+#include "bundlecats.h"
+
+#define CATEGORY(cls, n)                                        \
+    @implementation cls (Cat##n)                                \
+    -(int)method { return n; }                                  \
+    +(int)classMethod { return n; }                             \
+    -(int)method##n { return n; }                               \
+    @end
+
+#define CATEGORIES(cls)                                         \
+    CATEGORY(cls, 1) CATEGORY(cls, 2) CATEGORY(cls, 3) CATEGORY(cls, 4)
+
+#define TREE_CATEGORIES(t)                                      \
+    CATEGORIES(Base##t) CATEGORIES(Sub##t##_0)                  \
+    CATEGORIES(Sub##t##_1) CATEGORIES(Sub##t##_2)               \
+    CATEGORIES(Sub##t##_3)
+
+TREE_CATEGORIES(0) TREE_CATEGORIES(1) TREE_CATEGORIES(2) TREE_CATEGORIES(3)
+TREE_CATEGORIES(4) TREE_CATEGORIES(5) TREE_CATEGORIES(6) TREE_CATEGORIES(7)
@@ -0,0 +1,19 @@
+// Classes for bundlecats.m and the categories in bundlecats-cats.m.
+// Eight class trees of five classes each: Base0..7 and Sub0_0..Sub7_3.
+
+#include "test.h"
+
+#define TREES 8
+#define CLASSES_PER_TREE 5
+#define CATEGORIES_PER_CLASS 4
+
+#define DECLARE_TREE(t)                                         \
+    @interface Base##t : TestRoot                               \
+    -(int)method; +(int)classMethod; @end                       \
+    @interface Sub##t##_0 : Base##t @end                        \
+    @interface Sub##t##_1 : Sub##t##_0 @end                     \
+    @interface Sub##t##_2 : Sub##t##_1 @end                     \
+    @interface Sub##t##_3 : Base##t @end
+
+DECLARE_TREE(0) DECLARE_TREE(1) DECLARE_TREE(2) DECLARE_TREE(3)
+DECLARE_TREE(4) DECLARE_TREE(5) DECLARE_TREE(6) DECLARE_TREE(7)
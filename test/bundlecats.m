@@ -0,0 +1,91 @@
+/*
+TEST_BUILD
+    $C{COMPILE} $DIR/bundlecats.m -o bundlecats.out
+    $C{COMPILE} -undefined dynamic_lookup -bundle $DIR/bundlecats-cats.m -o bundlecats.bundle
+END
+*/
+
+// Load a bundle with many categories on classes that are 
+// already realized and have full method caches. 
+// Categories from one image are attached together, with one 
+// cache flush for all of their classes.
+
+#include "bundlecats.h"
+#include "testroot.i"
+#include <objc/runtime.h>
+#include <dlfcn.h>
+
+#define DEFINE_TREE(t)                                          \
+    @implementation Base##t                                     \
+    -(int)method { return 0; }                                  \
+    +(int)classMethod { return 0; }                             \
+    @end                                                        \
+    @implementation Sub##t##_0 @end                             \
+    @implementation Sub##t##_1 @end                             \
+    @implementation Sub##t##_2 @end                             \
+    @implementation Sub##t##_3 @end
+
+DEFINE_TREE(0) DEFINE_TREE(1) DEFINE_TREE(2) DEFINE_TREE(3)
+DEFINE_TREE(4) DEFINE_TREE(5) DEFINE_TREE(6) DEFINE_TREE(7)
+
+static Class classes[TREES * CLASSES_PER_TREE];
+
+static void check(int expected)
+{
+    for (int i = 0; i < TREES * CLASSES_PER_TREE; i++) {
+        Class cls = classes[i];
+        id obj = [cls new];
+        testassert([obj method] == expected);
+        testassert([cls classMethod] == expected);
+        RELEASE_VAR(obj);
+    }
+}
+
+int main()
+{
+    static const char * const suffixes[CLASSES_PER_TREE] = 
+        { "", "_0", "_1", "_2", "_3" };
+    for (int t = 0; t < TREES; t++) {
+        for (int c = 0; c < CLASSES_PER_TREE; c++) {
+            char name[16];
+            snprintf(name, sizeof(name), "%s%d%s", 
+                     c ? "Sub" : "Base", t, suffixes[c]);
+            classes[t*CLASSES_PER_TREE + c] = objc_getClass(name);
+            testassert(classes[t*CLASSES_PER_TREE + c]);
+        }
+    }
+
+    // Realize every class and fill its caches.
+    check(0);
+    check(0);
+
+    uint64_t start = mach_absolute_time();
+    void *dlh = dlopen("bundlecats.bundle", RTLD_LAZY);
+    uint64_t end = mach_absolute_time();
+    testassert(dlh);
+
+    testprintf("loaded %d categories in %llu ns\n", 
+               TREES * CLASSES_PER_TREE * CATEGORIES_PER_CLASS, 
+               nanoseconds(start, end));
+
+    // Newest categories win, and no stale cache entries remain.
+    check(CATEGORIES_PER_CLASS);
+
+    // Every category's lists were attached.
+    for (int i = 0; i < TREES * CLASSES_PER_TREE; i++) {
+        Class cls = classes[i];
+        for (int n = 1; n <= CATEGORIES_PER_CLASS; n++) {
+            char name[16];
+            snprintf(name, sizeof(name), "method%d", n);
+            testassert(class_getInstanceMethod(cls, sel_registerName(name)));
+        }
+
+        unsigned int count;
+        Method *methods = class_copyMethodList(cls, &count);
+        int base = (i % CLASSES_PER_TREE == 0) ? 1 : 0;
+        testassert(count == CATEGORIES_PER_CLASS * 2 + base);
+        free(methods);
+    }
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,158 @@
+// TEST_CONFIG MEM=mrc
+
+#include "test.h"
+#include "testroot.i"
+#include <objc/runtime.h>
+#include <objc/objc-internal.h>
+#include <mach/mach.h>
+
+#if !__OBJC2__
+
+int main()
+{
+    succeed(__FILE__);
+}
+
+#else
+
+@protocol Proto @end
+@protocol SubProto <Proto> @end
+@protocol CatProto @end
+
+@interface Sub1 : TestRoot <SubProto> @end
+@implementation Sub1 @end
+
+@interface Sub2 : Sub1 @end
+@implementation Sub2 @end
+
+@interface Other : TestRoot @end
+@implementation Other @end
+
+@interface Other (Cat) <CatProto> @end
+@implementation Other (Cat) @end
+
+static size_t classRWBytes(void)
+{
+    unsigned int count;
+    size_t bytes = 0;
+    objc_memory_statistic_t *stats = objc_copyMemoryStatistics(&count);
+    for (unsigned int i = 0; i < count; i++) {
+        if (0 == strcmp(stats[i].name, "class_rw_t")) {
+            bytes = stats[i].bytes;
+        }
+    }
+    free(stats);
+    return bytes;
+}
+
+static size_t residentBytes(void)
+{
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    kern_return_t kr = task_info(mach_task_self(), MACH_TASK_BASIC_INFO,
+                                 (task_info_t)&info, &count);
+    testassert(kr == KERN_SUCCESS);
+    return info.resident_size;
+}
+
+static bool contains(Class *list, unsigned int count, const char *name)
+{
+    for (unsigned int i = 0; i < count; i++) {
+        if (0 == strcmp(class_getName(list[i]), name)) return true;
+    }
+    return false;
+}
+
+int main()
+{
+    const char *image = class_getImageName([TestRoot class]);
+    testassert(image);
+
+    // Take the snapshots before touching Sub1 or Sub2 so the 
+    // enumeration sees them unrealized. Other is realized by 
+    // objc_getClass() below, but its category is still unattached 
+    // when the CatProto snapshot is taken.
+    unsigned int allCount, subCount, protoCount, catCount, noneCount, badCount;
+    Class *all = objc_copyClassListForImage(image, nil, nil, &allCount);
+    Class *subs = objc_copyClassListForImage(image, [TestRoot class], nil, 
+                                             &subCount);
+    Class *protos = objc_copyClassListForImage(image, nil, @protocol(Proto), 
+                                               &protoCount);
+    Class *cats = objc_copyClassListForImage(image, nil, @protocol(CatProto), 
+                                             &catCount);
+    Class *none = objc_copyClassListForImage(image, objc_getClass("Other"), 
+                                             @protocol(SubProto), &noneCount);
+    Class *bad = objc_copyClassListForImage("/no/such/image", nil, nil, 
+                                            &badCount);
+
+    testassert(all);
+    testassert(allCount == 4);
+    testassert(all[allCount] == nil);
+    testassert(contains(all, allCount, "TestRoot"));
+    testassert(contains(all, allCount, "Sub1"));
+    testassert(contains(all, allCount, "Sub2"));
+    testassert(contains(all, allCount, "Other"));
+
+    testassert(subCount == 4);
+
+    testassert(protoCount == 2);
+    testassert(contains(protos, protoCount, "Sub1"));
+    testassert(contains(protos, protoCount, "Sub2"));
+
+    testassert(catCount == 1);
+    testassert(contains(cats, catCount, "Other"));
+
+    testassert(!none);
+    testassert(noneCount == 0);
+
+    testassert(!bad);
+    testassert(badCount == 0);
+
+    free(all);
+    free(subs);
+    free(protos);
+    free(cats);
+
+    // Compare against the realizing API. Run ours first so that 
+    // objc_copyClassList() has not already realized everything. 
+    // Ours allocates no class_rw_t; the resident size saved is 
+    // whatever objc_copyClassList() adds by realizing the rest.
+    unsigned int count, count2;
+    size_t rw0 = classRWBytes();
+    size_t resident0 = residentBytes();
+    uint64_t t0 = mach_absolute_time();
+    all = objc_copyClassListForImage(NULL, nil, nil, &count);
+    uint64_t t1 = mach_absolute_time();
+    size_t rw1 = classRWBytes();
+    size_t resident1 = residentBytes();
+    uint64_t t2 = mach_absolute_time();
+    Class *all2 = objc_copyClassList(&count2);
+    uint64_t t3 = mach_absolute_time();
+    size_t rw2 = classRWBytes();
+    size_t resident2 = residentBytes();
+    testprintf("objc_copyClassListForImage: %u classes, %llu ns, "
+               "class_rw_t %+lld KB, resident %+lld KB\n", 
+               count, nanoseconds(t0, t1), 
+               ((long long)rw1 - (long long)rw0) / 1024, 
+               ((long long)resident1 - (long long)resident0) / 1024);
+    testprintf("objc_copyClassList:         %u classes, %llu ns, "
+               "class_rw_t %+lld KB, resident %+lld KB\n", 
+               count2, nanoseconds(t2, t3), 
+               ((long long)rw2 - (long long)rw1) / 1024, 
+               ((long long)resident2 - (long long)resident1) / 1024);
+    testassert(rw1 == rw0);
+    testassert(rw2 >= rw1);
+    for (unsigned int i = 0; i < count; i++) {
+        bool found = false;
+        for (unsigned int j = 0; j < count2  &&  !found; j++) {
+            found = (all[i] == all2[j]);
+        }
+        testassert(found);
+    }
+    free(all);
+    free(all2);
+
+    succeed(__FILE__);
+}
+
+#endif
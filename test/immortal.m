@@ -0,0 +1,97 @@
+// TEST_CONFIG MEM=mrc
+
+// objc_setImmortal() makes retain, release, and autorelease do nothing.
+// Check that an immortal object is never deallocated, still supports
+// weak references, and compare many threads hammering one hot object
+// before and after it becomes immortal.
+
+#include "test.h"
+#include <Foundation/NSObject.h>
+#include <objc/runtime.h>
+#include <objc/objc-internal.h>
+#include <pthread.h>
+
+#define THREADS 8
+#define RETAINS 10000
+
+static int deallocs;
+
+@interface Singleton : NSObject @end
+@implementation Singleton
+-(void)dealloc { deallocs++; [super dealloc]; }
+@end
+
+static id shared;
+
+static void *worker(void *arg __unused)
+{
+    for (int i = 0; i < RETAINS; i++) objc_retain(shared);
+    for (int i = 0; i < RETAINS; i++) objc_release(shared);
+    return NULL;
+}
+
+static uint64_t hammer(id obj)
+{
+    pthread_t threads[THREADS];
+    shared = obj;
+    uint64_t start = mach_absolute_time();
+    for (int i = 0; i < THREADS; i++) {
+        testassert(0 == pthread_create(&threads[i], NULL, worker, NULL));
+    }
+    for (int i = 0; i < THREADS; i++) {
+        testassert(0 == pthread_join(threads[i], NULL));
+    }
+    return nanoseconds(start, mach_absolute_time());
+}
+
+int main()
+{
+    id obj = [Singleton new];
+    uint64_t mortalTime = hammer(obj);
+    testassert([obj retainCount] == 1);
+
+    id weak = nil;
+    objc_storeWeak(&weak, obj);
+
+    objc_setImmortal(obj);
+    objc_setImmortal(obj);
+    testassert([obj retainCount] > 1000000);
+    uint64_t immortalTime = hammer(obj);
+
+    testprintf("%d threads x %d retains+releases of one object: "
+               "mortal %llu ns/op, immortal %llu ns/op\n",
+               THREADS, RETAINS,
+               mortalTime / (2ULL * THREADS * RETAINS),
+               immortalTime / (2ULL * THREADS * RETAINS));
+
+    // Unbalanced releases and autoreleases do not deallocate it.
+    deallocs = 0;
+    void *pool = objc_autoreleasePoolPush();
+    for (int i = 0; i < 10; i++) {
+        [obj release];
+        objc_release(obj);
+        [obj autorelease];
+        objc_autorelease(obj);
+    }
+    objc_autoreleasePoolPop(pool);
+    testassert(deallocs == 0);
+    testassert([obj retainCount] > 1000000);
+
+    // Weak references still load, and new ones can be formed.
+    testassert(objc_loadWeak(&weak) == obj);
+    id weak2 = nil;
+    testassert(objc_storeWeak(&weak2, obj) == obj);
+    id loaded = objc_loadWeakRetained(&weak2);
+    testassert(loaded == obj);
+    objc_release(loaded);
+    objc_storeWeak(&weak, nil);
+    objc_storeWeak(&weak2, nil);
+    testassert(deallocs == 0);
+
+    // Other objects are unaffected.
+    id mortal = [Singleton new];
+    objc_release(mortal);
+    testassert(deallocs == 1);
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,107 @@
+// TEST_CONFIG MEM=mrc OS=macosx,iphoneos ARCH=x86_64,arm64
+
+// class_setUsesInlineRetainCount() keeps overflowing retain counts in
+// the object instead of the side table. Check counts, subclass ivar
+// layout, and weak references, and compare a hot shared object's
+// retain/release throughput with and without an inline word.
+
+#include "test.h"
+#include <Foundation/NSObject.h>
+#include <objc/runtime.h>
+#include <objc/objc-internal.h>
+#include <pthread.h>
+
+#define THREADS 8
+#define RETAINS 10000
+#define DEEP 1000000
+
+static int deallocs;
+
+@interface Spilling : NSObject @end
+@implementation Spilling
+-(void)dealloc { deallocs++; [super dealloc]; }
+@end
+
+@interface Inline : NSObject @end
+@implementation Inline
+-(void)dealloc { deallocs++; [super dealloc]; }
+@end
+
+@interface InlineSub : Inline { @public long ivar; } @end
+@implementation InlineSub @end
+
+static id shared;
+
+static void *worker(void *arg __unused)
+{
+    for (int i = 0; i < RETAINS; i++) [shared retain];
+    for (int i = 0; i < RETAINS; i++) [shared release];
+    return NULL;
+}
+
+static uint64_t hammer(id obj)
+{
+    pthread_t threads[THREADS];
+    shared = obj;
+    uint64_t start = mach_absolute_time();
+    for (int i = 0; i < THREADS; i++) {
+        testassert(0 == pthread_create(&threads[i], NULL, worker, NULL));
+    }
+    for (int i = 0; i < THREADS; i++) {
+        testassert(0 == pthread_join(threads[i], NULL));
+    }
+    testassert([obj retainCount] == 1);
+    return nanoseconds(start, mach_absolute_time());
+}
+
+int main()
+{
+    // objc_getClass() does not initialize the class.
+    Class inlineCls = objc_getClass("Inline");
+    size_t oldSize = class_getInstanceSize(inlineCls);
+    testassert(class_setUsesInlineRetainCount(inlineCls));
+    testassert(class_setUsesInlineRetainCount(inlineCls));
+    testassert(class_getInstanceSize(inlineCls) == oldSize + sizeof(void*));
+
+    // Too late once the class is initialized.
+    testassert(!class_setUsesInlineRetainCount([Spilling class]));
+    testassert(!class_setUsesInlineRetainCount(object_getClass(inlineCls)));
+
+    // Subclasses slide their ivars past the inherited word.
+    InlineSub *sub = [InlineSub new];
+    testassert(class_getInstanceSize([InlineSub class]) >
+               class_getInstanceSize(inlineCls));
+    sub->ivar = 0x5555;
+    for (int i = 0; i < DEEP; i++) [sub retain];
+    testassert([sub retainCount] == DEEP + 1);
+    testassert(sub->ivar == 0x5555);
+
+    // A weak reference survives the deep count and is cleared at dealloc.
+    id weak = nil;
+    objc_storeWeak(&weak, sub);
+    for (int i = 0; i < DEEP; i++) [sub release];
+    testassert([sub retainCount] == 1);
+    testassert(objc_loadWeak(&weak) == sub);
+    deallocs = 0;
+    [sub release];
+    testassert(deallocs == 1);
+    testassert(objc_loadWeak(&weak) == nil);
+
+    // Compare a hot shared object with and without the inline word.
+    id spilling = [Spilling new];
+    id inlined = [Inline new];
+    uint64_t spillTime = hammer(spilling);
+    uint64_t inlineTime = hammer(inlined);
+    testprintf("%d threads x %d retains+releases of one object: "
+               "side table %llu ns/op, inline word %llu ns/op\n",
+               THREADS, RETAINS,
+               spillTime / (2ULL * THREADS * RETAINS),
+               inlineTime / (2ULL * THREADS * RETAINS));
+
+    deallocs = 0;
+    [spilling release];
+    [inlined release];
+    testassert(deallocs == 2);
+
+    succeed(__FILE__);
+}
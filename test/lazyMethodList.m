@@ -0,0 +1,88 @@
+// TEST_CONFIG
+
+// Method lists are fixed up when first searched. 
+// Search the same unfixed lists from several threads at once.
+
+#include "test.h"
+#include "testroot.i"
+#include <objc/runtime.h>
+#include <pthread.h>
+
+#define THREADS 8
+
+#define M(n) -(int)m##n { return n; }  +(int)c##n { return n; }
+#define M8(n) M(n##0) M(n##1) M(n##2) M(n##3) M(n##4) M(n##5) M(n##6) M(n##7)
+
+@interface Lazy : TestRoot @end
+@implementation Lazy
+M8(1) M8(2) M8(3) M8(4)
+@end
+
+@interface Lazy (Cat) @end
+@implementation Lazy (Cat)
+M8(5) M8(6)
+@end
+
+static Class cls;
+static pthread_mutex_t startLock = PTHREAD_MUTEX_INITIALIZER;
+
+static void check(int n)
+{
+    char name[16];
+
+    snprintf(name, sizeof(name), "m%d", n);
+    Method m = class_getInstanceMethod(cls, sel_registerName(name));
+    testassert(m);
+    testassert(0 == strcmp(sel_getName(method_getName(m)), name));
+    testassert(((int(*)(id, SEL))method_getImplementation(m))(nil, 0) == n);
+
+    snprintf(name, sizeof(name), "c%d", n);
+    m = class_getClassMethod(cls, sel_registerName(name));
+    testassert(m);
+    testassert(((int(*)(id, SEL))method_getImplementation(m))(nil, 0) == n);
+}
+
+static void *thread(void *arg)
+{
+    uintptr_t t = (uintptr_t)arg;
+
+    pthread_mutex_lock(&startLock);
+    pthread_mutex_unlock(&startLock);
+
+    // Each thread walks the selectors in a different order.
+    for (int i = 0; i < 6*8; i++) {
+        int j = (i + (int)t*7) % (6*8);
+        check((j/8 + 1)*10 + j%8);
+    }
+    return NULL;
+}
+
+int main()
+{
+    pthread_t threads[THREADS];
+
+    // Realize the class without searching its method lists.
+    cls = objc_getClass("Lazy");
+    testassert(cls);
+
+    pthread_mutex_lock(&startLock);
+    for (uintptr_t i = 0; i < THREADS; i++) {
+        pthread_create(&threads[i], NULL, thread, (void *)i);
+    }
+    pthread_mutex_unlock(&startLock);
+    for (uintptr_t i = 0; i < THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    unsigned int count;
+    Method *list = class_copyMethodList(cls, &count);
+    testassert(count == 6*8);
+    for (unsigned int i = 0; i < count; i++) {
+        testassert(sel_getName(method_getName(list[i]))[0] == 'm');
+        testassert(method_getName(list[i]) == 
+                   sel_registerName(sel_getName(method_getName(list[i]))));
+    }
+    free(list);
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,126 @@
+/*
+TEST_CONFIG MEM=mrc
+TEST_ENV OBJC_PRINT_LOCK_STATISTICS=YES OBJC_DISABLE_NONPOINTER_ISA=YES
+
+TEST_RUN_OUTPUT
+OK: lockOversubscription.m
+objc\[\d+\]: LOCKS: spin lock statistics for .*
+(objc\[\d+\]: LOCKS: .*\n)*
+END
+*/
+
+// Runtime spin locks under 4x oversubscription. Four threads per CPU
+// share a few objects, so every lock class is contended and lock holders
+// are regularly preempted. Report throughput and lock statistics.
+
+#include "test.h"
+#include "testroot.i"
+#include <objc/runtime.h>
+#include <objc/objc-internal.h>
+#include <objc/objc-sync.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#define OVERSUBSCRIPTION 4
+#define OBJECTS 4
+#define ITERATIONS 2000
+// Non-pointer isa is disabled, so every retain uses the side table.
+#define RETAINS 100
+
+@interface Shared : TestRoot
+@property (atomic, retain) id value;
+@end
+@implementation Shared
+@synthesize value;
+@end
+
+static Shared *shared[OBJECTS];
+static char assocKey;
+
+static void *worker(void *arg)
+{
+    uintptr_t n = (uintptr_t)arg;
+    for (int i = 0; i < ITERATIONS; i++) {
+        Shared *obj = shared[(n + i) % OBJECTS];
+
+        objc_sync_enter(obj);
+        objc_sync_exit(obj);
+
+        objc_setAssociatedObject(obj, &assocKey, obj, OBJC_ASSOCIATION_ASSIGN);
+        testassert(objc_getAssociatedObject(obj, &assocKey) == obj);
+
+        obj.value = obj;
+        testassert(obj.value == obj);
+
+        if (i % 100 == 0) {
+            for (int j = 0; j < RETAINS; j++) objc_retain(obj);
+            for (int j = 0; j < RETAINS; j++) objc_release(obj);
+        }
+    }
+    return NULL;
+}
+
+static objc_lock_statistic_t lockStat(const char *name)
+{
+    unsigned int count;
+    objc_lock_statistic_t *stats = objc_copyLockStatistics(&count);
+    testassert(stats);
+    for (unsigned int i = 0; i < count; i++) {
+        if (0 == strcmp(stats[i].name, name)) {
+            objc_lock_statistic_t result = stats[i];
+            free(stats);
+            return result;
+        }
+    }
+    fail("no lock statistic named '%s'", name);
+}
+
+int main()
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    testassert(cpus > 0);
+    int threadCount = (int)(cpus * OVERSUBSCRIPTION);
+
+    for (int i = 0; i < OBJECTS; i++) {
+        shared[i] = [Shared new];
+    }
+
+    pthread_t *threads = (pthread_t *)calloc(threadCount, sizeof(pthread_t));
+    uint64_t start = mach_absolute_time();
+    for (int i = 0; i < threadCount; i++) {
+        testassert(0 == pthread_create(&threads[i], NULL, worker,
+                                       (void *)(uintptr_t)i));
+    }
+    for (int i = 0; i < threadCount; i++) {
+        testassert(0 == pthread_join(threads[i], NULL));
+    }
+    uint64_t elapsed = nanoseconds(start, mach_absolute_time());
+    free(threads);
+
+    testprintf("%d threads on %ld CPUs: %llu ns per iteration\n",
+               threadCount, cpus,
+               elapsed / ((uint64_t)threadCount * ITERATIONS));
+
+    static const char * const names[] = {
+        "side tables", "@synchronized",
+        "associated objects", "atomic properties",
+    };
+    for (size_t i = 0; i < sizeof(names)/sizeof(names[0]); i++) {
+        objc_lock_statistic_t stat = lockStat(names[i]);
+        testprintf("%-20s %10llu acquired  %8llu contended  "
+                   "%12llu ns waiting\n", stat.name, stat.acquisitions,
+                   stat.contentions, stat.waitNanoseconds);
+        testassert(stat.acquisitions >= (uint64_t)threadCount);
+        testassert(stat.contentions <= stat.acquisitions);
+        testassert(stat.contentions > 0  ||  stat.waitNanoseconds == 0);
+    }
+
+    for (int i = 0; i < OBJECTS; i++) {
+        shared[i].value = nil;
+        objc_removeAssociatedObjects(shared[i]);
+        testassert([shared[i] retainCount] == 1);
+        [shared[i] release];
+    }
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,109 @@
+// TEST_CONFIG MEM=mrc
+
+// objc_copyMemoryStatistics() reports runtime heap usage by subsystem.
+
+#include "test.h"
+#include "testroot.i"
+#include <objc/runtime.h>
+#include <objc/objc-internal.h>
+#include <objc/objc-sync.h>
+
+#define COUNT 100
+
+@interface Counted : TestRoot @end
+@implementation Counted @end
+
+static objc_memory_statistic_t stat(const char *name)
+{
+    unsigned int count;
+    objc_memory_statistic_t *stats = objc_copyMemoryStatistics(&count);
+    testassert(stats);
+    for (unsigned int i = 0; i < count; i++) {
+        if (0 == strcmp(stats[i].name, name)) {
+            objc_memory_statistic_t result = stats[i];
+            free(stats);
+            return result;
+        }
+    }
+    fail("no memory statistic named '%s'", name);
+}
+
+static int imp(id self __unused, SEL _cmd __unused) { return 1; }
+
+int main()
+{
+    unsigned int count;
+    objc_memory_statistic_t *stats = objc_copyMemoryStatistics(&count);
+    testassert(stats);
+    testassert(count > 0);
+    for (unsigned int i = 0; i < count; i++) {
+        testassert(stats[i].name);
+        testassert(stats[i].count == 0  ||  stats[i].bytes > 0);
+        testprintf("%-24s %10zu bytes  count %zu\n",
+                   stats[i].name, stats[i].bytes, stats[i].count);
+    }
+    free(stats);
+
+    // Realized classes have class_rw_t.
+    objc_memory_statistic_t rw = stat("class_rw_t");
+    testassert(rw.count > 0);
+    testassert(rw.bytes >= rw.count * 3 * sizeof(void *));
+
+    // class_addMethod() allocates a method list.
+    objc_memory_statistic_t mlists = stat("method lists");
+    testassert(class_addMethod([Counted class], sel_registerName("added"),
+                               (IMP)imp, "i@:"));
+    testassert(stat("method lists").count == mlists.count + 1);
+
+    id objs[COUNT];
+    id *weaks = (id *)calloc(COUNT, sizeof(id));
+    for (int i = 0; i < COUNT; i++) {
+        objs[i] = [Counted new];
+    }
+
+    objc_memory_statistic_t assoc = stat("associated objects");
+    objc_memory_statistic_t weak = stat("weak table");
+    objc_memory_statistic_t sync = stat("@synchronized");
+    objc_memory_statistic_t pages = stat("autorelease pool pages");
+
+    for (int i = 0; i < COUNT; i++) {
+        objc_setAssociatedObject(objs[i], &weaks, objs[i],
+                                 OBJC_ASSOCIATION_ASSIGN);
+        objc_storeWeak(&weaks[i], objs[i]);
+        objc_sync_enter(objs[i]);
+    }
+
+    testassert(stat("associated objects").count == assoc.count + COUNT);
+    testassert(stat("associated objects").bytes > assoc.bytes);
+    testassert(stat("weak table").count == weak.count + COUNT);
+    testassert(stat("weak table").bytes >= weak.bytes);
+    // SyncData blocks are never freed, so unused ones may be reused.
+    testassert(stat("@synchronized").count >= COUNT);
+    testassert(stat("@synchronized").count >= sync.count);
+
+    for (int i = 0; i < COUNT; i++) {
+        objc_sync_exit(objs[i]);
+    }
+
+    // Fill several autorelease pool pages.
+    @autoreleasepool {
+        for (int i = 0; i < 100000; i++) {
+            [[objs[i % COUNT] retain] autorelease];
+        }
+        objc_memory_statistic_t full = stat("autorelease pool pages");
+        testassert(full.count > pages.count);
+        testassert(full.bytes > pages.bytes);
+    }
+
+    for (int i = 0; i < COUNT; i++) {
+        objc_storeWeak(&weaks[i], nil);
+        objc_removeAssociatedObjects(objs[i]);
+        [objs[i] release];
+    }
+    free(weaks);
+
+    testassert(stat("associated objects").count == assoc.count);
+    testassert(stat("weak table").count == weak.count);
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,14 @@
+/* 
+
+TEST_CONFIG MEM=mrc
+TEST_ENV OBJC_AUTORELEASE_POOL_PAGE_SIZE=2M
+
+TEST_BUILD
+    $C{COMPILE} $DIR/poolPageSize.m -o poolPageSize-2m.out -DPAGE_SIZE_EXPECTED=2097152
+END
+
+TEST_RUN_OUTPUT
+OK: poolPageSize-2m.out
+END
+
+*/
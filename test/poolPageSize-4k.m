@@ -0,0 +1,14 @@
+/* 
+
+TEST_CONFIG MEM=mrc
+TEST_ENV OBJC_AUTORELEASE_POOL_PAGE_SIZE=4K
+
+TEST_BUILD
+    $C{COMPILE} $DIR/poolPageSize.m -o poolPageSize-4k.out -DPAGE_SIZE_EXPECTED=4096
+END
+
+TEST_RUN_OUTPUT
+OK: poolPageSize-4k.out
+END
+
+*/
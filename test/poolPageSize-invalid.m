@@ -0,0 +1,15 @@
+/* 
+
+TEST_CONFIG MEM=mrc
+TEST_ENV OBJC_AUTORELEASE_POOL_PAGE_SIZE=3000
+
+TEST_BUILD
+    $C{COMPILE} $DIR/poolPageSize.m -o poolPageSize-invalid.out
+END
+
+TEST_RUN_OUTPUT
+objc\[\d+\]: OBJC_AUTORELEASE_POOL_PAGE_SIZE=3000 ignored: the size must be a power of 2 from \d+ to 2097152 bytes
+OK: poolPageSize-invalid.out
+END
+
+*/
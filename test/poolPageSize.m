@@ -0,0 +1,99 @@
+// TEST_CONFIG MEM=mrc
+
+// This file is also used by the poolPageSize-*.m tests, which select
+// other page sizes with OBJC_AUTORELEASE_POOL_PAGE_SIZE and define
+// PAGE_SIZE_EXPECTED to match.
+
+// Autorelease pool page size. Check that pages hold as many objects as
+// the selected size allows, that nested pools spanning many pages pop
+// correctly, and time push/pop of small pools and fill/drain of a
+// large pool.
+
+#include "test.h"
+#include <Foundation/NSObject.h>
+#include <objc/runtime.h>
+#include <objc/objc-internal.h>
+
+#define COUNT 10000
+#define SMALL_POOLS 10000
+#define SMALL_POOL_OBJECTS 8
+#define DEPTH 1000
+
+static uint64_t pagesUsed(void)
+{
+    objc_autorelease_page_statistics_t stats;
+    objc_autoreleasePoolPageStatistics(&stats);
+    return stats.pagesAllocated + stats.threadCacheHits + stats.globalPoolHits;
+}
+
+int main()
+{
+    id obj = [NSObject new];
+    id *objs = (id *)calloc(COUNT, sizeof(id));
+
+#ifdef PAGE_SIZE_EXPECTED
+    // Enough objects to fill four pages, plus the partly-used first page.
+    size_t perPage = PAGE_SIZE_EXPECTED / sizeof(id);
+    size_t fill = 4 * perPage;
+    id *filled = (id *)calloc(fill, sizeof(id));
+    for (size_t i = 0; i < fill; i++) filled[i] = [NSObject new];
+    uint64_t pages = pagesUsed();
+    void *pool = objc_autoreleasePoolPush();
+    for (size_t i = 0; i < fill; i++) objc_autorelease(filled[i]);
+    pages = pagesUsed() - pages;
+    objc_autoreleasePoolPop(pool);
+    free(filled);
+    testprintf("%zu-byte pages: %llu pages for %zu objects\n",
+               (size_t)PAGE_SIZE_EXPECTED, pages, fill);
+    testassert(pages >= 4  &&  pages <= 5);
+#endif
+
+    // Nested pools, each holding a few distinct objects so that
+    // pool boundaries fall on many different pages.
+    void *pools[DEPTH];
+    for (int i = 0; i < DEPTH; i++) {
+        pools[i] = objc_autoreleasePoolPush();
+        for (int j = 0; j < 100; j++) {
+            objc_autorelease(objc_retain(obj));
+            objc_autorelease([NSObject new]);
+        }
+    }
+    testassert([obj retainCount] == 1 + 100*DEPTH);
+    for (int i = DEPTH; i-- > 0; ) {
+        objc_autoreleasePoolPop(pools[i]);
+        testassert([obj retainCount] == 1 + 100*(uintptr_t)i);
+    }
+
+    // Push and pop of small pools.
+    uint64_t start = mach_absolute_time();
+    for (int i = 0; i < SMALL_POOLS; i++) {
+        void *pool = objc_autoreleasePoolPush();
+        for (int j = 0; j < SMALL_POOL_OBJECTS; j++) {
+            objc_autorelease(objc_retain(obj));
+            objc_autorelease(objc_retain(obj));
+        }
+        objc_autoreleasePoolPop(pool);
+    }
+    uint64_t pushPopTime = nanoseconds(start, mach_absolute_time());
+
+    // Fill and drain a large pool.
+    for (int i = 0; i < COUNT; i++) objs[i] = [NSObject new];
+    void *pool = objc_autoreleasePoolPush();
+    start = mach_absolute_time();
+    for (int i = 0; i < COUNT; i++) objc_autorelease(objs[i]);
+    uint64_t fillTime = nanoseconds(start, mach_absolute_time());
+    start = mach_absolute_time();
+    objc_autoreleasePoolPop(pool);
+    uint64_t drainTime = nanoseconds(start, mach_absolute_time());
+
+    testprintf("small pool push/pop %llu ns; %d-object pool: "
+               "autorelease %llu ns each, drain %llu ns each\n",
+               pushPopTime / SMALL_POOLS, COUNT, fillTime / COUNT,
+               drainTime / COUNT);
+
+    testassert([obj retainCount] == 1);
+    [obj release];
+    free(objs);
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,103 @@
+// TEST_CONFIG
+
+// class_conformsToProtocol() caches its answers.
+// Check that class_addProtocol() and class disposal invalidate them,
+// and report the cost of repeated checks on a deep protocol hierarchy.
+
+#include "test.h"
+#include "testroot.i"
+#include <objc/runtime.h>
+
+#define ITERATIONS 1000
+
+@protocol P0 @end
+@protocol P1 <P0> @end
+@protocol P2 <P1> @end
+@protocol P3 <P2> @end
+@protocol P4 <P3> @end
+@protocol P5 <P4> @end
+@protocol P6 <P5> @end
+@protocol P7 <P6> @end
+@protocol P8 <P7> @end
+@protocol P9 <P8> @end
+@protocol P10 <P9> @end
+@protocol P11 <P10> @end
+@protocol P12 <P11> @end
+@protocol P13 <P12> @end
+@protocol P14 <P13> @end
+@protocol P15 <P14> @end
+
+@protocol Q0 @end
+@protocol Q1 @end
+@protocol Q2 @end
+@protocol Q3 @end
+@protocol Q4 @end
+@protocol Q5 @end
+@protocol Q6 @end
+@protocol Q7 @end
+
+@protocol Unadopted @end
+@protocol Added @end
+
+@interface Deep : TestRoot <Q0, Q1, Q2, Q3, Q4, Q5, Q6, Q7, P15> @end
+@implementation Deep @end
+
+static void timeConformance(Class cls, Protocol *proto, BOOL expected,
+                            const char *name)
+{
+    // First call fills the cache.
+    uint64_t start = mach_absolute_time();
+    testassert(class_conformsToProtocol(cls, proto) == expected);
+    uint64_t first = nanoseconds(start, mach_absolute_time());
+
+    start = mach_absolute_time();
+    for (int i = 0; i < ITERATIONS; i++) {
+        testassert(class_conformsToProtocol(cls, proto) == expected);
+    }
+    uint64_t repeated = nanoseconds(start, mach_absolute_time());
+
+    testprintf("%s: first check %llu ns, then %llu ns per check\n",
+               name, first, repeated / ITERATIONS);
+}
+
+int main()
+{
+    Class deep = [Deep class];
+
+    timeConformance(deep, @protocol(P0), YES, "deepest inherited protocol");
+    timeConformance(deep, @protocol(P15), YES, "adopted protocol");
+    timeConformance(deep, @protocol(Unadopted), NO, "unadopted protocol");
+
+    // Every protocol in the hierarchy is found, before and after caching.
+    Protocol *chain[] = {
+        @protocol(P0), @protocol(P1), @protocol(P2), @protocol(P3),
+        @protocol(P4), @protocol(P5), @protocol(P6), @protocol(P7),
+        @protocol(P8), @protocol(P9), @protocol(P10), @protocol(P11),
+        @protocol(P12), @protocol(P13), @protocol(P14), @protocol(P15),
+        @protocol(Q0), @protocol(Q7),
+    };
+    for (int pass = 0; pass < 2; pass++) {
+        for (size_t i = 0; i < sizeof(chain)/sizeof(chain[0]); i++) {
+            testassert(class_conformsToProtocol(deep, chain[i]));
+        }
+    }
+
+    // class_addProtocol() invalidates a cached NO.
+    testassert(!class_conformsToProtocol(deep, @protocol(Added)));
+    testassert(class_addProtocol(deep, @protocol(Added)));
+    testassert(class_conformsToProtocol(deep, @protocol(Added)));
+    testassert(class_conformsToProtocol(deep, @protocol(P0)));
+
+    // Disposing a class invalidates its answers, even if a new
+    // class is allocated at the same address.
+    for (int i = 0; i < 16; i++) {
+        Class cls = objc_allocateClassPair([TestRoot class], "Disposable", 0);
+        testassert(cls);
+        if (i % 2 == 0) class_addProtocol(cls, @protocol(P0));
+        objc_registerClassPair(cls);
+        testassert(class_conformsToProtocol(cls, @protocol(P0)) == (i%2 == 0));
+        objc_disposeClassPair(cls);
+    }
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,17 @@
+// Protocols defined identically in protocolIdentity.m 
+// and protocolIdentity2.dylib. Each image gets its own protocol_t.
+
+#include "test.h"
+
+@protocol Shared0 @end
+@protocol Shared1 <Shared0> @end
+@protocol Shared2 <Shared1> @end
+@protocol Shared3 <Shared2> @end
+@protocol Shared4 <Shared3> @end
+@protocol Shared5 <Shared4> @end
+@protocol Shared6 <Shared5> @end
+@protocol Shared7 <Shared6> @end
+
+@interface SharedAdopter : TestRoot <Shared7> @end
+
+extern Protocol *dylibSharedProtocol(int n);
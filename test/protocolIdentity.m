@@ -0,0 +1,58 @@
+/*
+TEST_BUILD
+    $C{COMPILE} -undefined dynamic_lookup -dynamiclib $DIR/protocolIdentity2.m -o protocolIdentity2.dylib
+    $C{COMPILE} $DIR/protocolIdentity.m -x none protocolIdentity2.dylib -o protocolIdentity.out
+END
+*/
+
+// Every image defines its own protocol_t for the protocols it uses. 
+// The runtime picks one canonical protocol per name, so protocols 
+// from different images compare equal by pointer once remapped.
+
+#include "protocolIdentity.h"
+#include "testroot.i"
+#include <objc/runtime.h>
+
+#define ITERATIONS 1000
+
+int main()
+{
+    // @protocol() references are remapped to the canonical protocol.
+    testassert(@protocol(Shared0) == dylibSharedProtocol(0));
+    testassert(@protocol(Shared7) == dylibSharedProtocol(7));
+    testassert(@protocol(Shared0) == objc_getProtocol("Shared0"));
+
+    testassert(protocol_isEqual(@protocol(Shared7), dylibSharedProtocol(7)));
+    testassert(!protocol_isEqual(@protocol(Shared7), @protocol(Shared0)));
+
+    // Protocol lists written by the dylib are remapped too.
+    unsigned int count;
+    Protocol * __unsafe_unretained *protos = 
+        class_copyProtocolList([SharedAdopter class], &count);
+    testassert(count == 1);
+    testassert(protos[0] == @protocol(Shared7));
+    free(protos);
+
+    protos = protocol_copyProtocolList(@protocol(Shared7), &count);
+    testassert(count == 1);
+    testassert(protos[0] == @protocol(Shared6));
+    free(protos);
+
+    testassert(class_conformsToProtocol([SharedAdopter class], 
+                                        @protocol(Shared0)));
+    testassert(protocol_conformsToProtocol(@protocol(Shared7), 
+                                           @protocol(Shared0)));
+    testassert(!protocol_conformsToProtocol(@protocol(Shared0), 
+                                            @protocol(Shared7)));
+
+    // Time inherited conformance checks through the whole chain.
+    uint64_t start = mach_absolute_time();
+    for (int i = 0; i < ITERATIONS; i++) {
+        testassert(protocol_conformsToProtocol(@protocol(Shared7), 
+                                               @protocol(Shared0)));
+    }
+    testprintf("%llu ns per 8-deep protocol_conformsToProtocol()\n", 
+               nanoseconds(start, mach_absolute_time()) / ITERATIONS);
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,12 @@
+#include "protocolIdentity.h"
+
+@implementation SharedAdopter @end
+
+Protocol *dylibSharedProtocol(int n)
+{
+    switch (n) {
+    case 0: return @protocol(Shared0);
+    case 7: return @protocol(Shared7);
+    default: return nil;
+    }
+}
@@ -0,0 +1,58 @@
+/*
+TEST_CONFIG MEM=mrc
+TEST_ENV OBJC_DISABLE_NONPOINTER_ISA=YES OBJC_PRINT_HASH_STATISTICS=YES
+
+TEST_RUN_OUTPUT
+OK: refcountMap.m
+objc\[\d+\]: HASH: side table retain counts for .*
+(objc\[\d+\]: HASH: .*\n)*
+END
+*/
+
+// Side table retain count map throughput. With non-pointer isa disabled
+// every retain and release looks up the object in its stripe's map.
+// Grow the set of objects with side table entries through several sizes
+// and time random retain/release pairs at each size. The probe lengths
+// of the largest set are logged at exit.
+
+#include "test.h"
+#include <Foundation/NSObject.h>
+#include <objc/runtime.h>
+
+#define MAX_OBJECTS 10000
+#define OPERATIONS 20000
+
+int main()
+{
+    static const size_t sizes[] = { 10, 100, 1000, MAX_OBJECTS };
+    id *objs = (id *)calloc(MAX_OBJECTS, sizeof(id));
+    size_t live = 0;
+
+    for (size_t s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++) {
+        // Each object gets a side table entry by being retained once.
+        for ( ; live < sizes[s]; live++) {
+            objs[live] = [NSObject new];
+            objc_retain(objs[live]);
+        }
+
+        uint32_t seed = 1;
+        uint64_t start = mach_absolute_time();
+        for (int i = 0; i < OPERATIONS; i++) {
+            seed = seed * 1103515245 + 12345;
+            id obj = objs[seed % live];
+            objc_retain(obj);
+            objc_release(obj);
+        }
+        uint64_t elapsed = nanoseconds(start, mach_absolute_time());
+
+        testprintf("%7zu objects in side tables: %llu ns per retain+release\n",
+                   live, elapsed / OPERATIONS);
+    }
+
+    for (size_t i = 0; i < live; i++) {
+        testassert([objs[i] retainCount] == 2);
+    }
+
+    // The largest set stays alive so the exit statistics describe it.
+    succeed(__FILE__);
+}
@@ -0,0 +1,93 @@
+/*
+TEST_CONFIG MEM=mrc
+TEST_ENV OBJC_DISABLE_NONPOINTER_ISA=YES
+*/
+
+// Side table retain count maps shrink after a burst.
+// With non-pointer isa disabled every retained object gets a side table
+// entry. Retain a million objects, release them back to a zero count,
+// then deallocate most of them. The survivors' entries hold zero and
+// are purgeable, so the maps should shrink well below their high-water
+// size even though more than 1/16 of their entries remain.
+// Map memory and resident size are logged for each phase.
+
+#include "test.h"
+#include <Foundation/NSObject.h>
+#include <objc/runtime.h>
+#include <objc/objc-internal.h>
+#include <mach/mach.h>
+
+#define COUNT 1000000
+// One object in KEEP survives the burst.
+#define KEEP 5
+
+static size_t refcountBytes(void)
+{
+    unsigned int count;
+    size_t bytes = 0;
+    objc_memory_statistic_t *stats = objc_copyMemoryStatistics(&count);
+    for (unsigned int i = 0; i < count; i++) {
+        if (0 == strcmp(stats[i].name, "retain count tables")) {
+            bytes = stats[i].bytes;
+        }
+    }
+    free(stats);
+    return bytes;
+}
+
+static size_t residentBytes(void)
+{
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    kern_return_t kr = task_info(mach_task_self(), MACH_TASK_BASIC_INFO,
+                                 (task_info_t)&info, &count);
+    testassert(kr == KERN_SUCCESS);
+    return info.resident_size;
+}
+
+static void report(const char *phase)
+{
+    testprintf("%-6s retain count tables %8zu KB, resident %8zu KB\n",
+               phase, refcountBytes() / 1024, residentBytes() / 1024);
+}
+
+int main()
+{
+    id *objs = (id *)calloc(COUNT, sizeof(id));
+    report("start");
+
+    // Burst: every object gets a side table entry.
+    for (size_t i = 0; i < COUNT; i++) {
+        objs[i] = [NSObject new];
+        objc_retain(objs[i]);
+    }
+    size_t peak = refcountBytes();
+    report("burst");
+
+    // The extra retains go away, leaving zero-valued entries behind.
+    for (size_t i = 0; i < COUNT; i++) {
+        objc_release(objs[i]);
+    }
+
+    // Most objects deallocate, erasing their entries.
+    for (size_t i = 0; i < COUNT; i++) {
+        if (i % KEEP) objc_release(objs[i]);
+    }
+    size_t idle = refcountBytes();
+    report("idle");
+
+    testassert(idle < peak / 8);
+
+    for (size_t i = 0; i < COUNT; i += KEEP) {
+        testassert([objs[i] retainCount] == 1);
+        objc_retain(objs[i]);
+        testassert([objs[i] retainCount] == 2);
+        objc_release(objs[i]);
+        objc_release(objs[i]);
+    }
+    report("end");
+
+    free(objs);
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,123 @@
+// TEST_CONFIG MEM=mrc
+
+// objc_retainBatch() and objc_releaseBatch() behave like calling
+// objc_retain() and objc_release() on each object. Check counts for
+// inline and side table retain counts, custom RR, nil, and duplicates,
+// and compare tearing down a large array one object at a time, in one
+// batch, and by draining an autorelease pool.
+
+#include "test.h"
+#include <Foundation/NSObject.h>
+#include <objc/runtime.h>
+#include <objc/objc-internal.h>
+
+#define COUNT 10000
+// Enough retains to overflow the inline retain count into the side table.
+#define DEEP (2*RC_HALF + 1)
+// Enough objects to use most side table stripes.
+#define STRIPED 64
+
+static int deallocs;
+static int customRetains;
+static int customReleases;
+
+@interface Counted : NSObject @end
+@implementation Counted
+-(void)dealloc { deallocs++; [super dealloc]; }
+@end
+
+@interface Custom : Counted @end
+@implementation Custom
+-(id)retain { customRetains++; return [super retain]; }
+-(oneway void)release { customReleases++; [super release]; }
+@end
+
+static void fill(id *objs, size_t count)
+{
+    for (size_t i = 0; i < count; i++) objs[i] = [Counted new];
+}
+
+int main()
+{
+    // Basic counts, with nil and a repeated object.
+    deallocs = 0;
+    id a = [Counted new];
+    id b = [Custom new];
+    id objs[] = { a, nil, b, a, a };
+    size_t n = sizeof(objs)/sizeof(objs[0]);
+    objc_retainBatch(objs, n);
+    testassert([a retainCount] == 4);
+    testassert([b retainCount] == 2);
+    testassert(customRetains == 1);
+    objc_releaseBatch(objs, n);
+    testassert([a retainCount] == 1);
+    testassert([b retainCount] == 1);
+    testassert(customReleases == 1);
+    testassert(deallocs == 0);
+    objc_releaseBatch(objs, 3);
+    testassert(deallocs == 2);
+    testassert(customReleases == 2);
+
+    // Retain counts that overflow into the side table,
+    // with the last release deallocating.
+    id weak = nil;
+    id *deep = (id *)calloc(DEEP, sizeof(id));
+    id obj = [Counted new];
+    objc_storeWeak(&weak, obj);
+    for (size_t i = 0; i < DEEP; i++) deep[i] = obj;
+    objc_retainBatch(deep, DEEP);
+    objc_retainBatch(deep, DEEP);
+    testassert([obj retainCount] == 2*DEEP + 1);
+    objc_releaseBatch(deep, DEEP);
+    testassert([obj retainCount] == DEEP + 1);
+    deallocs = 0;
+    objc_releaseBatch(deep, DEEP);
+    objc_releaseBatch(deep, 1);
+    testassert(deallocs == 1);
+    testassert(objc_loadWeak(&weak) == nil);
+    free(deep);
+
+    // Many distinct objects across every side table stripe.
+    id *many = (id *)calloc(COUNT, sizeof(id));
+    fill(many, COUNT);
+    for (size_t i = 0; i < DEEP; i++) objc_retainBatch(many, STRIPED);
+    testassert([many[0] retainCount] == DEEP + 1);
+    testassert([many[STRIPED-1] retainCount] == DEEP + 1);
+    for (size_t i = 0; i < DEEP; i++) objc_releaseBatch(many, STRIPED);
+    testassert([many[0] retainCount] == 1);
+    testassert([many[STRIPED-1] retainCount] == 1);
+
+    // Teardown, one at a time.
+    deallocs = 0;
+    uint64_t start = mach_absolute_time();
+    for (size_t i = 0; i < COUNT; i++) objc_release(many[i]);
+    uint64_t singleTime = nanoseconds(start, mach_absolute_time());
+    testassert(deallocs == COUNT);
+
+    // Teardown, batched.
+    fill(many, COUNT);
+    deallocs = 0;
+    start = mach_absolute_time();
+    objc_releaseBatch(many, COUNT);
+    uint64_t batchTime = nanoseconds(start, mach_absolute_time());
+    testassert(deallocs == COUNT);
+
+    // Autorelease pool drain, which releases in batches.
+    fill(many, COUNT);
+    deallocs = 0;
+    void *pool = objc_autoreleasePoolPush();
+    for (size_t i = 0; i < COUNT; i++) objc_autorelease(many[i]);
+    start = mach_absolute_time();
+    objc_autoreleasePoolPop(pool);
+    uint64_t poolTime = nanoseconds(start, mach_absolute_time());
+    testassert(deallocs == COUNT);
+
+    testprintf("%d-object teardown: objc_release %llu ns, "
+               "objc_releaseBatch %llu ns, pool pop %llu ns per object\n",
+               COUNT, singleTime / COUNT, batchTime / COUNT, 
+               poolTime / COUNT);
+
+    free(many);
+
+    succeed(__FILE__);
+}
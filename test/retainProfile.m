@@ -0,0 +1,107 @@
+/*
+TEST_CONFIG MEM=mrc
+TEST_ENV OBJC_PRINT_RETAIN_PROFILE=YES
+
+TEST_RUN_OUTPUT
+OK: retainProfile.m
+objc\[\d+\]: RETAIN: retain/release profile for .*
+(objc\[\d+\]: RETAIN: .*\n)*
+END
+*/
+
+// Retain profiler. Several threads hammer one shared object and retain
+// their own objects less often. The shared object and its class must
+// top the profile, whether read while the threads run or after they
+// have exited and their samples were merged.
+
+#include "test.h"
+#include <Foundation/NSObject.h>
+#include <objc/runtime.h>
+#include <objc/objc-internal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <libkern/OSAtomic.h>
+
+#define THREADS 8
+#define ITERATIONS 200000
+#define COLD 16
+
+@interface Hot : NSObject @end
+@implementation Hot @end
+
+@interface Cold : NSObject @end
+@implementation Cold @end
+
+static Hot *hot;
+static volatile int32_t finished;
+static volatile int32_t proceed;
+
+static void *worker(void *arg __unused)
+{
+    Cold *cold[COLD];
+    for (int i = 0; i < COLD; i++) cold[i] = [Cold new];
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        objc_retain(hot);
+        objc_release(hot);
+        if (i % 8 == 0) {
+            Cold *obj = cold[(i / 8) % COLD];
+            objc_retain(obj);
+            objc_release(obj);
+        }
+    }
+
+    // Let the main thread read the profile while every thread is alive.
+    OSAtomicIncrement32(&finished);
+    while (!proceed) sched_yield();
+
+    for (int i = 0; i < COLD; i++) [cold[i] release];
+    return NULL;
+}
+
+static void check(const char *when)
+{
+    unsigned int count;
+    objc_retain_profile_entry_t *objects = objc_copyRetainProfile(NO, &count);
+    testassert(objects);
+    testassert(count > 1);
+    testassert(objects[0].object == hot);
+    testassert(0 == strcmp(objects[0].className, "Hot"));
+    for (unsigned int i = 1; i < count; i++) {
+        testassert(objects[i].samples <= objects[i-1].samples);
+    }
+    testprintf("%s: hot object %llu samples, %llu CAS retries, "
+               "%llu lock waits\n", when, objects[0].samples,
+               objects[0].casRetries, objects[0].lockWaits);
+    free(objects);
+
+    objc_retain_profile_entry_t *classes = objc_copyRetainProfile(YES, &count);
+    testassert(classes);
+    testassert(count > 1);
+    testassert(classes[0].object == NULL);
+    testassert(0 == strcmp(classes[0].className, "Hot"));
+    free(classes);
+}
+
+int main()
+{
+    hot = [Hot new];
+
+    pthread_t threads[THREADS];
+    for (int i = 0; i < THREADS; i++) {
+        testassert(0 == pthread_create(&threads[i], NULL, worker, NULL));
+    }
+
+    while (finished < THREADS) sched_yield();
+    check("running");
+    proceed = 1;
+
+    for (int i = 0; i < THREADS; i++) {
+        testassert(0 == pthread_join(threads[i], NULL));
+    }
+    check("exited");
+
+    [hot release];
+
+    succeed(__FILE__);
+}
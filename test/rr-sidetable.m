@@ -12,11 +12,6 @@
 #define OBJECTS 1
 #define LOOPS 256
 #define THREADS 16
-#if __x86_64__
-#   define RC_HALF  (1ULL<<7)
-#else
-#   error sorry
-#endif
 #define RC_DELTA RC_HALF
 
 static bool Deallocated = false;
@@ -0,0 +1,124 @@
+// TEST_CONFIG
+
+// Classes read their method, property, and protocol lists from class_ro_t
+// until something changes them. Check that lists stay correct across
+// categories, class_addMethod, class_addProtocol, class_addProperty,
+// and objc_duplicateClass, and report the heap cost of realizing classes.
+
+#include "test.h"
+#include "testroot.i"
+#include <objc/runtime.h>
+
+#define CLASSES 64
+
+@protocol Proto @end
+@protocol AddedProto @end
+
+#define C(n)                                                            \
+    @interface Plain##n : TestRoot <Proto> { int ivar; }                \
+    @property int prop;                                                 \
+    @end                                                                \
+    @implementation Plain##n                                            \
+    @synthesize prop = ivar;                                            \
+    -(int)base { return n; }                                            \
+    +(int)base { return n; }                                            \
+    @end
+#define C8(n) C(n##0) C(n##1) C(n##2) C(n##3) C(n##4) C(n##5) C(n##6) C(n##7)
+C8(1) C8(2) C8(3) C8(4) C8(5) C8(6) C8(7) C8(8)
+
+@interface Changed : TestRoot <Proto> @end
+@implementation Changed
+-(int)base { return 1; }
+-(int)replaced { return 1; }
+@end
+
+@interface Changed (Cat) @end
+@implementation Changed (Cat)
+-(int)cat { return 2; }
+-(int)replaced { return 2; }
+@end
+
+static int addedImp(id self __unused, SEL _cmd __unused) { return 3; }
+
+static unsigned methodCount(Class cls)
+{
+    unsigned int count;
+    free(class_copyMethodList(cls, &count));
+    return count;
+}
+
+static int call(Class cls, const char *name)
+{
+    Method m = class_getInstanceMethod(cls, sel_registerName(name));
+    testassert(m);
+    return ((int(*)(id, SEL))method_getImplementation(m))(nil, 0);
+}
+
+int main()
+{
+    // Report the cost of realizing classes that are never changed.
+    size_t before = leak_inuse();
+    for (int i = 0; i < CLASSES; i++) {
+        char name[16];
+        snprintf(name, sizeof(name), "Plain%d%d", i/8 + 1, i%8);
+        Class cls = objc_getClass(name);
+        testassert(cls);
+    }
+    size_t after = leak_inuse();
+    testprintf("%zu bytes for %d unchanged classes (%zu per class)\n",
+               after - before, CLASSES, (after - before) / CLASSES);
+
+    // Unchanged classes see their base lists.
+    Class plain = objc_getClass("Plain10");
+    testassert(methodCount(plain) == 3);  // base, prop, setProp:
+    testassert(call(plain, "base") == 10);
+    testassert(class_conformsToProtocol(plain, @protocol(Proto)));
+    testassert(class_getProperty(plain, "prop"));
+    unsigned int count;
+    free(class_copyPropertyList(plain, &count));
+    testassert(count == 1);
+    free(class_copyProtocolList(plain, &count));
+    testassert(count == 1);
+
+    // Category lists go in front of the base lists.
+    Class changed = objc_getClass("Changed");
+    testassert(methodCount(changed) == 4);
+    testassert(call(changed, "base") == 1);
+    testassert(call(changed, "cat") == 2);
+    testassert(call(changed, "replaced") == 2);
+
+    // Changing an unchanged class keeps its base lists.
+    testassert(class_addMethod(plain, sel_registerName("added"), (IMP)addedImp, "i@:"));
+    testassert(methodCount(plain) == 4);
+    testassert(call(plain, "added") == 3);
+    testassert(call(plain, "base") == 10);
+
+    Class plain2 = objc_getClass("Plain11");
+    testassert(class_addProtocol(plain2, @protocol(AddedProto)));
+    testassert(class_conformsToProtocol(plain2, @protocol(AddedProto)));
+    testassert(class_conformsToProtocol(plain2, @protocol(Proto)));
+    free(class_copyProtocolList(plain2, &count));
+    testassert(count == 2);
+    testassert(methodCount(plain2) == 3);
+
+    Class plain3 = objc_getClass("Plain12");
+    objc_property_attribute_t attr = { "T", "i" };
+    testassert(class_addProperty(plain3, "added", &attr, 1));
+    testassert(class_getProperty(plain3, "added"));
+    testassert(class_getProperty(plain3, "prop"));
+    free(class_copyPropertyList(plain3, &count));
+    testassert(count == 2);
+
+    // Duplicates of unchanged classes get their own method lists.
+    Class plain4 = objc_getClass("Plain13");
+    Class dup = objc_duplicateClass(plain4, "Plain13Dup", 0);
+    testassert(dup);
+    testassert(methodCount(dup) == 3);
+    Method m = class_getInstanceMethod(dup, @selector(base));
+    testassert(m);
+    method_setImplementation(m, (IMP)addedImp);
+    testassert(call(dup, "base") == 3);
+    testassert(call(plain4, "base") == 13);
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,113 @@
+// TEST_CONFIG MEM=mrc
+// TEST_ENV OBJC_DISABLE_NONPOINTER_ISA=YES
+
+// Side table and other striped locks are chosen by address hash, so
+// threads working on unrelated objects should rarely share a lock.
+// Each thread retains, releases, and weakly stores its own objects;
+// report throughput from 1 to 192 threads and check the results.
+
+#include "test.h"
+#include "testroot.i"
+#include <objc/runtime.h>
+#include <objc/objc-internal.h>
+#include <pthread.h>
+
+#define MAX_THREADS 192
+#define OBJECTS 16
+// Non-pointer isa is disabled, so every retain uses the side table.
+#define RETAINS 100
+#define WEAK_STORES 2000
+
+@interface Striped : TestRoot @end
+@implementation Striped @end
+
+static pthread_mutex_t startLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t startCond = PTHREAD_COND_INITIALIZER;
+static bool started;
+static int mode;  // 0: retain/release, 1: weak store
+
+static void waitForStart(void)
+{
+    pthread_mutex_lock(&startLock);
+    while (!started) pthread_cond_wait(&startCond, &startLock);
+    pthread_mutex_unlock(&startLock);
+}
+
+static void *worker(void *arg __unused)
+{
+    id objs[OBJECTS];
+    for (int i = 0; i < OBJECTS; i++) {
+        objs[i] = [Striped new];
+    }
+    id *weaks = (id *)calloc(OBJECTS, sizeof(id));
+
+    waitForStart();
+
+    if (mode == 0) {
+        for (int i = 0; i < OBJECTS; i++) {
+            for (int j = 0; j < RETAINS; j++) objc_retain(objs[i]);
+            for (int j = 0; j < RETAINS; j++) objc_release(objs[i]);
+        }
+    } else {
+        for (int j = 0; j < WEAK_STORES; j++) {
+            int i = j % OBJECTS;
+            objc_storeWeak(&weaks[i], objs[i]);
+            objc_storeWeak(&weaks[i], nil);
+        }
+    }
+
+    for (int i = 0; i < OBJECTS; i++) {
+        testassert([objs[i] retainCount] == 1);
+        objc_storeWeak(&weaks[i], objs[i]);
+    }
+    for (int i = 0; i < OBJECTS; i++) {
+        [objs[i] release];
+        testassert(weaks[i] == nil);
+    }
+    free(weaks);
+
+    return NULL;
+}
+
+static uint64_t run(int threadCount, int whichMode)
+{
+    pthread_t threads[MAX_THREADS];
+    started = false;
+    mode = whichMode;
+
+    for (int i = 0; i < threadCount; i++) {
+        testassert(0 == pthread_create(&threads[i], NULL, worker, NULL));
+    }
+
+    uint64_t start = mach_absolute_time();
+    pthread_mutex_lock(&startLock);
+    started = true;
+    pthread_cond_broadcast(&startCond);
+    pthread_mutex_unlock(&startLock);
+
+    for (int i = 0; i < threadCount; i++) {
+        testassert(0 == pthread_join(threads[i], NULL));
+    }
+    return nanoseconds(start, mach_absolute_time());
+}
+
+int main()
+{
+    static const int threadCounts[] = { 1, 2, 4, 8, 16, 32, 64, 128, 192 };
+
+    TestRootDealloc = 0;
+    int total = 0;
+    for (size_t i = 0; i < sizeof(threadCounts)/sizeof(threadCounts[0]); i++) {
+        int n = threadCounts[i];
+        uint64_t rr = run(n, 0);
+        uint64_t weak = run(n, 1);
+        total += 2 * n * OBJECTS;
+        testprintf("%3d threads: retain/release %6llu ns/op  "
+                   "weak store %6llu ns/op\n", n,
+                   rr / (2ULL * RETAINS * OBJECTS),
+                   weak / (2ULL * WEAK_STORES));
+    }
+    testassert(TestRootDealloc == total);
+
+    succeed(__FILE__);
+}
@@ -43,6 +43,16 @@ static OBJC_INLINE malloc_zone_t *objc_collectableZone(void) { return nil; }
 #   error unknown architecture
 #endif
 
+// RC_HALF from objc-private.h: half the range of a nonpointer isa's 
+// inline retain count. 2*RC_HALF retains overflow into the side table.
+#if !SUPPORT_NONPOINTER_ISA
+#   define RC_HALF  1ULL  // every retain count is in the side table
+#elif __x86_64__
+#   define RC_HALF  (1ULL<<7)
+#elif __arm64__
+#   define RC_HALF  (1ULL<<18)
+#endif
+
 
 // Test output
 
@@ -96,6 +106,14 @@ static inline void fail(const char *msg, ...)
                    name, (uint64_t)(time), (uint64_t)(fast), (uint64_t)(slow)); \
     }
 
+/* nanoseconds between two mach_absolute_time() readings */
+static inline uint64_t nanoseconds(uint64_t start, uint64_t end)
+{
+    static mach_timebase_info_data_t info;
+    if (info.denom == 0) mach_timebase_info(&info);
+    return (end - start) * info.numer / info.denom;
+}
+
 
 static inline void testprintf(const char *msg, ...)
 {
@@ -0,0 +1,110 @@
+// TEST_CONFIG MEM=mrc
+
+// objc_releaseBatch() clears the weak references of the objects it
+// deallocates in one pass per side table stripe, before sending -dealloc.
+// Check that every weak variable is cleared, that -dealloc sees its own
+// weak variables already nil, and that objects with side table retain
+// counts are handled, and compare tearing down many weakly-referenced
+// objects one at a time, in one batch, and by draining a pool.
+
+#include "test.h"
+#include <Foundation/NSObject.h>
+#include <objc/runtime.h>
+#include <objc/objc-internal.h>
+
+#define COUNT 10000
+#define WEAKS 2
+// Enough retains to overflow the inline retain count into the side table.
+#define DEEP (2*RC_HALF + 1)
+
+static int deallocs;
+static int weakStillSet;
+
+@interface Watched : NSObject {
+@public
+    id *weak;
+}
+@end
+@implementation Watched
+-(void)dealloc {
+    deallocs++;
+    if (weak  &&  objc_loadWeak(weak)) weakStillSet++;
+    [super dealloc];
+}
+@end
+
+static void fill(id *objs, id *weaks, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        Watched *obj = [Watched new];
+        obj->weak = &weaks[i*WEAKS];
+        for (size_t j = 0; j < WEAKS; j++) {
+            objc_storeWeak(&weaks[i*WEAKS + j], obj);
+        }
+        objs[i] = obj;
+    }
+}
+
+static void check(id *weaks, size_t count)
+{
+    testassert(deallocs == (int)count);
+    testassert(weakStillSet == 0);
+    for (size_t i = 0; i < count * WEAKS; i++) testassert(weaks[i] == nil);
+    deallocs = 0;
+}
+
+int main()
+{
+    id *objs = (id *)calloc(COUNT, sizeof(id));
+    id *weaks = (id *)calloc(COUNT * WEAKS, sizeof(id));
+
+    // Weakly-referenced objects mixed with plain ones, nil, and an
+    // object whose retain count lives partly in the side table.
+    id weak = nil;
+    Watched *deep = [Watched new];
+    objc_storeWeak(&weak, deep);
+    for (size_t i = 0; i < DEEP; i++) [deep retain];
+    for (size_t i = 0; i < DEEP; i++) [deep release];
+    Watched *plain = [Watched new];
+    fill(objs, weaks, 4);
+    id mixed[] = { objs[0], plain, nil, objs[1], deep, objs[2], objs[3] };
+    objc_releaseBatch(mixed, sizeof(mixed)/sizeof(mixed[0]));
+    testassert(deallocs == 6);
+    testassert(weakStillSet == 0);
+    testassert(weak == nil);
+    for (size_t i = 0; i < 4 * WEAKS; i++) testassert(weaks[i] == nil);
+    deallocs = 0;
+
+    // Teardown one at a time.
+    fill(objs, weaks, COUNT);
+    uint64_t start = mach_absolute_time();
+    for (size_t i = 0; i < COUNT; i++) objc_release(objs[i]);
+    uint64_t singleTime = nanoseconds(start, mach_absolute_time());
+    check(weaks, COUNT);
+
+    // Teardown batched.
+    fill(objs, weaks, COUNT);
+    start = mach_absolute_time();
+    objc_releaseBatch(objs, COUNT);
+    uint64_t batchTime = nanoseconds(start, mach_absolute_time());
+    check(weaks, COUNT);
+
+    // Autorelease pool drain, which releases in batches.
+    fill(objs, weaks, COUNT);
+    void *pool = objc_autoreleasePoolPush();
+    for (size_t i = 0; i < COUNT; i++) objc_autorelease(objs[i]);
+    start = mach_absolute_time();
+    objc_autoreleasePoolPop(pool);
+    uint64_t poolTime = nanoseconds(start, mach_absolute_time());
+    check(weaks, COUNT);
+
+    testprintf("%d weakly-referenced objects: objc_release %llu ns, "
+               "objc_releaseBatch %llu ns, pool pop %llu ns per object\n",
+               COUNT, singleTime / COUNT, batchTime / COUNT, 
+               poolTime / COUNT);
+
+    free(weaks);
+    free(objs);
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,109 @@
+// TEST_CONFIG MEM=mrc
+
+// Many threads loading the same weak variable, as with a shared weak
+// delegate. Loads do not take the side table lock, so they should scale
+// with the number of readers. Then race the readers against deallocation
+// of the object the variable refers to: every load must return either
+// nil or a live object.
+
+#include "test.h"
+#include <Foundation/NSObject.h>
+#include <objc/runtime.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <libkern/OSAtomic.h>
+
+#define MAX_READERS 16
+#define LOADS 10000
+#define CYCLES 20000
+
+@interface Delegate : NSObject {
+@public
+    int alive;
+}
+@end
+@implementation Delegate
+-(id)init { self = [super init]; alive = 1; return self; }
+-(void)dealloc { alive = 0; [super dealloc]; }
+@end
+
+static id weakDelegate;
+static Delegate *delegate;
+static volatile int32_t started;
+static volatile int32_t stop;
+static volatile int32_t nonNil;
+
+static void *reader(void *arg __unused)
+{
+    OSAtomicIncrement32(&started);
+    for (int i = 0; i < LOADS; i++) {
+        id obj = objc_loadWeakRetained(&weakDelegate);
+        testassert(obj == delegate);
+        objc_release(obj);
+    }
+    return NULL;
+}
+
+static void *racer(void *arg __unused)
+{
+    OSAtomicIncrement32(&started);
+    while (!stop) {
+        Delegate *obj = objc_loadWeakRetained(&weakDelegate);
+        if (obj) {
+            testassert(obj->alive);
+            OSAtomicIncrement32(&nonNil);
+            objc_release(obj);
+        }
+    }
+    return NULL;
+}
+
+static uint64_t run(void *(*fn)(void *), int count)
+{
+    pthread_t threads[MAX_READERS];
+    started = 0;
+    uint64_t start = mach_absolute_time();
+    for (int i = 0; i < count; i++) {
+        testassert(0 == pthread_create(&threads[i], NULL, fn, NULL));
+    }
+    if (fn == racer) {
+        while (started < count) sched_yield();
+        for (int i = 0; i < CYCLES; i++) {
+            Delegate *obj = [Delegate new];
+            objc_storeWeak(&weakDelegate, obj);
+            [obj release];
+            testassert(weakDelegate == nil);
+        }
+        stop = 1;
+    }
+    for (int i = 0; i < count; i++) {
+        testassert(0 == pthread_join(threads[i], NULL));
+    }
+    return nanoseconds(start, mach_absolute_time());
+}
+
+int main()
+{
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int maxReaders = cpus < MAX_READERS ? (int)cpus : MAX_READERS;
+
+    delegate = [Delegate new];
+    objc_storeWeak(&weakDelegate, delegate);
+
+    for (int readers = 1; readers <= maxReaders; readers *= 2) {
+        uint64_t elapsed = run(reader, readers);
+        testprintf("%2d readers: %llu ns per load\n",
+                   readers, elapsed / LOADS);
+    }
+    testassert([delegate retainCount] == 1);
+
+    [delegate release];
+    testassert(weakDelegate == nil);
+    delegate = nil;
+
+    run(racer, maxReaders);
+    testprintf("%d non-nil loads racing %d deallocations\n", nonNil, CYCLES);
+
+    succeed(__FILE__);
+}
@@ -0,0 +1,135 @@
+// TEST_CONFIG MEM=mrc
+
+// Weak table throughput with many weakly-referenced objects, with
+// one object referenced from many weak variables, and with objects
+// referenced from a few dozen weak variables each. Time objc_storeWeak(),
+// objc_loadWeakRetained(), and the clearing done by dealloc, and check
+// that every weak variable reads the right object and is cleared.
+
+#include "test.h"
+#include <Foundation/NSObject.h>
+#include <objc/runtime.h>
+
+#define OBJECTS 10000
+#define REFERRERS 2000
+
+int main()
+{
+    id *objs = (id *)calloc(OBJECTS, sizeof(id));
+    id *weaks = (id *)calloc(OBJECTS, sizeof(id));
+    for (size_t i = 0; i < OBJECTS; i++) objs[i] = [NSObject new];
+
+    // One weak variable per object.
+    uint64_t start = mach_absolute_time();
+    for (size_t i = 0; i < OBJECTS; i++) objc_storeWeak(&weaks[i], objs[i]);
+    uint64_t storeTime = nanoseconds(start, mach_absolute_time());
+
+    start = mach_absolute_time();
+    for (size_t i = 0; i < OBJECTS; i++) {
+        id obj = objc_loadWeakRetained(&weaks[i]);
+        testassert(obj == objs[i]);
+        objc_release(obj);
+    }
+    uint64_t loadTime = nanoseconds(start, mach_absolute_time());
+
+    // Moving a weak variable to an object that has no weak references
+    // yet looks up the old object and misses for the new one.
+    id *spare = (id *)calloc(OBJECTS, sizeof(id));
+    for (size_t i = 0; i < OBJECTS; i++) spare[i] = [NSObject new];
+    start = mach_absolute_time();
+    for (size_t i = 0; i < OBJECTS; i++) objc_storeWeak(&weaks[i], spare[i]);
+    for (size_t i = 0; i < OBJECTS; i++) objc_storeWeak(&weaks[i], objs[i]);
+    uint64_t moveTime = nanoseconds(start, mach_absolute_time());
+    for (size_t i = 0; i < OBJECTS; i++) [spare[i] release];
+    free(spare);
+
+    start = mach_absolute_time();
+    for (size_t i = 0; i < OBJECTS; i++) [objs[i] release];
+    uint64_t clearTime = nanoseconds(start, mach_absolute_time());
+    for (size_t i = 0; i < OBJECTS; i++) testassert(weaks[i] == nil);
+
+    testprintf("%d weakly-referenced objects: store %llu ns, "
+               "load %llu ns, move %llu ns, dealloc %llu ns\n", OBJECTS,
+               storeTime / OBJECTS, loadTime / OBJECTS,
+               moveTime / (2 * OBJECTS), clearTime / OBJECTS);
+
+    // Many weak variables for one object, half of them unregistered
+    // before the object deallocates.
+    id obj = [NSObject new];
+    start = mach_absolute_time();
+    for (size_t i = 0; i < REFERRERS; i++) objc_storeWeak(&weaks[i], obj);
+    storeTime = nanoseconds(start, mach_absolute_time());
+
+    start = mach_absolute_time();
+    for (size_t i = 0; i < REFERRERS; i++) {
+        id value = objc_loadWeakRetained(&weaks[i]);
+        testassert(value == obj);
+        objc_release(value);
+    }
+    loadTime = nanoseconds(start, mach_absolute_time());
+
+    start = mach_absolute_time();
+    for (size_t i = 0; i < REFERRERS; i += 2) objc_storeWeak(&weaks[i], nil);
+    uint64_t unregisterTime = nanoseconds(start, mach_absolute_time());
+
+    start = mach_absolute_time();
+    [obj release];
+    clearTime = nanoseconds(start, mach_absolute_time());
+    for (size_t i = 0; i < REFERRERS; i++) testassert(weaks[i] == nil);
+
+    testprintf("%d weak variables for one object: store %llu ns, "
+               "load %llu ns, unregister %llu ns, dealloc %llu us\n",
+               REFERRERS, storeTime / REFERRERS, loadTime / REFERRERS,
+               unregisterTime / (REFERRERS / 2), clearTime / 1000);
+
+    // Objects with a few to a few dozen weak variables each, as with
+    // observers and delegates. Small sets are kept in unhashed arrays.
+    static const size_t counts[] = { 2, 6, 12, 20, 40 };
+    for (size_t c = 0; c < sizeof(counts)/sizeof(counts[0]); c++) {
+        size_t perObject = counts[c];
+        size_t objects = OBJECTS / perObject;
+        for (size_t i = 0; i < objects; i++) objs[i] = [NSObject new];
+
+        start = mach_absolute_time();
+        for (size_t i = 0; i < objects; i++) {
+            for (size_t j = 0; j < perObject; j++) {
+                objc_storeWeak(&weaks[i*perObject + j], objs[i]);
+            }
+        }
+        storeTime = nanoseconds(start, mach_absolute_time());
+
+        // Unregister and re-register every other weak variable.
+        start = mach_absolute_time();
+        for (size_t i = 0; i < objects; i++) {
+            for (size_t j = 0; j < perObject; j += 2) {
+                objc_storeWeak(&weaks[i*perObject + j], nil);
+                objc_storeWeak(&weaks[i*perObject + j], objs[i]);
+            }
+        }
+        uint64_t restoreTime = nanoseconds(start, mach_absolute_time());
+
+        for (size_t i = 0; i < objects; i++) {
+            for (size_t j = 0; j < perObject; j++) {
+                testassert(weaks[i*perObject + j] == objs[i]);
+            }
+        }
+
+        start = mach_absolute_time();
+        for (size_t i = 0; i < objects; i++) [objs[i] release];
+        clearTime = nanoseconds(start, mach_absolute_time());
+        for (size_t i = 0; i < objects * perObject; i++) {
+            testassert(weaks[i] == nil);
+        }
+
+        size_t total = objects * perObject;
+        testprintf("%zu weak variables per object: store %llu ns, "
+                   "unregister and store %llu ns, dealloc %llu ns "
+                   "per variable\n", perObject, storeTime / total, 
+                   restoreTime / (total / 2), clearTime / total);
+    }
+
+    free(weaks);
+    free(objs);
+
+    succeed(__FILE__);
+}